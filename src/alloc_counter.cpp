@@ -0,0 +1,64 @@
+/**
+ * alloc_counter.cpp
+ * Debug hook counting heap allocations made by the process.
+ */
+
+#include "alloc_counter.h"
+
+#include <atomic>
+
+#ifdef PF_COUNT_ALLOCATIONS
+#include <stdlib.h>
+#include <new>
+#endif
+
+namespace {
+std::atomic<unsigned long> allocations(0);
+}  // namespace
+
+namespace alloc_counter {
+
+bool enabled() {
+#ifdef PF_COUNT_ALLOCATIONS
+  return true;
+#else
+  return false;
+#endif
+}
+
+unsigned long count() {
+  return allocations.load(std::memory_order_relaxed);
+}
+
+}  // namespace alloc_counter
+
+#ifdef PF_COUNT_ALLOCATIONS
+void* operator new(size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  void* p = malloc(size ? size : 1);
+  if (!p) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void* operator new[](size_t size) {
+  return operator new(size);
+}
+
+void operator delete(void* p) noexcept {
+  free(p);
+}
+
+void operator delete[](void* p) noexcept {
+  free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+  free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+  free(p);
+}
+#endif  // PF_COUNT_ALLOCATIONS
@@ -0,0 +1,27 @@
+/**
+ * alloc_counter.h
+ * Debug hook counting heap allocations made by the process.
+ *
+ * Building with PF_COUNT_ALLOCATIONS replaces the global operator new to
+ * bump a counter, which lets a driver check that the steady-state frame
+ * loop does not touch the heap. Without it the counter stays at zero.
+ */
+
+#ifndef ALLOC_COUNTER_H_
+#define ALLOC_COUNTER_H_
+
+namespace alloc_counter {
+
+/**
+ * enabled Returns whether allocation counting was compiled in.
+ */
+bool enabled();
+
+/**
+ * count Returns the number of operator new calls so far.
+ */
+unsigned long count();
+
+}  // namespace alloc_counter
+
+#endif  // ALLOC_COUNTER_H_
@@ -0,0 +1,118 @@
+/**
+ * association.cpp
+ * Nearest-neighbor data association between observations (in map
+ * coordinates) and the predicted landmark positions of a particle.
+ */
+
+#include "association.h"
+
+#include <algorithm>
+#include <limits>
+
+using std::vector;
+
+namespace {
+
+// Ranges this small are scanned linearly rather than split further
+const int kLeafSize = 8;
+
+inline bool closer(double d, int index, double best_d, int best) {
+  return d < best_d || (d == best_d && index < best);
+}
+
+struct AxisLess {
+  int axis;
+  template <typename Node>
+  bool operator()(const Node& a, const Node& b) const {
+    return axis == 0 ? a.x < b.x : a.y < b.y;
+  }
+};
+
+}  // namespace
+
+int nearestBruteForce(const vector<LandmarkObs>& predicted, double x,
+                      double y) {
+  double minDist = std::numeric_limits<double>::max();
+  int best = -1;
+  for (int k = 0 ; k < static_cast<int>(predicted.size()) ; k++) {
+    double xDist = x - predicted[k].x;
+    double yDist = y - predicted[k].y;
+    double distance = xDist*xDist + yDist*yDist;
+    if (distance < minDist) {
+      minDist = distance;
+      best = k;
+    }
+  }
+  return best;
+}
+
+void LandmarkKdTree::build(const vector<LandmarkObs>& predicted) {
+  nodes.resize(predicted.size());
+  for (size_t k = 0 ; k < predicted.size() ; k++) {
+    nodes[k].x = predicted[k].x;
+    nodes[k].y = predicted[k].y;
+    nodes[k].index = k;
+  }
+  buildRange(0, nodes.size(), 0);
+}
+
+void LandmarkKdTree::buildRange(int lo, int hi, int depth) {
+  if (hi - lo <= kLeafSize) {
+    return;
+  }
+  int mid = lo + (hi - lo) / 2;
+  AxisLess less;
+  less.axis = depth & 1;
+  std::nth_element(nodes.begin() + lo, nodes.begin() + mid, nodes.begin() + hi,
+                   less);
+  buildRange(lo, mid, depth + 1);
+  buildRange(mid + 1, hi, depth + 1);
+}
+
+int LandmarkKdTree::nearest(double x, double y) const {
+  int best = -1;
+  double best_d = std::numeric_limits<double>::max();
+  search(0, nodes.size(), 0, x, y, best_d, best);
+  return best;
+}
+
+void LandmarkKdTree::search(int lo, int hi, int depth, double x, double y,
+                            double& best_d, int& best) const {
+  if (hi - lo <= kLeafSize) {
+    for (int k = lo ; k < hi ; k++) {
+      double dx = x - nodes[k].x;
+      double dy = y - nodes[k].y;
+      double d = dx*dx + dy*dy;
+      if (closer(d, nodes[k].index, best_d, best)) {
+        best_d = d;
+        best = nodes[k].index;
+      }
+    }
+    return;
+  }
+
+  int mid = lo + (hi - lo) / 2;
+  const Node& node = nodes[mid];
+  double dx = x - node.x;
+  double dy = y - node.y;
+  double d = dx*dx + dy*dy;
+  if (closer(d, node.index, best_d, best)) {
+    best_d = d;
+    best = node.index;
+  }
+
+  // Descend into the query's side first, then the far side if the
+  //   splitting line is within the best distance (<= to honor ties)
+  double split = (depth & 1) ? dy : dx;
+  if (split < 0) {
+    search(lo, mid, depth + 1, x, y, best_d, best);
+    if (split * split <= best_d) {
+      search(mid + 1, hi, depth + 1, x, y, best_d, best);
+    }
+  } else {
+    search(mid + 1, hi, depth + 1, x, y, best_d, best);
+    if (split * split <= best_d) {
+      search(lo, mid, depth + 1, x, y, best_d, best);
+    }
+  }
+}
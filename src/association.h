@@ -0,0 +1,86 @@
+/**
+ * association.h
+ * Nearest-neighbor data association between observations (in map
+ * coordinates) and the predicted landmark positions of a particle.
+ */
+
+#ifndef ASSOCIATION_H_
+#define ASSOCIATION_H_
+
+#include <limits>
+#include <vector>
+#include "helper_functions.h"
+
+/**
+ * nearestBruteForce Returns the index of the prediction closest to (x, y),
+ *   or -1 if there are none. Ties go to the lowest index.
+ */
+int nearestBruteForce(const std::vector<LandmarkObs>& predicted, double x,
+                      double y);
+
+/**
+ * nearestResiduals Writes the residual of each of num_obs observations to
+ *   the nearest of num_lm landmarks, associated as by nearestBruteForce.
+ *   An observation with no landmark keeps its own coordinates, the
+ *   residual to (0, 0) ParticleFilter weighs unmatched observations by.
+ *   The landmark loop is outermost, so the inner loop updates independent
+ *   per-observation minima and vectorizes; best_d2 is scratch.
+ */
+template <typename Scalar>
+inline void nearestResiduals(const Scalar* map_x, const Scalar* map_y,
+                             int num_obs, const Scalar* lm_x,
+                             const Scalar* lm_y, int num_lm, Scalar* best_d2,
+                             Scalar* res_x, Scalar* res_y) {
+  for (int j = 0; j < num_obs; ++j) {
+    best_d2[j] = std::numeric_limits<Scalar>::max();
+    res_x[j] = map_x[j];
+    res_y[j] = map_y[j];
+  }
+  for (int k = 0; k < num_lm; ++k) {
+    const Scalar lx = lm_x[k];
+    const Scalar ly = lm_y[k];
+    for (int j = 0; j < num_obs; ++j) {
+      Scalar dx = map_x[j] - lx;
+      Scalar dy = map_y[j] - ly;
+      Scalar d2 = dx * dx + dy * dy;
+      bool closer = d2 < best_d2[j];
+      best_d2[j] = closer ? d2 : best_d2[j];
+      res_x[j] = closer ? dx : res_x[j];
+      res_y[j] = closer ? dy : res_y[j];
+    }
+  }
+}
+
+/**
+ * Static 2-d tree over a set of predictions, answering nearest-neighbor
+ *   queries in O(log n). Queries return the same index as
+ *   nearestBruteForce, including on ties. Storage is reused across builds.
+ */
+class LandmarkKdTree {
+ public:
+  /**
+   * build Indexes predicted; the vector must outlive the queries.
+   */
+  void build(const std::vector<LandmarkObs>& predicted);
+
+  /**
+   * nearest Returns the index into the built predictions closest to
+   *   (x, y), or -1 if the tree is empty.
+   */
+  int nearest(double x, double y) const;
+
+ private:
+  struct Node {
+    double x;
+    double y;
+    int index;  // Index into the predictions the tree was built from
+  };
+
+  void buildRange(int lo, int hi, int depth);
+  void search(int lo, int hi, int depth, double x, double y, double& best_d,
+              int& best) const;
+
+  std::vector<Node> nodes;  // Implicit tree: median of [lo, hi) at the middle
+};
+
+#endif  // ASSOCIATION_H_
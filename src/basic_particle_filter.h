@@ -0,0 +1,389 @@
+/**
+ * basic_particle_filter.h
+ * Compile-time specialized particle filter.
+ *
+ * BasicParticleFilter fixes the scalar type, the motion and sensor models,
+ * their noise and optionally the particle count as template parameters, so
+ * the kernels are inlined with constant coefficients and fixed trip counts
+ * and the compiler can unroll and vectorize them; a float instantiation
+ * runs at twice the SIMD width. It covers the core loop (init, prediction,
+ * updateWeights, systematic resampling) on a single thread. ParticleFilter
+ * remains the default, runtime-configured filter with threading, adaptive
+ * particle counts and the range cache; the default template arguments
+ * reproduce its double-precision CTRV and Gaussian models, and both
+ * associate through the rule of nearestResiduals (association.h),
+ * including observations with no landmark in range.
+ */
+
+#ifndef BASIC_PARTICLE_FILTER_H_
+#define BASIC_PARTICLE_FILTER_H_
+
+#include <math.h>
+#include <stdint.h>
+#include <algorithm>
+#include <array>
+#include <random>
+#include <vector>
+#include "association.h"
+#include "fast_math.h"
+#include "helper_functions.h"
+#include "map.h"
+#include "particle_stats.h"
+#include "resampler.h"
+#include "rng.h"
+
+/**
+ * Noise of the project's vehicle and sensor, as constants.
+ */
+struct DefaultNoise {
+  // GPS / process uncertainty [x [m], y [m], theta [rad]]
+  static constexpr double sigma_x = 0.3;
+  static constexpr double sigma_y = 0.3;
+  static constexpr double sigma_theta = 0.01;
+  // Landmark measurement uncertainty [x [m], y [m]]
+  static constexpr double sigma_landmark_x = 0.3;
+  static constexpr double sigma_landmark_y = 0.3;
+};
+
+/**
+ * gaussianNoise Adds zero-mean Gaussian noise of sigma to n values with
+ *   Box-Muller, in the precision of Scalar.
+ */
+template <typename Scalar>
+void gaussianNoise(Xoshiro256& rng, Scalar sigma, Scalar* values, int n) {
+  for (int i = 0 ; i < n ; i += 2) {
+    // 1 - u keeps the log argument in (0, 1]
+    Scalar r = sigma * static_cast<Scalar>(sqrt(-2.0 * log(1.0 - rng.uniform())));
+    Scalar s, c;
+    fast_math::sincos(static_cast<Scalar>(2.0 * M_PI * rng.uniform()), &s, &c);
+    values[i] += r * c;
+    if (i + 1 < n) {
+      values[i + 1] += r * s;
+    }
+  }
+}
+
+/**
+ * Constant turn rate and velocity motion with Noise's process noise.
+ */
+template <typename Scalar, typename Noise = DefaultNoise>
+struct CtrvMotion {
+  /**
+   * predict Moves n particles by the noiseless CTRV model, as predictCTRV.
+   */
+  static void predict(Scalar* x, Scalar* y, Scalar* theta, int n,
+                      Scalar delta_t, Scalar velocity, Scalar yaw_rate) {
+    // Same sin/cos-of-the-heading form as predictCTRV
+    Scalar xs, xc, ys, yc, dtheta;
+    if (fabs(yaw_rate) > Scalar(0.00001)) {
+      dtheta = yaw_rate*delta_t;
+      Scalar k = velocity/yaw_rate;
+      Scalar h = sin(Scalar(0.5)*dtheta);
+      Scalar cm1 = Scalar(-2)*h*h;
+      Scalar sa = sin(dtheta);
+      xs = k*cm1;
+      xc = k*sa;
+      ys = k*sa;
+      yc = -k*cm1;
+    } else {
+      dtheta = 0;
+      xs = 0;
+      xc = velocity*delta_t;
+      ys = velocity*delta_t;
+      yc = 0;
+    }
+    for (int i = 0 ; i < n ; i++) {
+      Scalar s, c;
+      fast_math::sincos(theta[i], &s, &c);
+      x[i] += xs*s + xc*c;
+      y[i] += ys*s + yc*c;
+      theta[i] += dtheta;
+    }
+  }
+
+  /**
+   * addNoise Adds the process noise to n particles.
+   */
+  static void addNoise(Xoshiro256& rng, Scalar* x, Scalar* y, Scalar* theta,
+                       int n) {
+    gaussianNoise(rng, static_cast<Scalar>(Noise::sigma_x), x, n);
+    gaussianNoise(rng, static_cast<Scalar>(Noise::sigma_y), y, n);
+    gaussianNoise(rng, static_cast<Scalar>(Noise::sigma_theta), theta, n);
+  }
+};
+
+/**
+ * Bivariate Gaussian landmark likelihood with Noise's measurement noise,
+ *   the log-domain form of GaussianLikelihood.
+ */
+template <typename Scalar, typename Noise = DefaultNoise>
+struct GaussianSensor {
+  static constexpr Scalar inv_2sx2 = static_cast<Scalar>(
+      1.0 / (2.0 * Noise::sigma_landmark_x * Noise::sigma_landmark_x));
+  static constexpr Scalar inv_2sy2 = static_cast<Scalar>(
+      1.0 / (2.0 * Noise::sigma_landmark_y * Noise::sigma_landmark_y));
+
+  /**
+   * logNorm Returns log(1 / (2 pi sig_x sig_y)).
+   */
+  static double logNorm() {
+    return -log(2.0 * M_PI * Noise::sigma_landmark_x * Noise::sigma_landmark_y);
+  }
+
+  /**
+   * exponent Returns the Gaussian's exponent for the residual (dx, dy);
+   *   the log-likelihood is logNorm() minus it.
+   */
+  static Scalar exponent(Scalar dx, Scalar dy) {
+    return dx * dx * inv_2sx2 + dy * dy * inv_2sy2;
+  }
+};
+
+template <typename Scalar, typename Noise>
+constexpr Scalar GaussianSensor<Scalar, Noise>::inv_2sx2;
+template <typename Scalar, typename Noise>
+constexpr Scalar GaussianSensor<Scalar, Noise>::inv_2sy2;
+
+/**
+ * Per-particle arrays of a BasicParticleFilter: std::array when the count
+ *   is fixed at compile time (N > 0), std::vector otherwise.
+ */
+template <typename T, int N>
+struct FilterArray {
+  typedef std::array<T, N> type;
+  static void resize(type& a, int n) {}
+};
+
+template <typename T>
+struct FilterArray<T, 0> {
+  typedef std::vector<T> type;
+  static void resize(type& a, int n) {
+    a.resize(n);
+  }
+};
+
+template <typename Scalar, int N>
+struct BasicParticleSet {
+  typename FilterArray<int, N>::type id;
+  typename FilterArray<Scalar, N>::type x;
+  typename FilterArray<Scalar, N>::type y;
+  typename FilterArray<Scalar, N>::type theta;
+  typename FilterArray<double, N>::type weight;  // Weights stay double
+
+  void resize(int n) {
+    FilterArray<int, N>::resize(id, n);
+    FilterArray<Scalar, N>::resize(x, n);
+    FilterArray<Scalar, N>::resize(y, n);
+    FilterArray<Scalar, N>::resize(theta, n);
+    FilterArray<double, N>::resize(weight, n);
+  }
+};
+
+/**
+ * Particle filter specialized at compile time.
+ *   MotionModel provides static predict(x, y, theta, n, delta_t, velocity,
+ *   yaw_rate) and addNoise(rng, x, y, theta, n) over Scalar arrays;
+ *   SensorModel provides static logNorm() and exponent(dx, dy) of the
+ *   per-observation log-likelihood logNorm() - exponent(dx, dy).
+ */
+template <typename Scalar = double,
+          typename MotionModel = CtrvMotion<Scalar>,
+          typename SensorModel = GaussianSensor<Scalar>,
+          int N = 0>
+class BasicParticleFilter {
+ public:
+  // Particle count fixed at compile time, 0 if set at construction
+  static const int kFixedParticles = N;
+
+  /**
+   * Constructor
+   * @param num_particles Number of particles, ignored when N > 0
+   */
+  explicit BasicParticleFilter(int num_particles = 100)
+      : num_particles(N > 0 ? N : num_particles), is_initialized(false),
+        rng(mixSeed(0, 0)) {
+    particles.resize(this->num_particles);
+    resampled.resize(this->num_particles);
+    FilterArray<double, N>::resize(log_weights, this->num_particles);
+    FilterArray<int, N>::resize(resample_idx, this->num_particles);
+  }
+
+  /**
+   * setSeed Restarts all random draws of the filter from seed.
+   */
+  void setSeed(uint64_t seed) {
+    rng.reseed(mixSeed(seed, 0));
+  }
+
+  /**
+   * init Spreads the particles around the first position with the motion
+   *   model's noise.
+   */
+  void init(double x, double y, double theta) {
+    for (int i = 0 ; i < size() ; i++) {
+      particles.id[i] = i;
+      particles.x[i] = x;
+      particles.y[i] = y;
+      particles.theta[i] = theta;
+      particles.weight[i] = 1.0;
+    }
+    MotionModel::addNoise(rng, particles.x.data(), particles.y.data(),
+                          particles.theta.data(), size());
+    is_initialized = true;
+  }
+
+  /**
+   * prediction Moves the particles by the motion model and its noise.
+   */
+  void prediction(double delta_t, double velocity, double yaw_rate) {
+    MotionModel::predict(particles.x.data(), particles.y.data(),
+                         particles.theta.data(), size(),
+                         static_cast<Scalar>(delta_t),
+                         static_cast<Scalar>(velocity),
+                         static_cast<Scalar>(yaw_rate));
+    MotionModel::addNoise(rng, particles.x.data(), particles.y.data(),
+                          particles.theta.data(), size());
+  }
+
+  /**
+   * updateWeights Weighs the particles by the sensor model against the
+   *   nearest in-range landmark of each observation, normalizes the
+   *   weights to sum 1 and gathers stats() in the same pass. Without
+   *   particles it only clears stats().
+   * @param sensor_range Range [m] of sensor
+   * @param observations Landmark observations in vehicle coordinates
+   * @param map Map of landmarks
+   */
+  void updateWeights(double sensor_range,
+                     const std::vector<LandmarkObs>& observations,
+                     const Map& map) {
+    const int num_obs = observations.size();
+    obs_x.resize(num_obs);
+    obs_y.resize(num_obs);
+    map_x.resize(num_obs);
+    map_y.resize(num_obs);
+    best_d2.resize(num_obs);
+    best_dx.resize(num_obs);
+    best_dy.resize(num_obs);
+    for (int j = 0 ; j < num_obs ; j++) {
+      obs_x[j] = observations[j].x;
+      obs_y[j] = observations[j].y;
+    }
+
+    if (size() == 0) {
+      weight_stats = ParticleStats();
+      return;
+    }
+
+    const Map::single_landmark_s* landmarks = map.landmarks();
+    const double log_norm = SensorModel::logNorm();
+    accumulator.reset(true, particles.x[0], particles.y[0],
+                      particles.theta[0]);
+
+    for (int i = 0 ; i < size() ; i++) {
+      const Scalar px = particles.x[i];
+      const Scalar py = particles.y[i];
+
+      // In-range landmarks of the particle as Scalar arrays
+      in_range.clear();
+      map.queryRange(px, py, sensor_range, in_range);
+      const int num_lm = in_range.size();
+      lm_x.resize(num_lm);
+      lm_y.resize(num_lm);
+      for (int k = 0 ; k < num_lm ; k++) {
+        lm_x[k] = landmarks[in_range[k]].x_f;
+        lm_y[k] = landmarks[in_range[k]].y_f;
+      }
+
+      // Transform observations from vehicle coordinates to map coordinates
+      Scalar s, c;
+      fast_math::sincos(particles.theta[i], &s, &c);
+      for (int j = 0 ; j < num_obs ; j++) {
+        map_x[j] = px + c * obs_x[j] - s * obs_y[j];
+        map_y[j] = py + s * obs_x[j] + c * obs_y[j];
+      }
+
+      // Nearest landmark residual of every observation, shared with
+      //   ParticleFilter's association
+      nearestResiduals(map_x.data(), map_y.data(), num_obs, lm_x.data(),
+                       lm_y.data(), num_lm, best_d2.data(), best_dx.data(),
+                       best_dy.data());
+      double log_weight = num_obs * log_norm;
+      for (int j = 0 ; j < num_obs ; j++) {
+        log_weight -= SensorModel::exponent(best_dx[j], best_dy[j]);
+      }
+      log_weights[i] = log_weight;
+      accumulator.addLog(log_weight, particles.id[i], px, py,
+                         particles.theta[i]);
+    }
+
+    accumulator.finish(accumulator.sum(), weight_stats);
+    const double max_lw = accumulator.logScale();
+    const double sum = accumulator.sum();
+    for (int i = 0 ; i < size() ; i++) {
+      particles.weight[i] = exp(log_weights[i] - max_lw) / sum;
+    }
+  }
+
+  /**
+   * resample Draws a new set of the same size by systematic resampling.
+   */
+  void resample() {
+    std::uniform_real_distribution<double> dist_u(0.0, 1.0);
+    systematicResample(particles.weight.data(), size(), size(), dist_u(rng),
+                       resample_idx.data());
+    for (int i = 0 ; i < size() ; i++) {
+      int index = resample_idx[i];
+      resampled.id[i] = particles.id[index];
+      resampled.x[i] = particles.x[index];
+      resampled.y[i] = particles.y[index];
+      resampled.theta[i] = particles.theta[index];
+      resampled.weight[i] = particles.weight[index];
+    }
+    std::swap(particles, resampled);
+  }
+
+  /**
+   * stats Returns the best particle, weighted mean pose and weight
+   *   statistics of the last updateWeights (see ParticleFilter::stats).
+   */
+  const ParticleStats& stats() const {
+    return weight_stats;
+  }
+
+  /**
+   * size Returns the number of particles.
+   */
+  int size() const {
+    return num_particles;
+  }
+
+  /**
+   * initialized Returns whether init() has run.
+   */
+  bool initialized() const {
+    return is_initialized;
+  }
+
+  // Set of current particles
+  BasicParticleSet<Scalar, N> particles;
+
+ private:
+  int num_particles;
+  bool is_initialized;
+  Xoshiro256 rng;
+
+  // Back buffer, log-weights and ancestor indices, sized once
+  BasicParticleSet<Scalar, N> resampled;
+  typename FilterArray<double, N>::type log_weights;
+  typename FilterArray<int, N>::type resample_idx;
+
+  // Per-frame buffers reused by every updateWeights call
+  std::vector<Scalar> obs_x, obs_y, map_x, map_y, lm_x, lm_y;
+  std::vector<Scalar> best_d2, best_dx, best_dy;
+  std::vector<int> in_range;
+  StatsAccumulator accumulator;
+  ParticleStats weight_stats;
+};
+
+#endif  // BASIC_PARTICLE_FILTER_H_
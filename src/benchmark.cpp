@@ -0,0 +1,436 @@
+/**
+ * benchmark.cpp
+ * Scaling benchmarks of the filter stages on synthetic maps and
+ * observations (pf_benchmark, built when Google Benchmark is installed).
+ *
+ * Sweeps the particle count (100 to 1M), map size (42 to 1M landmarks),
+ * observation count and thread count across prediction, updateWeights
+ * and resample. The *Baseline benchmarks run the filter in its original
+ * configuration (linear weights, resampling wheel, no range cache, one
+ * thread) as the reference the tuned configuration is measured against;
+ * the *Compact ones add the compact particle state. BM_FilterBatch steps
+ * fleets of independent filters through FilterBatch, and BM_Relocalization
+ * weighs a cloud spread over the map with and without gating. BM_BasicFrame
+ * runs whole frames of the float and double BasicParticleFilter
+ * instantiations against BM_Frame, the same frames on ParticleFilter.
+ *
+ * Results are machine-readable through Google Benchmark's own flags:
+ *   pf_benchmark --benchmark_format=json --benchmark_out=results.json
+ *   pf_benchmark --benchmark_filter='UpdateWeights/.*landmarks:1000000'
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "basic_particle_filter.h"
+#include "filter_batch.h"
+#include "helper_functions.h"
+#include "particle_filter.h"
+#include "sim_data.h"
+
+using std::vector;
+
+namespace {
+
+const double kSensorRange = 50.0;  // [m]
+const double kSpacing = 10.0;  // Mean landmark spacing of the maps [m]
+const double kDeltaT = 0.1;  // [s]
+
+double sigma_pos[3] = {0.3, 0.3, 0.01};
+double sigma_landmark[2] = {0.3, 0.3};
+
+// A synthetic map and the view of a vehicle at its center
+struct Scenario {
+  Map map;
+  double x;
+  double y;
+  double theta;
+  vector<LandmarkObs> in_range;  // Noisy observations of the landmarks in range
+  vector<LandmarkObs> clutter;   // Spurious returns, used past in_range
+};
+
+// Maps are built once per size and shared by all benchmarks
+const Scenario& scenario(int num_landmarks) {
+  static std::map<int, std::unique_ptr<Scenario> > scenarios;
+  std::unique_ptr<Scenario>& entry = scenarios[num_landmarks];
+  if (entry) {
+    return *entry;
+  }
+  entry.reset(new Scenario());
+  Scenario& s = *entry;
+  simulateMap(num_landmarks, kSpacing, 42, s.map);
+  double side = kSpacing * sqrt(static_cast<double>(num_landmarks));
+  s.x = 0.5 * side;
+  s.y = 0.5 * side;
+  s.theta = 0.3;
+
+  std::mt19937 gen(7);
+  std::normal_distribution<double> noise_x(0.0, sigma_landmark[0]);
+  std::normal_distribution<double> noise_y(0.0, sigma_landmark[1]);
+  std::uniform_real_distribution<double> clutter(-kSensorRange, kSensorRange);
+  vector<int> in_range;
+  s.map.queryRange(s.x, s.y, kSensorRange, in_range);
+  double c = cos(s.theta);
+  double sn = sin(s.theta);
+  const Map::single_landmark_s* landmarks = s.map.landmarks();
+  for (size_t k = 0; k < in_range.size(); ++k) {
+    double dx = landmarks[in_range[k]].x_f - s.x;
+    double dy = landmarks[in_range[k]].y_f - s.y;
+    LandmarkObs obs;
+    obs.id = -1;
+    obs.x = c * dx + sn * dy + noise_x(gen);
+    obs.y = -sn * dx + c * dy + noise_y(gen);
+    s.in_range.push_back(obs);
+  }
+  for (int k = 0; k < 256; ++k) {
+    LandmarkObs obs;
+    obs.id = -1;
+    obs.x = clutter(gen);
+    obs.y = clutter(gen);
+    s.clutter.push_back(obs);
+  }
+  return s;
+}
+
+// The first num_obs observations of s, padded with clutter when fewer
+//   landmarks are in range
+void observations(const Scenario& s, int num_obs, vector<LandmarkObs>& out) {
+  out.clear();
+  for (int k = 0; k < num_obs; ++k) {
+    if (k < static_cast<int>(s.in_range.size())) {
+      out.push_back(s.in_range[k]);
+    } else {
+      out.push_back(s.clutter[(k - s.in_range.size()) % s.clutter.size()]);
+    }
+  }
+}
+
+// Filter configurations compared
+enum Config { BASELINE, TUNED, COMPACT };
+
+// Filter of num_particles tracking the vehicle of s
+void setUp(ParticleFilter& pf, const Scenario& s, int num_particles,
+           int num_threads, Config config) {
+  if (config != BASELINE) {
+    pf.setWeightMode(ParticleFilter::LOG_WEIGHTS);
+    pf.setResampleMethod(ParticleFilter::SYSTEMATIC_RESAMPLING);
+    pf.setRangeCache(true);
+    pf.setNumThreads(num_threads);
+    pf.setCompactState(config == COMPACT);
+  }
+  pf.setNumParticles(num_particles);
+  pf.setSeed(1);
+  pf.init(s.x, s.y, s.theta, sigma_pos);
+}
+
+void report(benchmark::State& state, int num_particles) {
+  state.SetItemsProcessed(state.iterations() * num_particles);
+  state.counters["particles"] = num_particles;
+}
+
+void prediction(benchmark::State& state, Config config) {
+  const int num_particles = state.range(0);
+  const int num_threads = config == BASELINE ? 1 : state.range(1);
+  const Scenario& s = scenario(42);
+  ParticleFilter pf;
+  setUp(pf, s, num_particles, num_threads, config);
+  if (config != COMPACT) {
+    for (auto _ : state) {
+      pf.prediction(kDeltaT, sigma_pos, 10.0, 0.05);
+      benchmark::ClobberMemory();
+    }
+  } else {
+    // The compact state exists from resample() to the next prediction(),
+    //   so every iteration resamples first, untimed
+    vector<LandmarkObs> obs;
+    observations(s, 16, obs);
+    pf.updateWeights(kSensorRange, sigma_landmark, obs, s.map);
+    for (auto _ : state) {
+      pf.resample();
+      std::chrono::steady_clock::time_point t0 =
+          std::chrono::steady_clock::now();
+      pf.prediction(kDeltaT, sigma_pos, 10.0, 0.05);
+      std::chrono::steady_clock::time_point t1 =
+          std::chrono::steady_clock::now();
+      state.SetIterationTime(std::chrono::duration<double>(t1 - t0).count());
+    }
+  }
+  report(state, num_particles);
+}
+
+void updateWeights(benchmark::State& state, Config config) {
+  const int num_particles = state.range(0);
+  const Scenario& s = scenario(state.range(1));
+  const int num_obs = state.range(2);
+  const int num_threads = config == BASELINE ? 1 : state.range(3);
+  ParticleFilter pf;
+  setUp(pf, s, num_particles, num_threads, config);
+  vector<LandmarkObs> obs;
+  observations(s, num_obs, obs);
+  for (auto _ : state) {
+    pf.updateWeights(kSensorRange, sigma_landmark, obs, s.map);
+    benchmark::ClobberMemory();
+  }
+  report(state, num_particles);
+  state.counters["in_range"] = s.in_range.size();
+}
+
+void resample(benchmark::State& state, Config config) {
+  const int num_particles = state.range(0);
+  const Scenario& s = scenario(42);
+  ParticleFilter pf;
+  setUp(pf, s, num_particles, 1, config);
+  vector<LandmarkObs> obs;
+  observations(s, 16, obs);
+  // Only resample() is timed; every iteration starts from freshly
+  //   weighed particles
+  for (auto _ : state) {
+    pf.updateWeights(kSensorRange, sigma_landmark, obs, s.map);
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    pf.resample();
+    std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+    state.SetIterationTime(std::chrono::duration<double>(t1 - t0).count());
+  }
+  report(state, num_particles);
+}
+
+// Full frames of num_filters tuned 100-particle filters tracking the
+//   vehicle of the 10k-landmark map
+void filterBatch(benchmark::State& state) {
+  const int num_filters = state.range(0);
+  const int num_threads = state.range(1);
+  const Scenario& s = scenario(10000);
+  BatchConfig config;
+  config.delta_t = kDeltaT;
+  config.sensor_range = kSensorRange;
+  std::copy(sigma_pos, sigma_pos + 3, config.sigma_pos);
+  std::copy(sigma_landmark, sigma_landmark + 2, config.sigma_landmark);
+  FilterBatch batch(s.map, config, num_threads);
+  batch.resize(num_filters);
+  vector<LandmarkObs> obs;
+  observations(s, 16, obs);
+  vector<FilterInput> inputs(num_filters);
+  for (int k = 0; k < num_filters; ++k) {
+    setUp(batch.filter(k), s, 100, 1, TUNED);
+    batch.filter(k).setSeed(k);
+    inputs[k].active = true;
+    inputs[k].observations = &obs;
+  }
+  for (auto _ : state) {
+    batch.step(inputs);
+  }
+  state.SetItemsProcessed(state.iterations() * num_filters);
+  state.counters["filters"] = num_filters;
+}
+
+// updateWeights of particles spread over a 200 m x 200 m area of the 10k
+//   landmark map with any heading, as after a kidnapping; most of them
+//   are hopeless
+void relocalization(benchmark::State& state) {
+  const int num_particles = state.range(0);
+  const bool gating = state.range(1) != 0;
+  const Scenario& s = scenario(10000);
+  ParticleFilter pf;
+  pf.setWeightMode(ParticleFilter::LOG_WEIGHTS);
+  pf.setRangeCache(true);
+  pf.setGating(gating);
+  pf.setNumParticles(num_particles);
+  pf.setSeed(1);
+  double spread[3] = {100.0, 100.0, M_PI};
+  pf.init(s.x, s.y, s.theta, spread);
+  vector<LandmarkObs> obs;
+  observations(s, 16, obs);
+  for (auto _ : state) {
+    pf.updateWeights(kSensorRange, sigma_landmark, obs, s.map);
+    benchmark::ClobberMemory();
+  }
+  report(state, num_particles);
+  state.counters["best_error"] =
+      hypot(pf.stats().best_x - s.x, pf.stats().best_y - s.y);
+}
+
+// Full frames of a stationary vehicle (prediction, updateWeights, resample)
+//   on one thread, for the compile-time specialized filter next to
+//   ParticleFilter
+template <typename Scalar>
+void BM_BasicFrame(benchmark::State& state) {
+  const int num_particles = state.range(0);
+  const Scenario& s = scenario(10000);
+  BasicParticleFilter<Scalar> pf(num_particles);
+  pf.setSeed(1);
+  pf.init(s.x, s.y, s.theta);
+  vector<LandmarkObs> obs;
+  observations(s, 16, obs);
+  for (auto _ : state) {
+    pf.prediction(kDeltaT, 0.0, 0.0);
+    pf.updateWeights(kSensorRange, obs, s.map);
+    pf.resample();
+  }
+  report(state, num_particles);
+  state.counters["best_error"] =
+      hypot(pf.stats().best_x - s.x, pf.stats().best_y - s.y);
+}
+
+void BM_Frame(benchmark::State& state) {
+  const int num_particles = state.range(0);
+  const Scenario& s = scenario(10000);
+  ParticleFilter pf;
+  setUp(pf, s, num_particles, 1, TUNED);
+  vector<LandmarkObs> obs;
+  observations(s, 16, obs);
+  for (auto _ : state) {
+    pf.prediction(kDeltaT, sigma_pos, 0.0, 0.0);
+    pf.updateWeights(kSensorRange, sigma_landmark, obs, s.map);
+    pf.resample();
+  }
+  report(state, num_particles);
+  state.counters["best_error"] =
+      hypot(pf.stats().best_x - s.x, pf.stats().best_y - s.y);
+}
+
+void BM_Prediction(benchmark::State& state) {
+  prediction(state, TUNED);
+}
+
+void BM_PredictionBaseline(benchmark::State& state) {
+  prediction(state, BASELINE);
+}
+
+void BM_PredictionCompact(benchmark::State& state) {
+  prediction(state, COMPACT);
+}
+
+void BM_UpdateWeights(benchmark::State& state) {
+  updateWeights(state, TUNED);
+}
+
+void BM_UpdateWeightsBaseline(benchmark::State& state) {
+  updateWeights(state, BASELINE);
+}
+
+void BM_Resample(benchmark::State& state) {
+  resample(state, TUNED);
+}
+
+void BM_ResampleBaseline(benchmark::State& state) {
+  resample(state, BASELINE);
+}
+
+void BM_ResampleCompact(benchmark::State& state) {
+  resample(state, COMPACT);
+}
+
+void BM_FilterBatch(benchmark::State& state) {
+  filterBatch(state);
+}
+
+void BM_Relocalization(benchmark::State& state) {
+  relocalization(state);
+}
+
+const vector<int64_t> kParticles = {100, 1000, 10000, 100000, 1000000};
+const vector<int64_t> kLandmarks = {42, 1000, 10000, 100000, 1000000};
+const vector<int64_t> kObservations = {4, 16, 64};
+const vector<int64_t> kThreads = {1, 2, 4, 8};
+
+// One axis at a time around 1000 particles on the 10k-landmark map with
+//   16 observations, plus the thread sweep at 100k particles
+void addWeightSweeps(benchmark::internal::Benchmark* b, bool threads) {
+  const int64_t particles = 1000;
+  const int64_t landmarks = 10000;
+  const int64_t obs = 16;
+  for (size_t i = 0; i < kParticles.size(); ++i) {
+    b->Args({kParticles[i], landmarks, obs, 1});
+  }
+  for (size_t i = 0; i < kLandmarks.size(); ++i) {
+    if (kLandmarks[i] != landmarks) {
+      b->Args({particles, kLandmarks[i], obs, 1});
+    }
+  }
+  for (size_t i = 0; i < kObservations.size(); ++i) {
+    if (kObservations[i] != obs) {
+      b->Args({particles, landmarks, kObservations[i], 1});
+    }
+  }
+  if (threads) {
+    // The single-threaded point is part of the particle sweep
+    for (size_t i = 0; i < kThreads.size(); ++i) {
+      if (kThreads[i] != 1) {
+        b->Args({100000, landmarks, obs, kThreads[i]});
+      }
+    }
+  }
+}
+
+void weightSweeps(benchmark::internal::Benchmark* b) {
+  addWeightSweeps(b, true);
+}
+
+void baselineWeightSweeps(benchmark::internal::Benchmark* b) {
+  addWeightSweeps(b, false);
+}
+
+}  // namespace
+
+BENCHMARK(BM_Prediction)
+    ->ArgNames({"particles", "threads"})
+    ->ArgsProduct({kParticles, kThreads})
+    ->Unit(benchmark::kMicrosecond)->UseRealTime();
+BENCHMARK(BM_PredictionBaseline)
+    ->ArgName("particles")->ArgsProduct({kParticles})
+    ->Unit(benchmark::kMicrosecond)->UseRealTime();
+BENCHMARK(BM_PredictionCompact)
+    ->ArgNames({"particles", "threads"})
+    ->ArgsProduct({kParticles, {1}})
+    ->Unit(benchmark::kMicrosecond)->UseManualTime();
+
+BENCHMARK(BM_UpdateWeights)
+    ->ArgNames({"particles", "landmarks", "observations", "threads"})
+    ->Apply(weightSweeps)
+    ->Unit(benchmark::kMicrosecond)->UseRealTime();
+BENCHMARK(BM_UpdateWeightsBaseline)
+    ->ArgNames({"particles", "landmarks", "observations", "threads"})
+    ->Apply(baselineWeightSweeps)
+    ->Unit(benchmark::kMicrosecond)->UseRealTime();
+
+// resample() runs on the calling thread, so it has no thread sweep
+BENCHMARK(BM_Resample)
+    ->ArgName("particles")->ArgsProduct({kParticles})
+    ->Unit(benchmark::kMicrosecond)->UseManualTime();
+BENCHMARK(BM_ResampleBaseline)
+    ->ArgName("particles")->ArgsProduct({kParticles})
+    ->Unit(benchmark::kMicrosecond)->UseManualTime();
+BENCHMARK(BM_ResampleCompact)
+    ->ArgName("particles")->ArgsProduct({kParticles})
+    ->Unit(benchmark::kMicrosecond)->UseManualTime();
+
+BENCHMARK(BM_Relocalization)
+    ->ArgNames({"particles", "gating"})
+    ->ArgsProduct({{10000, 100000}, {0, 1}})
+    ->Unit(benchmark::kMicrosecond)->UseRealTime();
+
+// Items are particle frames
+BENCHMARK_TEMPLATE(BM_BasicFrame, float)
+    ->ArgName("particles")->Arg(100)->Arg(1000)->Arg(10000)->Arg(100000)
+    ->Unit(benchmark::kMicrosecond)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_BasicFrame, double)
+    ->ArgName("particles")->Arg(100)->Arg(1000)->Arg(10000)->Arg(100000)
+    ->Unit(benchmark::kMicrosecond)->UseRealTime();
+BENCHMARK(BM_Frame)
+    ->ArgName("particles")->Arg(100)->Arg(1000)->Arg(10000)->Arg(100000)
+    ->Unit(benchmark::kMicrosecond)->UseRealTime();
+
+// Items are filter frames
+BENCHMARK(BM_FilterBatch)
+    ->ArgNames({"filters", "threads"})
+    ->ArgsProduct({{16, 64, 256}, kThreads})
+    ->Unit(benchmark::kMicrosecond)->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -0,0 +1,176 @@
+/**
+ * binary_protocol.cpp
+ * Fixed-layout binary WebSocket frames, an alternative to the SocketIO
+ * JSON messages for clients other than the simulator.
+ */
+
+#include "binary_protocol.h"
+
+#include <string.h>
+
+namespace {
+
+// Byte-wise little-endian access, independent of host order and alignment.
+//   Compilers fold these into plain loads and stores on little-endian
+//   targets.
+inline uint32_t load32(const char* p) {
+  const unsigned char* b = reinterpret_cast<const unsigned char*>(p);
+  return static_cast<uint32_t>(b[0]) | (static_cast<uint32_t>(b[1]) << 8) |
+         (static_cast<uint32_t>(b[2]) << 16) | (static_cast<uint32_t>(b[3]) << 24);
+}
+
+inline uint16_t load16(const char* p) {
+  const unsigned char* b = reinterpret_cast<const unsigned char*>(p);
+  return static_cast<uint16_t>(b[0] | (b[1] << 8));
+}
+
+inline uint64_t load64(const char* p) {
+  return static_cast<uint64_t>(load32(p)) |
+         (static_cast<uint64_t>(load32(p + 4)) << 32);
+}
+
+inline double loadF64(const char* p) {
+  uint64_t bits = load64(p);
+  double v;
+  memcpy(&v, &bits, sizeof(v));
+  return v;
+}
+
+inline float loadF32(const char* p) {
+  uint32_t bits = load32(p);
+  float v;
+  memcpy(&v, &bits, sizeof(v));
+  return v;
+}
+
+inline void store32(char* p, uint32_t v) {
+  for (int i = 0; i < 4; ++i) {
+    p[i] = static_cast<char>(v >> (8 * i));
+  }
+}
+
+inline void store16(char* p, uint16_t v) {
+  p[0] = static_cast<char>(v);
+  p[1] = static_cast<char>(v >> 8);
+}
+
+inline void storeF64(char* p, double v) {
+  uint64_t bits;
+  memcpy(&bits, &v, sizeof(bits));
+  store32(p, static_cast<uint32_t>(bits));
+  store32(p + 4, static_cast<uint32_t>(bits >> 32));
+}
+
+inline void storeF32(char* p, float v) {
+  uint32_t bits;
+  memcpy(&bits, &v, sizeof(bits));
+  store32(p, bits);
+}
+
+void storeHeader(char* p, BinaryFrameType type) {
+  store32(p, kBinaryMagic);
+  store16(p + 4, kBinaryVersion);
+  store16(p + 6, static_cast<uint16_t>(type));
+}
+
+// Checks magic and version; returns the frame type or -1
+int frameType(const char* data, size_t length) {
+  if (length < kBinaryHeaderSize || load32(data) != kBinaryMagic ||
+      load16(data + 4) != kBinaryVersion) {
+    return -1;
+  }
+  return load16(data + 6);
+}
+
+}  // namespace
+
+TelemetryStatus decodeBinaryTelemetry(const char* data, size_t length,
+                                      Telemetry& telemetry,
+                                      std::vector<LandmarkObs>& observations) {
+  int type = frameType(data, length);
+  if (type < 0) {
+    return TELEMETRY_MALFORMED;
+  }
+  if (type != BINARY_TELEMETRY) {
+    return TELEMETRY_OTHER;
+  }
+  if (length < kBinaryTelemetryFixedSize) {
+    return TELEMETRY_MALFORMED;
+  }
+  const char* p = data + kBinaryHeaderSize;
+  uint32_t flags = load32(p);
+  uint32_t n = load32(p + 4);
+  if ((length - kBinaryTelemetryFixedSize) / 8 != n ||
+      (length - kBinaryTelemetryFixedSize) % 8 != 0) {
+    return TELEMETRY_MALFORMED;
+  }
+  p += 8;
+  telemetry.has_sense = (flags & BINARY_HAS_SENSE) != 0;
+  telemetry.has_control = (flags & BINARY_HAS_CONTROL) != 0;
+  telemetry.sense_x = loadF64(p);
+  telemetry.sense_y = loadF64(p + 8);
+  telemetry.sense_theta = loadF64(p + 16);
+  telemetry.previous_velocity = loadF64(p + 24);
+  telemetry.previous_yawrate = loadF64(p + 32);
+  p += 40;
+
+  observations.resize(n);
+  const char* xs = p;
+  const char* ys = p + 4 * static_cast<size_t>(n);
+  for (uint32_t i = 0; i < n; ++i) {
+    observations[i].id = -1;
+    observations[i].x = loadF32(xs + 4 * i);
+    observations[i].y = loadF32(ys + 4 * i);
+  }
+  return TELEMETRY_OK;
+}
+
+void encodeBinaryTelemetry(const Telemetry& telemetry,
+                           const std::vector<LandmarkObs>& observations,
+                           std::vector<char>& out) {
+  size_t n = observations.size();
+  size_t start = out.size();
+  out.resize(start + kBinaryTelemetryFixedSize + 8 * n);
+  char* p = &out[start];
+  storeHeader(p, BINARY_TELEMETRY);
+  p += kBinaryHeaderSize;
+  uint32_t flags = (telemetry.has_sense ? BINARY_HAS_SENSE : 0) |
+                   (telemetry.has_control ? BINARY_HAS_CONTROL : 0);
+  store32(p, flags);
+  store32(p + 4, static_cast<uint32_t>(n));
+  storeF64(p + 8, telemetry.sense_x);
+  storeF64(p + 16, telemetry.sense_y);
+  storeF64(p + 24, telemetry.sense_theta);
+  storeF64(p + 32, telemetry.previous_velocity);
+  storeF64(p + 40, telemetry.previous_yawrate);
+  p += 48;
+  for (size_t i = 0; i < n; ++i) {
+    storeF32(p + 4 * i, static_cast<float>(observations[i].x));
+    storeF32(p + 4 * (n + i), static_cast<float>(observations[i].y));
+  }
+}
+
+void encodeBinaryPose(const BinaryPose& pose, char* out) {
+  storeHeader(out, BINARY_POSE);
+  char* p = out + kBinaryHeaderSize;
+  storeF64(p, pose.x);
+  storeF64(p + 8, pose.y);
+  storeF64(p + 16, pose.theta);
+  storeF64(p + 24, pose.weight);
+  store32(p + 32, pose.num_particles);
+  store32(p + 36, pose.num_observations);
+}
+
+bool decodeBinaryPose(const char* data, size_t length, BinaryPose& pose) {
+  if (frameType(data, length) != BINARY_POSE || length != kBinaryPoseSize) {
+    return false;
+  }
+  const char* p = data + kBinaryHeaderSize;
+  pose.x = loadF64(p);
+  pose.y = loadF64(p + 8);
+  pose.theta = loadF64(p + 16);
+  pose.weight = loadF64(p + 24);
+  pose.num_particles = load32(p + 32);
+  pose.num_observations = load32(p + 36);
+  return true;
+}
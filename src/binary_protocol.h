@@ -0,0 +1,104 @@
+/**
+ * binary_protocol.h
+ * Fixed-layout binary WebSocket frames, an alternative to the SocketIO
+ * JSON messages for clients other than the simulator.
+ *
+ * All fields are little-endian and packed without padding. Every frame
+ * starts with an 8-byte header:
+ *   uint32 magic      'P' 'F' 'B' 'P' (kBinaryMagic)
+ *   uint16 version    kBinaryVersion
+ *   uint16 type       BinaryFrameType
+ *
+ * BINARY_TELEMETRY (client to filter), 56 + 8 * n bytes:
+ *   header
+ *   uint32 flags      BINARY_HAS_SENSE | BINARY_HAS_CONTROL
+ *   uint32 n          Number of observations
+ *   float64 sense_x, sense_y, sense_theta        [m, m, rad]
+ *   float64 previous_velocity, previous_yawrate  [m/s, rad/s]
+ *   float32 x[n], then float32 y[n]   Observations, vehicle frame [m]
+ *
+ * BINARY_POSE (filter to client), kBinaryPoseSize bytes:
+ *   header
+ *   float64 x, y, theta   Best particle, or the weighted mean pose with
+ *                         SessionConfig::publish_mean [m, m, rad]
+ *   float64 weight        Weight of the best particle; normalized in
+ *                         LOG_WEIGHTS mode, the raw likelihood product
+ *                         in LINEAR_WEIGHTS mode
+ *   uint32 num_particles
+ *   uint32 num_observations
+ */
+
+#ifndef BINARY_PROTOCOL_H_
+#define BINARY_PROTOCOL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include "helper_functions.h"
+#include "telemetry.h"
+
+const uint32_t kBinaryMagic = 0x50424650;  // "PFBP" in little-endian order
+const uint16_t kBinaryVersion = 1;
+
+enum BinaryFrameType {
+  BINARY_TELEMETRY = 1,
+  BINARY_POSE = 2
+};
+
+enum BinaryTelemetryFlags {
+  BINARY_HAS_SENSE = 1,
+  BINARY_HAS_CONTROL = 2
+};
+
+const size_t kBinaryHeaderSize = 8;
+const size_t kBinaryTelemetryFixedSize = kBinaryHeaderSize + 8 + 5 * 8;
+const size_t kBinaryPoseSize = kBinaryHeaderSize + 4 * 8 + 2 * 4;
+
+/**
+ * Fields of a BINARY_POSE frame.
+ */
+struct BinaryPose {
+  double x;
+  double y;
+  double theta;
+  double weight;
+  uint32_t num_particles;
+  uint32_t num_observations;
+};
+
+/**
+ * decodeBinaryTelemetry Decodes a BINARY_TELEMETRY frame. Does not
+ *   allocate once observations has grown to the largest frame seen.
+ * @param data Frame bytes
+ * @param length Number of bytes in data
+ * @param telemetry Output fields of the frame
+ * @param observations Output observations, resized to n
+ * @output TELEMETRY_OK, TELEMETRY_OTHER for a frame of another type, or
+ *   TELEMETRY_MALFORMED for a bad header, version or length
+ */
+TelemetryStatus decodeBinaryTelemetry(const char* data, size_t length,
+                                      Telemetry& telemetry,
+                                      std::vector<LandmarkObs>& observations);
+
+/**
+ * encodeBinaryTelemetry Appends a BINARY_TELEMETRY frame to out (used by
+ *   clients and tools; the filter only decodes these).
+ */
+void encodeBinaryTelemetry(const Telemetry& telemetry,
+                           const std::vector<LandmarkObs>& observations,
+                           std::vector<char>& out);
+
+/**
+ * encodeBinaryPose Writes a BINARY_POSE frame of kBinaryPoseSize bytes.
+ * @param pose Fields of the frame
+ * @param out Buffer of at least kBinaryPoseSize bytes
+ */
+void encodeBinaryPose(const BinaryPose& pose, char* out);
+
+/**
+ * decodeBinaryPose Decodes a BINARY_POSE frame.
+ * @output False for a bad header, version, type or length
+ */
+bool decodeBinaryPose(const char* data, size_t length, BinaryPose& pose);
+
+#endif  // BINARY_PROTOCOL_H_
@@ -0,0 +1,107 @@
+/**
+ * compact_particle_set.cpp
+ * Low-precision structure-of-arrays particle state for large sets.
+ */
+
+#include "compact_particle_set.h"
+
+#include <math.h>
+
+namespace {
+
+// Heading steps per turn and radians per step
+const double kHeadingSteps = 65536.0;
+const double kRadPerStep = 2.0 * M_PI / kHeadingSteps;
+
+// sin and cos of heading q. The quadrant and the remainder within
+//   [-pi/4, pi/4] come straight from the bits of q, so unlike the generic
+//   sincos there is no range reduction and no floor, and loops over it
+//   vectorize. Same minimax polynomials as fast_math::sincos(float).
+inline void headingSinCos(int q, float* s, float* c) {
+  int centered = q + 8192;  // An eighth of a turn
+  float r = static_cast<float>((centered & 16383) - 8192) *
+      static_cast<float>(kRadPerStep);
+  int quad = (centered >> 14) & 3;
+  float r2 = r * r;
+  float sr = ((-1.9515295891e-4f * r2 + 8.3321608736e-3f) * r2
+              - 1.6666654611e-1f) * r2 * r + r;
+  float cr = ((2.443315711809948e-5f * r2 - 1.388731625493765e-3f) * r2
+              + 4.166664568298827e-2f) * r2 * r2 - 0.5f * r2 + 1.0f;
+  float sv = (quad & 1) ? cr : sr;
+  float cv = (quad & 1) ? sr : cr;
+  *s = (quad & 2) ? -sv : sv;
+  *c = ((quad + 1) & 2) ? -cv : cv;
+}
+
+}  // namespace
+
+uint16_t CompactParticleSet::quantizeHeading(double theta) {
+  // Truncation to 16 bits wraps any turn count, negative ones included
+  return static_cast<uint16_t>(lrint(theta * (1.0 / kRadPerStep)));
+}
+
+double CompactParticleSet::headingAngle(uint16_t q) {
+  return q * kRadPerStep;
+}
+
+void CompactParticleSet::gather(const ParticleSet& src, const double* log_w,
+                                double log_norm, const int* idx, int n) {
+  resize(n);
+  if (n == 0) {
+    return;
+  }
+  anchor_x = src.x[idx[0]];
+  anchor_y = src.y[idx[0]];
+  for (int i = 0 ; i < n ; i++) {
+    int index = idx[i];
+    id[i] = src.id[index];
+    dx[i] = static_cast<float>(src.x[index] - anchor_x);
+    dy[i] = static_cast<float>(src.y[index] - anchor_y);
+    heading[i] = quantizeHeading(src.theta[index]);
+    log_weight[i] = static_cast<float>(log_w ? log_w[index] - log_norm
+                                             : log(src.weight[index]));
+  }
+}
+
+void CompactParticleSet::predict(int begin, int end, const CtrvStep& step,
+                                 const double* noise_x, const double* noise_y,
+                                 const double* noise_theta) {
+  const float steps_per_rad = static_cast<float>(1.0 / kRadPerStep);
+  const float dtheta = static_cast<float>(step.dtheta);
+  const float xs = static_cast<float>(step.xs);
+  const float xc = static_cast<float>(step.xc);
+  const float ys = static_cast<float>(step.ys);
+  const float yc = static_cast<float>(step.yc);
+  // Local pointers, so the compiler need not reload the vectors' storage
+  //   and vectorizes the loop
+  float* px = dx.data() + begin;
+  float* py = dy.data() + begin;
+  uint16_t* ph = heading.data() + begin;
+  const int n = end - begin;
+  for (int k = 0 ; k < n ; k++) {
+    float s, c;
+    headingSinCos(ph[k], &s, &c);
+    px[k] += xs*s + xc*c + static_cast<float>(noise_x[k]);
+    py[k] += ys*s + yc*c + static_cast<float>(noise_y[k]);
+    // Whole steps added modulo a turn, rounded half away from zero; the
+    //   rounding is unbiased under the heading noise
+    float turn = (dtheta + static_cast<float>(noise_theta[k])) * steps_per_rad;
+    turn += turn < 0.0f ? -0.5f : 0.5f;
+    ph[k] += static_cast<uint16_t>(static_cast<int>(turn));
+  }
+}
+
+void CompactParticleSet::unpack(int begin, int end, bool weights,
+                                ParticleSet& out) const {
+  for (int i = begin ; i < end ; i++) {
+    out.id[i] = id[i];
+    out.x[i] = anchor_x + dx[i];
+    out.y[i] = anchor_y + dy[i];
+    out.theta[i] = headingAngle(heading[i]);
+  }
+  if (weights) {
+    for (int i = begin ; i < end ; i++) {
+      out.weight[i] = exp(log_weight[i]);
+    }
+  }
+}
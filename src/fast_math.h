@@ -0,0 +1,234 @@
+/**
+ * fast_math.h
+ * Branch-free trigonometry shared by the scalar and SIMD filter kernels.
+ *
+ * sin/cos are evaluated with a Cody-Waite reduction to [-pi/4, pi/4] and
+ * the Cephes minimax polynomials, which keeps the error within a couple of
+ * ulp for the angle ranges a particle filter sees (|a| < 1e5 rad).
+ */
+
+#ifndef FAST_MATH_H_
+#define FAST_MATH_H_
+
+#include <math.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+namespace fast_math {
+
+// pi/2 split in a 33-bit head and a tail so that q * PIO2_HI is exact
+const double PIO2_HI = 1.57079632673412561417e+00;
+const double PIO2_LO = 6.07710050650619224932e-11;
+const double TWO_OVER_PI = 6.36619772367581382433e-01;
+
+// sin(r) = r + r^3 * S(r^2), cos(r) = 1 - r^2/2 + r^4 * C(r^2) on |r| <= pi/4
+const double S0 = 1.58962301576546568060E-10;
+const double S1 = -2.50507477628578072866E-8;
+const double S2 = 2.75573136213857245213E-6;
+const double S3 = -1.98412698295895385996E-4;
+const double S4 = 8.33333333332211858878E-3;
+const double S5 = -1.66666666666666307295E-1;
+const double C0 = -1.13585365213876817300E-11;
+const double C1 = 2.08757008419747316778E-9;
+const double C2 = -2.75573141792967388112E-7;
+const double C3 = 2.48015872888517045348E-5;
+const double C4 = -1.38888888888730564116E-3;
+const double C5 = 4.16666666666665929218E-2;
+
+/**
+ * fmadd Returns a * b + c, fused when the target has hardware FMA.
+ */
+inline double fmadd(double a, double b, double c) {
+#if defined(__FMA__) || defined(__ARM_FEATURE_FMA)
+  return fma(a, b, c);
+#else
+  return a * b + c;
+#endif
+}
+
+/**
+ * sincos Computes sin(a) and cos(a) with a single range reduction.
+ * @param a Angle [rad]
+ * @param s Output sin(a)
+ * @param c Output cos(a)
+ */
+inline void sincos(double a, double* s, double* c) {
+  double q = floor(a * TWO_OVER_PI + 0.5);
+  double r = (a - q * PIO2_HI) - q * PIO2_LO;
+  double r2 = r * r;
+
+  double ps = ((((S0 * r2 + S1) * r2 + S2) * r2 + S3) * r2 + S4) * r2 + S5;
+  double pc = ((((C0 * r2 + C1) * r2 + C2) * r2 + C3) * r2 + C4) * r2 + C5;
+  double sr = r + r * r2 * ps;
+  double cr = 1.0 - 0.5 * r2 + r2 * r2 * pc;
+
+  // Rotate the reduced result back into the quadrant of a
+  double quad = q - 4.0 * floor(q * 0.25);
+  bool swap = quad == 1.0 || quad == 3.0;
+  double sv = swap ? cr : sr;
+  double cv = swap ? sr : cr;
+  *s = quad >= 2.0 ? -sv : sv;
+  *c = (quad == 1.0 || quad == 2.0) ? -cv : cv;
+}
+
+// Single-precision reduction and Cephes sinf/cosf polynomials, accurate to
+//   about one float ulp for |a| < 1e4 rad
+const float PIO2_F1 = 1.5703125f;
+const float PIO2_F2 = 4.837512969970703125e-4f;
+const float PIO2_F3 = 7.54978995489188216e-8f;
+
+/**
+ * sincos Single-precision sincos, branch-free so that loops over floats
+ *   vectorize at twice the width of the double version.
+ */
+inline void sincos(float a, float* s, float* c) {
+  float q = floorf(a * static_cast<float>(TWO_OVER_PI) + 0.5f);
+  float r = ((a - q * PIO2_F1) - q * PIO2_F2) - q * PIO2_F3;
+  float r2 = r * r;
+
+  float sr = ((-1.9515295891e-4f * r2 + 8.3321608736e-3f) * r2
+              - 1.6666654611e-1f) * r2 * r + r;
+  float cr = ((2.443315711809948e-5f * r2 - 1.388731625493765e-3f) * r2
+              + 4.166664568298827e-2f) * r2 * r2 - 0.5f * r2 + 1.0f;
+
+  float quad = q - 4.0f * floorf(q * 0.25f);
+  bool swap = quad == 1.0f || quad == 3.0f;
+  float sv = swap ? cr : sr;
+  float cv = swap ? sr : cr;
+  *s = quad >= 2.0f ? -sv : sv;
+  *c = (quad == 1.0f || quad == 2.0f) ? -cv : cv;
+}
+
+#if defined(__AVX2__)
+inline __m256d fmadd(__m256d a, __m256d b, __m256d c) {
+#if defined(__FMA__)
+  return _mm256_fmadd_pd(a, b, c);
+#else
+  return _mm256_add_pd(_mm256_mul_pd(a, b), c);
+#endif
+}
+
+/**
+ * sincos4 AVX2 version of sincos for four packed angles.
+ */
+inline void sincos4(__m256d a, __m256d* s, __m256d* c) {
+  const __m256d half = _mm256_set1_pd(0.5);
+  const __m256d one = _mm256_set1_pd(1.0);
+  const __m256d two = _mm256_set1_pd(2.0);
+  const __m256d three = _mm256_set1_pd(3.0);
+  const __m256d sign = _mm256_set1_pd(-0.0);
+
+  __m256d q = _mm256_floor_pd(fmadd(a, _mm256_set1_pd(TWO_OVER_PI), half));
+  __m256d r = _mm256_sub_pd(a, _mm256_mul_pd(q, _mm256_set1_pd(PIO2_HI)));
+  r = _mm256_sub_pd(r, _mm256_mul_pd(q, _mm256_set1_pd(PIO2_LO)));
+  __m256d r2 = _mm256_mul_pd(r, r);
+
+  __m256d ps = fmadd(_mm256_set1_pd(S0), r2, _mm256_set1_pd(S1));
+  ps = fmadd(ps, r2, _mm256_set1_pd(S2));
+  ps = fmadd(ps, r2, _mm256_set1_pd(S3));
+  ps = fmadd(ps, r2, _mm256_set1_pd(S4));
+  ps = fmadd(ps, r2, _mm256_set1_pd(S5));
+  __m256d pc = fmadd(_mm256_set1_pd(C0), r2, _mm256_set1_pd(C1));
+  pc = fmadd(pc, r2, _mm256_set1_pd(C2));
+  pc = fmadd(pc, r2, _mm256_set1_pd(C3));
+  pc = fmadd(pc, r2, _mm256_set1_pd(C4));
+  pc = fmadd(pc, r2, _mm256_set1_pd(C5));
+  __m256d sr = fmadd(_mm256_mul_pd(r, r2), ps, r);
+  __m256d cr = fmadd(_mm256_mul_pd(r2, r2), pc,
+                     _mm256_sub_pd(one, _mm256_mul_pd(half, r2)));
+
+  __m256d quad = _mm256_sub_pd(
+      q, _mm256_mul_pd(_mm256_set1_pd(4.0),
+                       _mm256_floor_pd(_mm256_mul_pd(q, _mm256_set1_pd(0.25)))));
+  __m256d is1 = _mm256_cmp_pd(quad, one, _CMP_EQ_OQ);
+  __m256d is2 = _mm256_cmp_pd(quad, two, _CMP_EQ_OQ);
+  __m256d is3 = _mm256_cmp_pd(quad, three, _CMP_EQ_OQ);
+  __m256d swap = _mm256_or_pd(is1, is3);
+  __m256d sv = _mm256_blendv_pd(sr, cr, swap);
+  __m256d cv = _mm256_blendv_pd(cr, sr, swap);
+  *s = _mm256_xor_pd(sv, _mm256_and_pd(_mm256_or_pd(is2, is3), sign));
+  *c = _mm256_xor_pd(cv, _mm256_and_pd(_mm256_or_pd(is1, is2), sign));
+}
+#endif  // __AVX2__
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+/**
+ * sincos2 NEON version of sincos for two packed angles.
+ */
+inline void sincos2(float64x2_t a, float64x2_t* s, float64x2_t* c) {
+  const float64x2_t one = vdupq_n_f64(1.0);
+  const float64x2_t two = vdupq_n_f64(2.0);
+  const float64x2_t three = vdupq_n_f64(3.0);
+
+  float64x2_t q = vrndmq_f64(vfmaq_f64(vdupq_n_f64(0.5), a,
+                                       vdupq_n_f64(TWO_OVER_PI)));
+  float64x2_t r = vfmsq_f64(a, q, vdupq_n_f64(PIO2_HI));
+  r = vfmsq_f64(r, q, vdupq_n_f64(PIO2_LO));
+  float64x2_t r2 = vmulq_f64(r, r);
+
+  float64x2_t ps = vfmaq_f64(vdupq_n_f64(S1), vdupq_n_f64(S0), r2);
+  ps = vfmaq_f64(vdupq_n_f64(S2), ps, r2);
+  ps = vfmaq_f64(vdupq_n_f64(S3), ps, r2);
+  ps = vfmaq_f64(vdupq_n_f64(S4), ps, r2);
+  ps = vfmaq_f64(vdupq_n_f64(S5), ps, r2);
+  float64x2_t pc = vfmaq_f64(vdupq_n_f64(C1), vdupq_n_f64(C0), r2);
+  pc = vfmaq_f64(vdupq_n_f64(C2), pc, r2);
+  pc = vfmaq_f64(vdupq_n_f64(C3), pc, r2);
+  pc = vfmaq_f64(vdupq_n_f64(C4), pc, r2);
+  pc = vfmaq_f64(vdupq_n_f64(C5), pc, r2);
+  float64x2_t sr = vfmaq_f64(r, vmulq_f64(r, r2), ps);
+  float64x2_t cr = vfmaq_f64(vfmsq_f64(one, vdupq_n_f64(0.5), r2),
+                             vmulq_f64(r2, r2), pc);
+
+  float64x2_t quad = vfmsq_f64(q, vdupq_n_f64(4.0),
+                               vrndmq_f64(vmulq_f64(q, vdupq_n_f64(0.25))));
+  uint64x2_t is1 = vceqq_f64(quad, one);
+  uint64x2_t is2 = vceqq_f64(quad, two);
+  uint64x2_t is3 = vceqq_f64(quad, three);
+  uint64x2_t swap = vorrq_u64(is1, is3);
+  float64x2_t sv = vbslq_f64(swap, cr, sr);
+  float64x2_t cv = vbslq_f64(swap, sr, cr);
+  *s = vbslq_f64(vorrq_u64(is2, is3), vnegq_f64(sv), sv);
+  *c = vbslq_f64(vorrq_u64(is1, is2), vnegq_f64(cv), cv);
+}
+#endif  // __ARM_NEON && __aarch64__
+
+/**
+ * sincosBatch Computes sin and cos of n angles, four (AVX2) or two (NEON)
+ *   at a time.
+ * @param a Array of n angles [rad]
+ * @param n Number of angles
+ * @param s Output array of n sines
+ * @param c Output array of n cosines
+ */
+inline void sincosBatch(const double* a, int n, double* s, double* c) {
+  int i = 0;
+#if defined(__AVX2__)
+  for ( ; i + 4 <= n ; i += 4) {
+    __m256d vs, vc;
+    sincos4(_mm256_loadu_pd(a + i), &vs, &vc);
+    _mm256_storeu_pd(s + i, vs);
+    _mm256_storeu_pd(c + i, vc);
+  }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+  for ( ; i + 2 <= n ; i += 2) {
+    float64x2_t vs, vc;
+    sincos2(vld1q_f64(a + i), &vs, &vc);
+    vst1q_f64(s + i, vs);
+    vst1q_f64(c + i, vc);
+  }
+#endif
+
+  for ( ; i < n ; i++) {
+    sincos(a[i], s + i, c + i);
+  }
+}
+
+}  // namespace fast_math
+
+#endif  // FAST_MATH_H_
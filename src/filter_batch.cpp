@@ -0,0 +1,115 @@
+/**
+ * filter_batch.cpp
+ * Many independent particle filters stepped in lockstep on one pool.
+ */
+
+#include "filter_batch.h"
+
+#include <algorithm>
+
+FilterBatch::FilterBatch(const Map& map, const BatchConfig& config,
+                         int num_threads)
+    : map(map), config(config), pool(num_threads), steal_count(0) {
+  for (int t = 0; t < pool.size(); ++t) {
+    shares.push_back(std::unique_ptr<Share>(new Share()));
+    shares.back()->begin = 0;
+    shares.back()->end = 0;
+  }
+}
+
+void FilterBatch::resize(int num_filters) {
+  if (num_filters < 0) {
+    num_filters = 0;
+  }
+  filters.resize(num_filters);
+  for (int k = 0; k < num_filters; ++k) {
+    if (!filters[k]) {
+      filters[k].reset(new ParticleFilter());
+    }
+  }
+  active.reserve(num_filters);
+}
+
+void FilterBatch::step(const std::vector<FilterInput>& inputs) {
+  active.clear();
+  int n = std::min(size(), static_cast<int>(inputs.size()));
+  for (int k = 0; k < n; ++k) {
+    if (inputs[k].active) {
+      active.push_back(k);
+    }
+  }
+  int num_active = static_cast<int>(active.size());
+  int num_workers = pool.size();
+  for (int t = 0; t < num_workers; ++t) {
+    shares[t]->begin =
+        static_cast<int>(static_cast<long long>(num_active) * t / num_workers);
+    shares[t]->end = static_cast<int>(
+        static_cast<long long>(num_active) * (t + 1) / num_workers);
+  }
+  // One chunk per worker; the chunk index is the worker's share
+  pool.parallelFor(num_workers, [&](int begin, int end, int chunk) {
+    runWorker(chunk, inputs);
+  });
+}
+
+void FilterBatch::runWorker(int t, const std::vector<FilterInput>& inputs) {
+  int k;
+  do {
+    while (popFront(t, k)) {
+      advance(*filters[k], inputs[k]);
+    }
+  } while (steal(t));
+}
+
+bool FilterBatch::popFront(int t, int& filter_index) {
+  Share& share = *shares[t];
+  std::lock_guard<std::mutex> lock(share.mutex);
+  if (share.begin >= share.end) {
+    return false;
+  }
+  filter_index = active[share.begin++];
+  return true;
+}
+
+bool FilterBatch::steal(int t) {
+  int num_workers = static_cast<int>(shares.size());
+  for (int i = 1; i < num_workers; ++i) {
+    Share& victim = *shares[(t + i) % num_workers];
+    int begin, end;
+    {
+      std::lock_guard<std::mutex> lock(victim.mutex);
+      if (victim.begin >= victim.end) {
+        continue;
+      }
+      // The thief takes the back half, rounded up, so a single
+      //   remaining filter is taken whole
+      end = victim.end;
+      begin = victim.begin + (victim.end - victim.begin) / 2;
+      victim.end = begin;
+    }
+    // Only worker t refills its own share, and it is empty here
+    Share& own = *shares[t];
+    {
+      std::lock_guard<std::mutex> lock(own.mutex);
+      own.begin = begin;
+      own.end = end;
+    }
+    steal_count++;
+    return true;
+  }
+  return false;
+}
+
+void FilterBatch::advance(ParticleFilter& pf, const FilterInput& input) {
+  if (input.init || !pf.initialized()) {
+    pf.init(input.x, input.y, input.theta, config.sigma_pos);
+  } else {
+    pf.prediction(config.delta_t, config.sigma_pos, input.velocity,
+                  input.yaw_rate);
+  }
+  if (input.observations) {
+    pf.updateWeights(config.sensor_range, config.sigma_landmark,
+                     *input.observations, map);
+    pf.resample();
+  }
+}
@@ -0,0 +1,139 @@
+/**
+ * filter_batch.h
+ * Many independent particle filters stepped in lockstep on one pool, for
+ * offline localization of whole fleets of recorded trajectories.
+ *
+ * All filters weigh against the same read-only map, and one step() call
+ * forks the pool once for every filter instead of once per filter and
+ * stage. Within a step each worker starts on a contiguous share of the
+ * active filters and, once it runs dry, steals the back half of another
+ * worker's share. Filters of different cost (particle counts, observation
+ * counts) therefore keep all cores busy until the step is done. Filters
+ * whose trajectory has ended are left out of the step.
+ */
+
+#ifndef FILTER_BATCH_H_
+#define FILTER_BATCH_H_
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "helper_functions.h"
+#include "map.h"
+#include "particle_filter.h"
+#include "thread_pool.h"
+
+/**
+ * Filter parameters shared by all filters of a batch.
+ */
+struct BatchConfig {
+  double delta_t;            // Time elapsed between steps [sec]
+  double sensor_range;       // Sensor range [m]
+  double sigma_pos[3];       // GPS measurement uncertainty [m, m, rad]
+  double sigma_landmark[2];  // Landmark measurement uncertainty [m, m]
+};
+
+/**
+ * Input of one filter for one step.
+ */
+struct FilterInput {
+  bool active;      // Step this filter; inactive filters are left untouched
+  bool init;        // Initialize at the fix below instead of predicting
+  double x;         // Initial fix [m, m, rad]
+  double y;
+  double theta;
+  double velocity;  // Controls applied since the previous step
+  double yaw_rate;
+  // Observations of this step in vehicle coordinates; NULL predicts only
+  const std::vector<LandmarkObs>* observations;
+
+  FilterInput()
+      : active(false), init(false), x(0.0), y(0.0), theta(0.0),
+        velocity(0.0), yaw_rate(0.0), observations(NULL) {}
+};
+
+class FilterBatch {
+ public:
+  /**
+   * Constructor
+   * @param map Map shared read-only by all filters; must outlive the batch
+   * @param config Filter parameters
+   * @param num_threads Threads stepping filters, including the caller's
+   */
+  FilterBatch(const Map& map, const BatchConfig& config, int num_threads);
+
+  /**
+   * resize Sets the number of filters. New filters are default
+   *   constructed; configure them through filter() before their first
+   *   step. Filters run single-threaded: the batch parallelizes across
+   *   filters, so their own setNumThreads() should stay at 1.
+   */
+  void resize(int num_filters);
+
+  int size() const {
+    return static_cast<int>(filters.size());
+  }
+
+  ParticleFilter& filter(int k) {
+    return *filters[k];
+  }
+
+  const ParticleFilter& filter(int k) const {
+    return *filters[k];
+  }
+
+  int numThreads() const {
+    return pool.size();
+  }
+
+  /**
+   * step Advances every active filter by one frame: init or prediction,
+   *   then updateWeights and resample when it has observations. Blocks
+   *   until all are done. Each filter's result depends only on its own
+   *   seed and inputs, not on the thread count or on which thread ran it.
+   * @param inputs One input per filter (size() entries)
+   */
+  void step(const std::vector<FilterInput>& inputs);
+
+  /**
+   * steals Returns the number of work shares moved between workers.
+   */
+  unsigned long steals() const {
+    return steal_count.load();
+  }
+
+ private:
+  // Positions [begin, end) of active owned by one worker. A filter step
+  //   is tens of microseconds or more, so a mutex per share costs little.
+  struct Share {
+    std::mutex mutex;
+    int begin;
+    int end;
+  };
+
+  FilterBatch(const FilterBatch&);
+  FilterBatch& operator=(const FilterBatch&);
+
+  // Runs worker t's share, then steals until no share has work left
+  void runWorker(int t, const std::vector<FilterInput>& inputs);
+
+  // Takes the next filter of worker t's own share
+  bool popFront(int t, int& filter_index);
+
+  // Moves the back half of another worker's share to worker t
+  bool steal(int t);
+
+  void advance(ParticleFilter& pf, const FilterInput& input);
+
+  const Map& map;
+  BatchConfig config;
+  ThreadPool pool;
+  std::vector<std::unique_ptr<ParticleFilter> > filters;
+  std::vector<int> active;  // Filters stepped by the current call
+  // One per worker, allocated separately so they do not share cache lines
+  std::vector<std::unique_ptr<Share> > shares;
+  std::atomic<unsigned long> steal_count;
+};
+
+#endif  // FILTER_BATCH_H_
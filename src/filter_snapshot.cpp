@@ -0,0 +1,369 @@
+/**
+ * filter_snapshot.cpp
+ * Binary snapshot format of ParticleFilter and its file and background
+ * writers.
+ *
+ * Layout, in host byte order (the header records it), 8-byte aligned:
+ *   SnapshotHeader                  Counts, flags, random state, frame
+ *   ParticleStats                   Statistics of the last weighting pass
+ *   int32[set_size]                 ParticleSet id
+ *   double[set_size] x 4            ParticleSet x, y, theta, weight
+ *   double[log_weight_size]         Log-weights of the last weighting pass
+ *   int32[compact_size]             CompactParticleSet id
+ *   float[compact_size] x 2         CompactParticleSet dx, dy
+ *   uint16[compact_size]            CompactParticleSet heading
+ *   float[compact_size]             CompactParticleSet log_weight
+ *
+ * The sections are raw copies of the filter's arrays, so saving and
+ * restoring are a single copy of the particle state each.
+ */
+
+#include "filter_snapshot.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+
+namespace {
+
+const char kSnapshotMagic[8] = {'P', 'F', 'S', 'N', 'A', 'P', 0, 0};
+const uint32_t kSnapshotVersion = 1;
+const uint32_t kByteOrderMark = 0x01020304;
+
+static_assert(sizeof(int) == sizeof(int32_t), "ids are stored as int32");
+
+enum SnapshotFlag {
+  FLAG_INITIALIZED = 1,
+  FLAG_HAS_STATS = 2,
+  FLAG_CARRY_WEIGHTS = 4,
+  FLAG_PENDING_WEIGHTS = 8,
+  FLAG_COMPACT_CURRENT = 16,
+  FLAG_COMPACT_WEIGHTS = 32
+};
+
+struct SnapshotHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;      // kByteOrderMark as written by the producer
+  uint32_t stats_size;      // sizeof(ParticleStats)
+  uint32_t flags;           // SnapshotFlag bits
+  int32_t weight_mode;
+  int32_t num_particles;
+  int32_t set_size;         // Entries of the ParticleSet arrays
+  int32_t log_weight_size;
+  int32_t compact_size;
+  int32_t reserved;
+  uint64_t saved_at;        // [us since the epoch]
+  uint64_t random_seed;
+  uint64_t noise_frame;
+  uint64_t rng_state[4];
+  uint64_t skipped_resamples;
+  double weight_log_norm;
+  double anchor_x;          // CompactParticleSet anchor
+  double anchor_y;
+};
+
+inline uint64_t align8(uint64_t n) {
+  return (n + 7) & ~static_cast<uint64_t>(7);
+}
+
+// Byte offsets of the sections
+struct Layout {
+  uint64_t stats;
+  uint64_t set[5];      // id, x, y, theta, weight
+  uint64_t log_weights;
+  uint64_t compact[5];  // id, dx, dy, heading, log_weight
+  uint64_t end;
+};
+
+// Returns the offset of a section of n bytes at *pos and moves past it
+uint64_t section(uint64_t* pos, uint64_t n) {
+  uint64_t start = *pos;
+  *pos = align8(start + n);
+  return start;
+}
+
+Layout layoutOf(const SnapshotHeader& h) {
+  Layout l;
+  uint64_t pos = align8(sizeof(SnapshotHeader));
+  uint64_t n = h.set_size;
+  uint64_t c = h.compact_size;
+  l.stats = section(&pos, sizeof(ParticleStats));
+  l.set[0] = section(&pos, n * sizeof(int32_t));
+  for (int k = 1; k < 5; ++k) {
+    l.set[k] = section(&pos, n * sizeof(double));
+  }
+  l.log_weights = section(&pos, h.log_weight_size * sizeof(double));
+  l.compact[0] = section(&pos, c * sizeof(int32_t));
+  l.compact[1] = section(&pos, c * sizeof(float));
+  l.compact[2] = section(&pos, c * sizeof(float));
+  l.compact[3] = section(&pos, c * sizeof(uint16_t));
+  l.compact[4] = section(&pos, c * sizeof(float));
+  l.end = pos;
+  return l;
+}
+
+// Copies n elements of src to offset of out
+template <typename T>
+void put(std::vector<char>& out, uint64_t offset, const T* src, size_t n) {
+  if (n > 0) {
+    memcpy(&out[offset], src, n * sizeof(T));
+  }
+}
+
+// Replaces v by the n elements at offset of data
+template <typename T>
+void get(const char* data, uint64_t offset, size_t n, std::vector<T>& v) {
+  v.resize(n);
+  if (n > 0) {
+    memcpy(v.data(), data + offset, n * sizeof(T));
+  }
+}
+
+uint64_t nowUs() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// Header of data if it is a well-formed snapshot of this version
+const SnapshotHeader* checkHeader(const char* data, size_t size) {
+  if (size < sizeof(SnapshotHeader)) {
+    return NULL;
+  }
+  const SnapshotHeader* h = reinterpret_cast<const SnapshotHeader*>(data);
+  if (memcmp(h->magic, kSnapshotMagic, sizeof(kSnapshotMagic)) != 0 ||
+      h->version != kSnapshotVersion || h->byte_order != kByteOrderMark ||
+      h->stats_size != sizeof(ParticleStats) || h->num_particles < 0 ||
+      h->set_size < 0 || h->log_weight_size < 0 || h->compact_size < 0 ||
+      layoutOf(*h).end != size) {
+    return NULL;
+  }
+  return h;
+}
+
+}  // namespace
+
+void ParticleFilter::saveState(std::vector<char>& out) const {
+  SnapshotHeader h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, kSnapshotMagic, sizeof(kSnapshotMagic));
+  h.version = kSnapshotVersion;
+  h.byte_order = kByteOrderMark;
+  h.stats_size = sizeof(ParticleStats);
+  h.flags = (is_initialized ? FLAG_INITIALIZED : 0) |
+            (has_stats ? FLAG_HAS_STATS : 0) |
+            (carry_weights ? FLAG_CARRY_WEIGHTS : 0) |
+            (pending_weights ? FLAG_PENDING_WEIGHTS : 0) |
+            (compact_current ? FLAG_COMPACT_CURRENT : 0) |
+            (compact_weights ? FLAG_COMPACT_WEIGHTS : 0);
+  h.weight_mode = weight_mode;
+  h.num_particles = num_particles;
+  h.set_size = particles.size();
+  // Log-weights left over from a set of another size are never read again
+  h.log_weight_size =
+      log_weights.size() == static_cast<size_t>(particles.size())
+          ? log_weights.size() : 0;
+  h.compact_size = compact_current || compact_weights ? compact.size() : 0;
+  h.saved_at = nowUs();
+  h.random_seed = random_seed;
+  h.noise_frame = noise_frame;
+  rng.getState(h.rng_state);
+  h.skipped_resamples = skipped_resamples;
+  h.weight_log_norm = weight_log_norm;
+  h.anchor_x = compact.anchor_x;
+  h.anchor_y = compact.anchor_y;
+
+  // Zero-filled so the padding is deterministic; no reallocation once
+  //   out has grown to the largest snapshot
+  Layout l = layoutOf(h);
+  out.assign(l.end, 0);
+  put(out, 0, &h, 1);
+  put(out, l.stats, &weight_stats, 1);
+  put(out, l.set[0], particles.id.data(), h.set_size);
+  put(out, l.set[1], particles.x.data(), h.set_size);
+  put(out, l.set[2], particles.y.data(), h.set_size);
+  put(out, l.set[3], particles.theta.data(), h.set_size);
+  put(out, l.set[4], particles.weight.data(), h.set_size);
+  put(out, l.log_weights, log_weights.data(), h.log_weight_size);
+  put(out, l.compact[0], compact.id.data(), h.compact_size);
+  put(out, l.compact[1], compact.dx.data(), h.compact_size);
+  put(out, l.compact[2], compact.dy.data(), h.compact_size);
+  put(out, l.compact[3], compact.heading.data(), h.compact_size);
+  put(out, l.compact[4], compact.log_weight.data(), h.compact_size);
+}
+
+bool ParticleFilter::restoreState(const char* data, size_t size) {
+  const SnapshotHeader* h = checkHeader(data, size);
+  if (!h || h->weight_mode != weight_mode) {
+    return false;
+  }
+  // The file is untrusted; an initialized filter without particles would
+  //   read particles.x[0] in its next stats pass
+  bool initialized_in = (h->flags & FLAG_INITIALIZED) != 0;
+  if (initialized_in && h->num_particles == 0) {
+    return false;
+  }
+  // The arrays the flags say are current must hold every particle
+  bool compact_current_in = (h->flags & FLAG_COMPACT_CURRENT) != 0;
+  bool compact_weights_in = (h->flags & FLAG_COMPACT_WEIGHTS) != 0;
+  if ((compact_current_in || compact_weights_in) &&
+      h->compact_size != h->num_particles) {
+    return false;
+  }
+  if (!compact_current_in && h->set_size != h->num_particles) {
+    return false;
+  }
+  if (h->log_weight_size != 0 && h->log_weight_size != h->set_size) {
+    return false;
+  }
+
+  Layout l = layoutOf(*h);
+  num_particles = h->num_particles;
+  is_initialized = initialized_in;
+  has_stats = (h->flags & FLAG_HAS_STATS) != 0;
+  carry_weights = (h->flags & FLAG_CARRY_WEIGHTS) != 0;
+  pending_weights = (h->flags & FLAG_PENDING_WEIGHTS) != 0;
+  compact_current = compact_current_in;
+  compact_weights = compact_weights_in;
+  random_seed = h->random_seed;
+  noise_frame = h->noise_frame;
+  rng.setState(h->rng_state);
+  skipped_resamples = h->skipped_resamples;
+  weight_log_norm = h->weight_log_norm;
+  memcpy(&weight_stats, data + l.stats, sizeof(ParticleStats));
+
+  reserveBuffers();
+  get(data, l.set[0], h->set_size, particles.id);
+  get(data, l.set[1], h->set_size, particles.x);
+  get(data, l.set[2], h->set_size, particles.y);
+  get(data, l.set[3], h->set_size, particles.theta);
+  get(data, l.set[4], h->set_size, particles.weight);
+  get(data, l.log_weights, h->log_weight_size, log_weights);
+  compact.anchor_x = h->anchor_x;
+  compact.anchor_y = h->anchor_y;
+  get(data, l.compact[0], h->compact_size, compact.id);
+  get(data, l.compact[1], h->compact_size, compact.dx);
+  get(data, l.compact[2], h->compact_size, compact.dy);
+  get(data, l.compact[3], h->compact_size, compact.heading);
+  get(data, l.compact[4], h->compact_size, compact.log_weight);
+
+  // The association debug state refers to the saved filter's map
+  debug_map = NULL;
+  return true;
+}
+
+bool readSnapshotInfo(const char* data, size_t size, SnapshotInfo& info) {
+  const SnapshotHeader* h = checkHeader(data, size);
+  if (!h) {
+    return false;
+  }
+  info.num_particles = h->num_particles;
+  info.frame = h->noise_frame;
+  info.saved_at = h->saved_at;
+  return true;
+}
+
+double snapshotAge(const SnapshotInfo& info) {
+  return (static_cast<double>(nowUs()) - static_cast<double>(info.saved_at)) *
+         1e-6;
+}
+
+bool writeSnapshotFile(const std::string& filename,
+                       const std::vector<char>& data) {
+  std::string tmp = filename + ".tmp";
+  FILE* f = fopen(tmp.c_str(), "wb");
+  if (!f) {
+    return false;
+  }
+  bool ok = data.empty() ||
+            fwrite(data.data(), 1, data.size(), f) == data.size();
+  // On disk before it replaces the previous snapshot
+  ok = fflush(f) == 0 && ok;
+  ok = fsync(fileno(f)) == 0 && ok;
+  ok = fclose(f) == 0 && ok;
+  if (!ok || rename(tmp.c_str(), filename.c_str()) != 0) {
+    unlink(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool readSnapshotFile(const std::string& filename, std::vector<char>& data) {
+  FILE* f = fopen(filename.c_str(), "rb");
+  if (!f) {
+    return false;
+  }
+  bool ok = fseek(f, 0, SEEK_END) == 0;
+  long length = ok ? ftell(f) : -1;
+  ok = length >= 0 && fseek(f, 0, SEEK_SET) == 0;
+  if (ok) {
+    data.resize(length);
+    ok = length == 0 ||
+         fread(data.data(), 1, length, f) == static_cast<size_t>(length);
+  }
+  fclose(f);
+  return ok;
+}
+
+SnapshotWriter::SnapshotWriter(const std::string& filename)
+    : filename(filename), dirty(false), stopping(false), failed_writes(0) {
+  SnapshotInfo info;
+  if (!readSnapshotFile(filename, current) ||
+      !readSnapshotInfo(current.data(), current.size(), info)) {
+    current.clear();
+  }
+  writer = std::thread(&SnapshotWriter::writerLoop, this);
+}
+
+SnapshotWriter::~SnapshotWriter() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  cv.notify_one();
+  writer.join();
+}
+
+void SnapshotWriter::submit(const ParticleFilter& pf) {
+  std::lock_guard<std::mutex> submit_lock(submit_mutex);
+  pf.saveState(spare);
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    current.swap(spare);
+    dirty = true;
+  }
+  cv.notify_one();
+}
+
+bool SnapshotWriter::latest(std::vector<char>& data) const {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (current.empty()) {
+    return false;
+  }
+  data.assign(current.begin(), current.end());
+  return true;
+}
+
+unsigned long SnapshotWriter::failedWrites() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return failed_writes;
+}
+
+void SnapshotWriter::writerLoop() {
+  std::unique_lock<std::mutex> lock(mutex);
+  for (;;) {
+    cv.wait(lock, [this] { return stopping || dirty; });
+    if (!dirty) {
+      return;
+    }
+    writing.assign(current.begin(), current.end());
+    dirty = false;
+    lock.unlock();
+    bool ok = writeSnapshotFile(filename, writing);
+    lock.lock();
+    if (!ok) {
+      failed_writes++;
+    }
+  }
+}
@@ -0,0 +1,111 @@
+/**
+ * filter_snapshot.h
+ * Snapshots of the particle filter state (ParticleFilter::saveState) on
+ * disk and in the background, for a warm start after a restart or a
+ * dropped connection.
+ */
+
+#ifndef FILTER_SNAPSHOT_H_
+#define FILTER_SNAPSHOT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "particle_filter.h"
+
+/**
+ * Header fields of a snapshot.
+ */
+struct SnapshotInfo {
+  int num_particles;
+  unsigned long frame;  // Noise draws since the filter was seeded
+  uint64_t saved_at;    // Wall clock of saveState [us since the epoch]
+};
+
+/**
+ * readSnapshotInfo Reads the header of a snapshot made by saveState.
+ * @output False if data is not a snapshot of this format version
+ */
+bool readSnapshotInfo(const char* data, size_t size, SnapshotInfo& info);
+
+/**
+ * snapshotAge Returns the seconds since the snapshot was saved.
+ */
+double snapshotAge(const SnapshotInfo& info);
+
+/**
+ * writeSnapshotFile Writes a snapshot to filename through a temporary file
+ *   renamed over it, so readers never see a partial snapshot. A path on a
+ *   memory file system (/dev/shm) keeps it in shared memory.
+ * @output True if the snapshot was written
+ */
+bool writeSnapshotFile(const std::string& filename,
+                       const std::vector<char>& data);
+
+/**
+ * readSnapshotFile Reads a snapshot written by writeSnapshotFile into data,
+ *   reusing its storage.
+ * @output True if the file could be read
+ */
+bool readSnapshotFile(const std::string& filename, std::vector<char>& data);
+
+/**
+ * Keeps the latest snapshot of a filter in memory and writes it to a file
+ *   on its own thread. submit() only serializes into a spare buffer, so
+ *   the filter thread never waits on the disk; a snapshot not yet written
+ *   when a newer one arrives is replaced by it.
+ */
+class SnapshotWriter {
+ public:
+  /**
+   * Constructor Loads the snapshot already in filename, if any, as the
+   *   latest one and starts the writer thread.
+   * @param filename Snapshot file
+   */
+  explicit SnapshotWriter(const std::string& filename);
+
+  /**
+   * Destructor Writes the last submitted snapshot and stops the thread.
+   */
+  ~SnapshotWriter();
+
+  /**
+   * submit Snapshots pf as the latest state and queues it for writing.
+   */
+  void submit(const ParticleFilter& pf);
+
+  /**
+   * latest Copies the latest snapshot into data, reusing its storage.
+   * @output False if there is none
+   */
+  bool latest(std::vector<char>& data) const;
+
+  /**
+   * failedWrites Returns the number of snapshots that could not be written.
+   */
+  unsigned long failedWrites() const;
+
+ private:
+  SnapshotWriter(const SnapshotWriter&);
+  SnapshotWriter& operator=(const SnapshotWriter&);
+
+  void writerLoop();
+
+  std::string filename;
+  std::mutex submit_mutex;    // Held while serializing into spare
+  mutable std::mutex mutex;   // Guards the buffers below and the flags
+  std::condition_variable cv;
+  std::vector<char> current;  // Latest snapshot
+  std::vector<char> writing;  // Copy the writer thread writes out
+  std::vector<char> spare;    // Buffer submit() serializes into
+  bool dirty;                 // current not yet written
+  bool stopping;
+  unsigned long failed_writes;
+  std::thread writer;
+};
+
+#endif  // FILTER_SNAPSHOT_H_
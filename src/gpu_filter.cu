@@ -0,0 +1,626 @@
+/**
+ * gpu_filter.cu
+ * CUDA kernels of GpuParticleFilter.
+ *
+ * One thread per particle for motion and weighting. Noise is drawn from a
+ * counter-based hash of (seed, frame, particle, draw), so no per-particle
+ * generator state is kept and the draws do not depend on the launch shape.
+ * The weight reductions, the prefix sum and the moments use Thrust.
+ */
+
+#include "gpu_filter.h"
+
+#include <math.h>
+#include <algorithm>
+#include <cuda_runtime.h>
+#include <thrust/device_ptr.h>
+#include <thrust/execution_policy.h>
+#include <thrust/extrema.h>
+#include <thrust/iterator/counting_iterator.h>
+#include <thrust/scan.h>
+#include <thrust/system_error.h>
+#include <thrust/transform_reduce.h>
+
+namespace {
+
+const int kBlockSize = 256;
+
+int numBlocks(int n) {
+  return std::max(1, (n + kBlockSize - 1) / kBlockSize);
+}
+
+// splitmix64 finalizer
+__host__ __device__ uint64_t mix64(uint64_t z) {
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+// Uniform in (0, 1) for draw k of particle i in the given frame
+__device__ double uniformDraw(uint64_t frame_key, int i, int k) {
+  uint64_t z = mix64(frame_key + static_cast<uint64_t>(i) * 0x9e3779b97f4a7c15ULL
+                     + static_cast<uint64_t>(k) * 0xd1b54a32d192ed03ULL);
+  return ((z >> 11) + 0.5) * (1.0 / 9007199254740992.0);
+}
+
+// Two standard normals from draws (k, k + 1) by Box-Muller
+__device__ void gaussianPair(uint64_t frame_key, int i, int k, double* z0,
+                             double* z1) {
+  double r = sqrt(-2.0 * log(uniformDraw(frame_key, i, k)));
+  double s, c;
+  sincospi(2.0 * uniformDraw(frame_key, i, k + 1), &s, &c);
+  *z0 = r * c;
+  *z1 = r * s;
+}
+
+__device__ void addNoise(uint64_t frame_key, int i, double sx, double sy,
+                         double st, double* x, double* y, double* theta) {
+  double n0, n1, n2, n3;
+  gaussianPair(frame_key, i, 0, &n0, &n1);
+  gaussianPair(frame_key, i, 2, &n2, &n3);
+  x[i] += sx * n0;
+  y[i] += sy * n1;
+  theta[i] += st * n2;
+}
+
+__global__ void initKernel(int n, double x0, double y0, double theta0,
+                           double sx, double sy, double st,
+                           uint64_t frame_key, double* x, double* y,
+                           double* theta, double* w) {
+  int i = blockIdx.x * blockDim.x + threadIdx.x;
+  if (i >= n) {
+    return;
+  }
+  x[i] = x0;
+  y[i] = y0;
+  theta[i] = theta0;
+  w[i] = 1.0;
+  addNoise(frame_key, i, sx, sy, st, x, y, theta);
+}
+
+__global__ void initUniformKernel(int n, double lo_x, double lo_y,
+                                  double span_x, double span_y,
+                                  uint64_t frame_key, double* x, double* y,
+                                  double* theta, double* w) {
+  int i = blockIdx.x * blockDim.x + threadIdx.x;
+  if (i >= n) {
+    return;
+  }
+  x[i] = lo_x + span_x * uniformDraw(frame_key, i, 0);
+  y[i] = lo_y + span_y * uniformDraw(frame_key, i, 1);
+  theta[i] = 2.0 * M_PI * uniformDraw(frame_key, i, 2);
+  w[i] = 1.0;
+}
+
+// CTRV in the sin/cos-of-the-heading form of predictCTRV
+__global__ void predictKernel(int n, double xs, double xc, double ys,
+                              double yc, double dtheta, double sx, double sy,
+                              double st, uint64_t frame_key, double* x,
+                              double* y, double* theta) {
+  int i = blockIdx.x * blockDim.x + threadIdx.x;
+  if (i >= n) {
+    return;
+  }
+  double s, c;
+  sincos(theta[i], &s, &c);
+  x[i] += xs * s + xc * c;
+  y[i] += ys * s + yc * c;
+  theta[i] += dtheta;
+  addNoise(frame_key, i, sx, sy, st, x, y, theta);
+}
+
+struct DeviceMap {
+  const float* lm_x;
+  const float* lm_y;
+  const int* start;
+  const int* items;
+  double cell_size;
+  double min_x;
+  double min_y;
+  int cols;
+  int rows;
+};
+
+// Log-likelihood of every particle. The cells overlapping the sensor disk
+//   are walked in queryRange order, so the nearest landmark and its ties
+//   match the CPU filter.
+__global__ void weightKernel(int n, DeviceMap map, const double* x,
+                             const double* y, const double* theta,
+                             const float* obs_x, const float* obs_y,
+                             int num_obs, double range, double inv_2sx2,
+                             double inv_2sy2, double log_norm,
+                             double* log_w) {
+  int i = blockIdx.x * blockDim.x + threadIdx.x;
+  if (i >= n) {
+    return;
+  }
+  double px = x[i];
+  double py = y[i];
+  double s, c;
+  sincos(theta[i], &s, &c);
+
+  int c0 = max(0, static_cast<int>(floor((px - range - map.min_x) / map.cell_size)));
+  int c1 = min(map.cols - 1, static_cast<int>(floor((px + range - map.min_x) / map.cell_size)));
+  int r0 = max(0, static_cast<int>(floor((py - range - map.min_y) / map.cell_size)));
+  int r1 = min(map.rows - 1, static_cast<int>(floor((py + range - map.min_y) / map.cell_size)));
+
+  double lw = 0.0;
+  for (int j = 0; j < num_obs; ++j) {
+    double mx = px + c * obs_x[j] - s * obs_y[j];
+    double my = py + s * obs_x[j] + c * obs_y[j];
+    // No landmark in range leaves the residual to the origin, as on the CPU
+    double best_d2 = INFINITY;
+    double best_dx = mx;
+    double best_dy = my;
+    for (int r = r0; r <= r1; ++r) {
+      for (int col = c0; col <= c1; ++col) {
+        int cell = r * map.cols + col;
+        for (int k = map.start[cell]; k < map.start[cell + 1]; ++k) {
+          int lm = map.items[k];
+          double lx = map.lm_x[lm];
+          double ly = map.lm_y[lm];
+          double rx = lx - px;
+          double ry = ly - py;
+          if (sqrt(rx * rx + ry * ry) > range) {
+            continue;
+          }
+          double dx = mx - lx;
+          double dy = my - ly;
+          double d2 = dx * dx + dy * dy;
+          if (d2 < best_d2) {
+            best_d2 = d2;
+            best_dx = dx;
+            best_dy = dy;
+          }
+        }
+      }
+    }
+    lw += log_norm - (best_dx * best_dx * inv_2sx2 + best_dy * best_dy * inv_2sy2);
+  }
+  log_w[i] = lw;
+}
+
+__global__ void expKernel(int n, const double* log_w, double max_lw,
+                          double* w) {
+  int i = blockIdx.x * blockDim.x + threadIdx.x;
+  if (i < n) {
+    w[i] = exp(log_w[i] - max_lw);
+  }
+}
+
+// Systematic resampling: output j takes the first particle whose
+//   cumulative weight exceeds (j + u) / n of the total
+__global__ void resampleKernel(int n, const double* cdf, double u,
+                               const double* x, const double* y,
+                               const double* theta, double* out_x,
+                               double* out_y, double* out_theta,
+                               double* w) {
+  int j = blockIdx.x * blockDim.x + threadIdx.x;
+  if (j >= n) {
+    return;
+  }
+  double target = (j + u) / n * cdf[n - 1];
+  int lo = 0;
+  int hi = n - 1;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (cdf[mid] > target) {
+      hi = mid;
+    } else {
+      lo = mid + 1;
+    }
+  }
+  out_x[j] = x[lo];
+  out_y[j] = y[lo];
+  out_theta[j] = theta[lo];
+  // The draw reads only cdf, so the survivors' equal weights go in place
+  w[j] = 1.0;
+}
+
+// Weighted moments about a reference pose, as StatsAccumulator
+struct Moments {
+  double sw, sw2, sx, sy, st, sxx, syy, stt, sxy, sxt, syt;
+
+  __host__ __device__ Moments()
+      : sw(0), sw2(0), sx(0), sy(0), st(0), sxx(0), syy(0), stt(0), sxy(0),
+        sxt(0), syt(0) {}
+};
+
+struct MomentOf {
+  const double* w;
+  const double* x;
+  const double* y;
+  const double* theta;
+  double rx, ry, rt;
+
+  __host__ __device__ Moments operator()(int i) const {
+    Moments m;
+    double dx = x[i] - rx;
+    double dy = y[i] - ry;
+    double dt = theta[i] - rt;
+    if (fabs(dt) > M_PI) {
+      dt = remainder(dt, 2.0 * M_PI);
+    }
+    m.sw = w[i];
+    m.sw2 = w[i] * w[i];
+    m.sx = w[i] * dx;
+    m.sy = w[i] * dy;
+    m.st = w[i] * dt;
+    m.sxx = m.sx * dx;
+    m.syy = m.sy * dy;
+    m.stt = m.st * dt;
+    m.sxy = m.sx * dy;
+    m.sxt = m.sx * dt;
+    m.syt = m.sy * dt;
+    return m;
+  }
+};
+
+struct MomentSum {
+  __host__ __device__ Moments operator()(const Moments& a,
+                                         const Moments& b) const {
+    Moments m;
+    m.sw = a.sw + b.sw;
+    m.sw2 = a.sw2 + b.sw2;
+    m.sx = a.sx + b.sx;
+    m.sy = a.sy + b.sy;
+    m.st = a.st + b.st;
+    m.sxx = a.sxx + b.sxx;
+    m.syy = a.syy + b.syy;
+    m.stt = a.stt + b.stt;
+    m.sxy = a.sxy + b.sxy;
+    m.sxt = a.sxt + b.sxt;
+    m.syt = a.syt + b.syt;
+    return m;
+  }
+};
+
+}  // namespace
+
+struct GpuParticleFilter::DeviceState {
+  // Particle set and the back buffer resample() gathers into
+  double* x;
+  double* y;
+  double* theta;
+  double* next_x;
+  double* next_y;
+  double* next_theta;
+  double* log_w;
+  double* w;
+  double* cdf;
+
+  // Observations of the current frame, grown on demand
+  float* obs_x;
+  float* obs_y;
+  int obs_capacity;
+  std::vector<float> host_obs;
+
+  // Map; landmark coordinates split into arrays
+  float* lm_x;
+  float* lm_y;
+  int* start;
+  int* items;
+  DeviceMap map;
+  double lo_x, lo_y, hi_x, hi_y;  // Landmark bounding box
+
+  DeviceState()
+      : x(NULL), y(NULL), theta(NULL), next_x(NULL), next_y(NULL),
+        next_theta(NULL), log_w(NULL), w(NULL), cdf(NULL), obs_x(NULL),
+        obs_y(NULL), obs_capacity(0), lm_x(NULL), lm_y(NULL), start(NULL),
+        items(NULL), lo_x(0), lo_y(0), hi_x(0), hi_y(0) {
+    map.cols = map.rows = 0;
+  }
+
+  void freeMap() {
+    cudaFree(lm_x);
+    cudaFree(lm_y);
+    cudaFree(start);
+    cudaFree(items);
+    lm_x = lm_y = NULL;
+    start = items = NULL;
+    map.cols = map.rows = 0;
+  }
+
+  ~DeviceState() {
+    cudaFree(x);
+    cudaFree(y);
+    cudaFree(theta);
+    cudaFree(next_x);
+    cudaFree(next_y);
+    cudaFree(next_theta);
+    cudaFree(log_w);
+    cudaFree(w);
+    cudaFree(cdf);
+    cudaFree(obs_x);
+    cudaFree(obs_y);
+    freeMap();
+  }
+};
+
+bool GpuParticleFilter::available() {
+  int count = 0;
+  return cudaGetDeviceCount(&count) == cudaSuccess && count > 0;
+}
+
+GpuParticleFilter::GpuParticleFilter(int num_particles)
+    : num_particles(num_particles), is_initialized(false), random_seed(0),
+      frame(0), rng(mixSeed(0, 0)), dev(new DeviceState()) {
+  size_t bytes = sizeof(double) * num_particles;
+  double** buffers[] = {&dev->x, &dev->y, &dev->theta, &dev->next_x,
+                        &dev->next_y, &dev->next_theta, &dev->log_w, &dev->w,
+                        &dev->cdf};
+  for (size_t b = 0; b < sizeof(buffers) / sizeof(buffers[0]); ++b) {
+    if (!check(cudaMalloc(buffers[b], bytes), "cudaMalloc particles")) {
+      return;
+    }
+  }
+}
+
+GpuParticleFilter::~GpuParticleFilter() {}
+
+bool GpuParticleFilter::check(int status, const char* what) {
+  if (status != cudaSuccess && last_error.empty()) {
+    last_error = std::string(what) + ": " +
+        cudaGetErrorString(static_cast<cudaError_t>(status));
+  }
+  return status == cudaSuccess;
+}
+
+bool GpuParticleFilter::setMap(const Map& map) {
+  if (!ok()) {
+    return false;
+  }
+  // The kernels walk the grid, so an unindexed map is indexed on a copy
+  Map indexed_copy;
+  const Map* source = &map;
+  if (!map.indexed()) {
+    indexed_copy.landmark_list.assign(map.landmarks(),
+                                      map.landmarks() + map.size());
+    indexed_copy.buildIndex();
+    source = &indexed_copy;
+  }
+  Map::IndexView view = source->indexView();
+  const Map::single_landmark_s* landmarks = source->landmarks();
+  int count = source->size();
+  int cells = view.cols * view.rows;
+
+  std::vector<float> lx(count), ly(count);
+  dev->lo_x = dev->lo_y = dev->hi_x = dev->hi_y = 0.0;
+  for (int i = 0; i < count; ++i) {
+    lx[i] = landmarks[i].x_f;
+    ly[i] = landmarks[i].y_f;
+    if (i == 0 || lx[i] < dev->lo_x) dev->lo_x = lx[i];
+    if (i == 0 || lx[i] > dev->hi_x) dev->hi_x = lx[i];
+    if (i == 0 || ly[i] < dev->lo_y) dev->lo_y = ly[i];
+    if (i == 0 || ly[i] > dev->hi_y) dev->hi_y = ly[i];
+  }
+
+  dev->freeMap();
+  if (count == 0 || cells == 0) {
+    return true;
+  }
+  bool uploaded =
+      check(cudaMalloc(&dev->lm_x, sizeof(float) * count), "cudaMalloc map") &&
+      check(cudaMalloc(&dev->lm_y, sizeof(float) * count), "cudaMalloc map") &&
+      check(cudaMalloc(&dev->start, sizeof(int) * (cells + 1)), "cudaMalloc map") &&
+      check(cudaMalloc(&dev->items, sizeof(int) * count), "cudaMalloc map") &&
+      check(cudaMemcpy(dev->lm_x, lx.data(), sizeof(float) * count,
+                       cudaMemcpyHostToDevice), "upload map") &&
+      check(cudaMemcpy(dev->lm_y, ly.data(), sizeof(float) * count,
+                       cudaMemcpyHostToDevice), "upload map") &&
+      check(cudaMemcpy(dev->start, view.start, sizeof(int) * (cells + 1),
+                       cudaMemcpyHostToDevice), "upload map") &&
+      check(cudaMemcpy(dev->items, view.items, sizeof(int) * count,
+                       cudaMemcpyHostToDevice), "upload map");
+  if (!uploaded) {
+    dev->freeMap();
+    return false;
+  }
+  dev->map.lm_x = dev->lm_x;
+  dev->map.lm_y = dev->lm_y;
+  dev->map.start = dev->start;
+  dev->map.items = dev->items;
+  dev->map.cell_size = view.cell_size;
+  dev->map.min_x = view.min_x;
+  dev->map.min_y = view.min_y;
+  dev->map.cols = view.cols;
+  dev->map.rows = view.rows;
+  return true;
+}
+
+void GpuParticleFilter::setSeed(uint64_t seed) {
+  random_seed = seed;
+  frame = 0;
+  rng.reseed(mixSeed(seed, 0));
+}
+
+void GpuParticleFilter::init(double x, double y, double theta,
+                             const double std[]) {
+  if (!ok()) {
+    return;
+  }
+  initKernel<<<numBlocks(num_particles), kBlockSize>>>(
+      num_particles, x, y, theta, std[0], std[1], std[2],
+      mixSeed(random_seed, ++frame), dev->x, dev->y, dev->theta, dev->w);
+  check(cudaGetLastError(), "initKernel");
+  weight_stats = ParticleStats();
+  weight_stats.mean_x = x;
+  weight_stats.mean_y = y;
+  weight_stats.mean_theta = theta;
+  is_initialized = true;
+}
+
+void GpuParticleFilter::initUniform() {
+  if (!ok()) {
+    return;
+  }
+  initUniformKernel<<<numBlocks(num_particles), kBlockSize>>>(
+      num_particles, dev->lo_x, dev->lo_y, dev->hi_x - dev->lo_x,
+      dev->hi_y - dev->lo_y, mixSeed(random_seed, ++frame), dev->x, dev->y,
+      dev->theta, dev->w);
+  check(cudaGetLastError(), "initUniformKernel");
+  weight_stats = ParticleStats();
+  weight_stats.mean_x = 0.5 * (dev->lo_x + dev->hi_x);
+  weight_stats.mean_y = 0.5 * (dev->lo_y + dev->hi_y);
+  is_initialized = true;
+}
+
+void GpuParticleFilter::prediction(double delta_t, const double std_pos[],
+                                   double velocity, double yaw_rate) {
+  if (!ok()) {
+    return;
+  }
+  // Per-frame coefficients of predictCTRV; only these go to the device
+  double xs, xc, ys, yc, dtheta;
+  if (fabs(yaw_rate) > 0.00001) {
+    dtheta = yaw_rate * delta_t;
+    double k = velocity / yaw_rate;
+    double h = sin(0.5 * dtheta);
+    double cm1 = -2.0 * h * h;
+    double sa = sin(dtheta);
+    xs = k * cm1;
+    xc = k * sa;
+    ys = k * sa;
+    yc = -k * cm1;
+  } else {
+    dtheta = 0.0;
+    xs = 0.0;
+    xc = velocity * delta_t;
+    ys = velocity * delta_t;
+    yc = 0.0;
+  }
+  predictKernel<<<numBlocks(num_particles), kBlockSize>>>(
+      num_particles, xs, xc, ys, yc, dtheta, std_pos[0], std_pos[1],
+      std_pos[2], mixSeed(random_seed, ++frame), dev->x, dev->y, dev->theta);
+  check(cudaGetLastError(), "predictKernel");
+}
+
+void GpuParticleFilter::updateWeights(
+    double sensor_range, const double std_landmark[],
+    const std::vector<LandmarkObs>& observations) {
+  if (!ok() || num_particles == 0) {
+    return;
+  }
+  // Upload the observations as x[n] then y[n]
+  int num_obs = observations.size();
+  if (num_obs > dev->obs_capacity) {
+    cudaFree(dev->obs_x);
+    cudaFree(dev->obs_y);
+    dev->obs_x = dev->obs_y = NULL;
+    dev->obs_capacity = 0;
+    if (!check(cudaMalloc(&dev->obs_x, sizeof(float) * num_obs), "cudaMalloc observations") ||
+        !check(cudaMalloc(&dev->obs_y, sizeof(float) * num_obs), "cudaMalloc observations")) {
+      return;
+    }
+    dev->obs_capacity = num_obs;
+  }
+  dev->host_obs.resize(2 * num_obs);
+  for (int j = 0; j < num_obs; ++j) {
+    dev->host_obs[j] = observations[j].x;
+    dev->host_obs[num_obs + j] = observations[j].y;
+  }
+  if (num_obs > 0 &&
+      (!check(cudaMemcpy(dev->obs_x, dev->host_obs.data(), sizeof(float) * num_obs,
+                         cudaMemcpyHostToDevice), "upload observations") ||
+       !check(cudaMemcpy(dev->obs_y, dev->host_obs.data() + num_obs,
+                         sizeof(float) * num_obs, cudaMemcpyHostToDevice),
+              "upload observations"))) {
+    return;
+  }
+
+  const GaussianLikelihood likelihood(std_landmark[0], std_landmark[1]);
+  weightKernel<<<numBlocks(num_particles), kBlockSize>>>(
+      num_particles, dev->map, dev->x, dev->y, dev->theta, dev->obs_x,
+      dev->obs_y, num_obs, sensor_range, likelihood.inv_2sx2,
+      likelihood.inv_2sy2, likelihood.log_norm, dev->log_w);
+  if (!check(cudaGetLastError(), "weightKernel")) {
+    return;
+  }
+
+  try {
+    // Best particle and log-sum-exp maximum in one reduction
+    thrust::device_ptr<double> log_w(dev->log_w);
+    thrust::device_ptr<double> best =
+        thrust::max_element(thrust::device, log_w, log_w + num_particles);
+    int best_index = best - log_w;
+    double max_lw = *best;
+
+    expKernel<<<numBlocks(num_particles), kBlockSize>>>(num_particles,
+                                                        dev->log_w, max_lw,
+                                                        dev->w);
+    if (!check(cudaGetLastError(), "expKernel")) {
+      return;
+    }
+
+    // Moments about the previous mean pose
+    MomentOf moment_of;
+    moment_of.w = dev->w;
+    moment_of.x = dev->x;
+    moment_of.y = dev->y;
+    moment_of.theta = dev->theta;
+    moment_of.rx = weight_stats.mean_x;
+    moment_of.ry = weight_stats.mean_y;
+    moment_of.rt = weight_stats.mean_theta;
+    Moments m = thrust::transform_reduce(
+        thrust::device, thrust::counting_iterator<int>(0),
+        thrust::counting_iterator<int>(num_particles), moment_of, Moments(),
+        MomentSum());
+
+    double best_pose[3];
+    if (!check(cudaMemcpy(&best_pose[0], dev->x + best_index, sizeof(double),
+                          cudaMemcpyDeviceToHost), "download best") ||
+        !check(cudaMemcpy(&best_pose[1], dev->y + best_index, sizeof(double),
+                          cudaMemcpyDeviceToHost), "download best") ||
+        !check(cudaMemcpy(&best_pose[2], dev->theta + best_index, sizeof(double),
+                          cudaMemcpyDeviceToHost), "download best")) {
+      return;
+    }
+
+    ParticleStats stats;
+    stats.best_id = best_index;
+    stats.best_x = best_pose[0];
+    stats.best_y = best_pose[1];
+    stats.best_theta = best_pose[2];
+    stats.max_weight = 1.0 / m.sw;
+    stats.weight_sum = 1.0;
+    stats.ess = m.sw * m.sw / m.sw2;
+    double mx = m.sx / m.sw;
+    double my = m.sy / m.sw;
+    double mt = m.st / m.sw;
+    stats.mean_x = moment_of.rx + mx;
+    stats.mean_y = moment_of.ry + my;
+    stats.mean_theta = moment_of.rt + mt;
+    stats.covariance[0][0] = m.sxx / m.sw - mx * mx;
+    stats.covariance[1][1] = m.syy / m.sw - my * my;
+    stats.covariance[2][2] = m.stt / m.sw - mt * mt;
+    stats.covariance[0][1] = stats.covariance[1][0] = m.sxy / m.sw - mx * my;
+    stats.covariance[0][2] = stats.covariance[2][0] = m.sxt / m.sw - mx * mt;
+    stats.covariance[1][2] = stats.covariance[2][1] = m.syt / m.sw - my * mt;
+    weight_stats = stats;
+  } catch (const thrust::system_error& e) {
+    check(cudaErrorUnknown, e.what());
+  }
+}
+
+void GpuParticleFilter::resample() {
+  if (!ok() || num_particles == 0) {
+    return;
+  }
+  try {
+    thrust::device_ptr<double> w(dev->w);
+    thrust::device_ptr<double> cdf(dev->cdf);
+    thrust::inclusive_scan(thrust::device, w, w + num_particles, cdf);
+  } catch (const thrust::system_error& e) {
+    check(cudaErrorUnknown, e.what());
+    return;
+  }
+  resampleKernel<<<numBlocks(num_particles), kBlockSize>>>(
+      num_particles, dev->cdf, rng.uniform(), dev->x, dev->y, dev->theta,
+      dev->next_x, dev->next_y, dev->next_theta, dev->w);
+  if (!check(cudaGetLastError(), "resampleKernel")) {
+    return;
+  }
+  std::swap(dev->x, dev->next_x);
+  std::swap(dev->y, dev->next_y);
+  std::swap(dev->theta, dev->next_theta);
+}
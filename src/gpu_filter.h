@@ -0,0 +1,128 @@
+/**
+ * gpu_filter.h
+ * Experimental CUDA backend of the particle filter, built with
+ * -DPF_ENABLE_CUDA=ON; it has not yet been compiled with nvcc.
+ *
+ * The particle set stays resident on the device. Per frame only the
+ * controls and the observations are uploaded; motion, range query,
+ * association, likelihood, the weight reductions and the prefix-sum
+ * resampler run as device kernels, and only the summary pose (stats())
+ * comes back. Meant for very large sets, e.g. 1M particles spread over
+ * the map for global relocalization.
+ */
+
+#ifndef GPU_FILTER_H_
+#define GPU_FILTER_H_
+
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include "helper_functions.h"
+#include "map.h"
+#include "particle_stats.h"
+#include "rng.h"
+
+class GpuParticleFilter {
+ public:
+  /**
+   * available Returns whether a CUDA device can be used.
+   */
+  static bool available();
+
+  /**
+   * Constructor, allocates the device buffers for num_particles.
+   */
+  explicit GpuParticleFilter(int num_particles);
+  ~GpuParticleFilter();
+
+  /**
+   * setMap Uploads the landmarks and the spatial index of map.
+   * @output False if the upload failed (see error())
+   */
+  bool setMap(const Map& map);
+
+  /**
+   * setSeed Restarts all random draws of the filter from seed.
+   */
+  void setSeed(uint64_t seed);
+
+  /**
+   * init Spreads the particles as a Gaussian of std[] around (x, y, theta).
+   */
+  void init(double x, double y, double theta, const double std[]);
+
+  /**
+   * initUniform Spreads the particles uniformly over the map's bounding
+   *   box with uniform headings, for relocalization without a prior.
+   */
+  void initUniform();
+
+  /**
+   * prediction Moves every particle by the CTRV model plus noise of
+   *   std_pos[]; only the three controls are uploaded.
+   */
+  void prediction(double delta_t, const double std_pos[], double velocity,
+                  double yaw_rate);
+
+  /**
+   * updateWeights Weighs every particle against the uploaded map in log
+   *   domain, normalizes the weights and reduces them to stats().
+   */
+  void updateWeights(double sensor_range, const double std_landmark[],
+                     const std::vector<LandmarkObs>& observations);
+
+  /**
+   * resample Systematic resampling over the device prefix sum of the
+   *   weights; the set stays on the device.
+   */
+  void resample();
+
+  /**
+   * stats Returns the summary of the last updateWeights: best particle,
+   *   weighted mean pose, ESS and covariance.
+   */
+  const ParticleStats& stats() const {
+    return weight_stats;
+  }
+
+  int size() const {
+    return num_particles;
+  }
+
+  bool initialized() const {
+    return is_initialized;
+  }
+
+  /**
+   * ok Returns false once a CUDA call has failed; error() says which.
+   */
+  bool ok() const {
+    return last_error.empty();
+  }
+
+  const std::string& error() const {
+    return last_error;
+  }
+
+ private:
+  GpuParticleFilter(const GpuParticleFilter&);
+  GpuParticleFilter& operator=(const GpuParticleFilter&);
+
+  // Records the first failing call
+  bool check(int status, const char* what);
+
+  int num_particles;
+  bool is_initialized;
+  uint64_t random_seed;
+  unsigned long frame;  // Keys the device noise streams
+  Xoshiro256 rng;       // Offsets of resample()
+  ParticleStats weight_stats;
+  std::string last_error;
+
+  // Device buffers (gpu_filter.cu)
+  struct DeviceState;
+  std::unique_ptr<DeviceState> dev;
+};
+
+#endif  // GPU_FILTER_H_
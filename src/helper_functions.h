@@ -14,6 +14,7 @@
 #include <sstream>
 #include <string>
 #include <vector>
+#include "fast_math.h"
 #include "map.h"
 
 // for portability of M_PI (Vis Studio, MinGW, etc.)
@@ -78,10 +79,15 @@ inline double * getError(double gt_x, double gt_y, double gt_theta, double pf_x,
 
 /**
  * Reads map data from a file.
- * @param filename Name of file containing map data.
+ * @param filename Name of file containing map data, either the text
+ *   format or a binary map (see map.cpp), which is memory-mapped
  * @output True if opening and reading file was successful
  */
 inline bool read_map_data(std::string filename, Map& map) {
+  if (Map::isBinaryMap(filename)) {
+    return map.loadBinary(filename);
+  }
+
   // Get file of map
   std::ifstream in_file_map(filename.c_str(),std::ifstream::in);
   // Return if we can't open the file
@@ -117,6 +123,9 @@ inline bool read_map_data(std::string filename, Map& map) {
     // Add to landmark list of map
     map.landmark_list.push_back(single_landmark_temp);
   }
+
+  // Build the spatial index used for sensor range queries
+  map.buildIndex();
   return true;
 }
 
@@ -261,4 +270,57 @@ inline double multiv_prob(double sig_x, double sig_y, double x_obs, double y_obs
   return weight;
 }
 
+/**
+ * Bivariate Gaussian measurement likelihood with the constant terms of
+ *   multiv_prob hoisted out, so that they are computed once per update.
+ */
+struct GaussianLikelihood {
+  double gauss_norm;  // 1 / (2 pi sig_x sig_y)
+  double log_norm;    // log(gauss_norm)
+  double inv_2sx2;    // 1 / (2 sig_x^2)
+  double inv_2sy2;    // 1 / (2 sig_y^2)
+
+  GaussianLikelihood(double sig_x, double sig_y)
+      : gauss_norm(1 / (2 * M_PI * sig_x * sig_y)),
+        log_norm(log(gauss_norm)),
+        inv_2sx2(1 / (2 * sig_x * sig_x)),
+        inv_2sy2(1 / (2 * sig_y * sig_y)) {}
+
+  // Exponent of the Gaussian for the residual (dx, dy)
+  double exponent(double dx, double dy) const {
+    return fast_math::fmadd(dx * inv_2sx2, dx, dy * dy * inv_2sy2);
+  }
+
+  // Equivalent to multiv_prob for the residual (dx, dy)
+  double prob(double dx, double dy) const {
+    return gauss_norm * exp(-exponent(dx, dy));
+  }
+
+  // log(prob(dx, dy)) without the exp/log round trip
+  double logProb(double dx, double dy) const {
+    return log_norm - exponent(dx, dy);
+  }
+};
+
+/**
+ * Outlier gating and early termination of the likelihood loop
+ *   (ParticleFilter::setGating). Distances are Mahalanobis distances under
+ *   the landmark noise.
+ */
+struct GatingParams {
+  // Associations farther than gate, or observations with no landmark in
+  //   range, are outliers and count as if they were outlier_distance away.
+  //   outlier_distance == gate caps the penalty where the Gaussian leaves
+  //   off; larger values penalize outliers more.
+  double gate;
+  double outlier_distance;
+  // In LOG_WEIGHTS mode a particle stops being weighed once even a perfect
+  //   match of its remaining observations would leave it more than
+  //   early_out below the best particle weighed so far in its stats block,
+  //   i.e. below exp(-early_out) of that particle's weight. 0 disables it.
+  double early_out;
+
+  GatingParams() : gate(5.0), outlier_distance(5.0), early_out(15.0) {}
+};
+
 #endif  // HELPER_FUNCTIONS_H_
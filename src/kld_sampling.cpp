@@ -0,0 +1,77 @@
+/**
+ * kld_sampling.cpp
+ * Particle count adaptation by KLD-sampling (Fox, 2003).
+ */
+
+#include "kld_sampling.h"
+
+#include <math.h>
+#include <algorithm>
+
+int kldSampleSize(int k, const KldParams& params) {
+  int n = params.min_particles;
+  if (k > 1) {
+    // Wilson-Hilferty approximation of the chi-square quantile
+    double a = 2.0 / (9.0 * (k - 1));
+    double b = 1.0 - a + sqrt(a) * params.z;
+    double bound = ceil((k - 1) / (2.0 * params.epsilon) * b * b * b);
+    if (bound > params.max_particles) {
+      return params.max_particles;
+    }
+    n = std::max(n, static_cast<int>(bound));
+  }
+  return std::min(n, params.max_particles);
+}
+
+namespace {
+
+// Power-of-two table size keeping the load factor at or below 1/2
+size_t tableSize(int n) {
+  size_t capacity = 16;
+  while (capacity < 2 * static_cast<size_t>(n)) {
+    capacity <<= 1;
+  }
+  return capacity;
+}
+
+}  // namespace
+
+void KldBinCounter::reserve(int n) {
+  table.reserve(tableSize(n));
+}
+
+int KldBinCounter::count(const ParticleSet& particles, double min_weight,
+                         const KldParams& params) {
+  int n = particles.size();
+  size_t capacity = tableSize(n);
+  table.assign(capacity, 0);
+  const size_t mask = capacity - 1;
+
+  int occupied = 0;
+  for (int i = 0 ; i < n ; i++) {
+    if (particles.weight[i] < min_weight) {
+      continue;
+    }
+    double theta = particles.theta[i];
+    theta -= 2.0 * M_PI * floor((theta + M_PI) / (2.0 * M_PI));
+    int64_t bx = static_cast<int64_t>(floor(particles.x[i] / params.bin_x));
+    int64_t by = static_cast<int64_t>(floor(particles.y[i] / params.bin_y));
+    int64_t bt = static_cast<int64_t>(floor(theta / params.bin_theta));
+
+    // 21 bits per axis; the top bit flags an occupied slot
+    uint64_t key = (static_cast<uint64_t>(bx & 0x1FFFFF) << 42) |
+                   (static_cast<uint64_t>(by & 0x1FFFFF) << 21) |
+                   static_cast<uint64_t>(bt & 0x1FFFFF) | (1ULL << 63);
+
+    uint64_t h = key * 0x9E3779B97F4A7C15ULL;
+    size_t slot = static_cast<size_t>(h >> 32) & mask;
+    while (table[slot] != 0 && table[slot] != key) {
+      slot = (slot + 1) & mask;
+    }
+    if (table[slot] == 0) {
+      table[slot] = key;
+      occupied++;
+    }
+  }
+  return occupied;
+}
@@ -0,0 +1,68 @@
+/**
+ * kld_sampling.h
+ * Particle count adaptation by KLD-sampling (Fox, 2003).
+ *
+ * The state space is split into (x, y, theta) bins; the number of bins k
+ * that carry posterior mass gives the sample size that keeps the K-L
+ * divergence between the sample and the true posterior below epsilon with
+ * probability 1 - delta.
+ */
+
+#ifndef KLD_SAMPLING_H_
+#define KLD_SAMPLING_H_
+
+#include <stdint.h>
+#include <vector>
+#include "particle_set.h"
+
+/**
+ * Parameters of KLD-sampling.
+ */
+struct KldParams {
+  int min_particles;   // Lower bound on the particle count
+  int max_particles;   // Upper bound on the particle count
+  double epsilon;      // K-L error bound
+  double z;            // Upper 1 - delta standard normal quantile
+  double bin_x;        // Bin size in x [m]
+  double bin_y;        // Bin size in y [m]
+  double bin_theta;    // Bin size in yaw [rad]
+
+  KldParams()
+      : min_particles(100), max_particles(5000), epsilon(0.05), z(2.326),
+        bin_x(0.5), bin_y(0.5), bin_theta(0.1745) {}
+};
+
+/**
+ * kldSampleSize Returns the number of samples needed for k occupied bins,
+ *   clamped to [min_particles, max_particles].
+ * @param k Number of occupied bins
+ * @param params KLD-sampling parameters
+ */
+int kldSampleSize(int k, const KldParams& params);
+
+/**
+ * Counts occupied state-space bins with a reusable open-addressing table,
+ *   so repeated counts do not allocate once the table has grown.
+ */
+class KldBinCounter {
+ public:
+  /**
+   * count Returns the number of distinct bins holding a particle whose
+   *   weight is at least min_weight.
+   * @param particles Particle set to bin
+   * @param min_weight Weight below which particles are ignored
+   * @param params KLD-sampling parameters (bin sizes)
+   */
+  int count(const ParticleSet& particles, double min_weight,
+            const KldParams& params);
+
+  /**
+   * reserve Pre-sizes the table for sets of up to n particles.
+   */
+  void reserve(int n);
+
+ private:
+  std::vector<uint64_t> table;  // 0 marks an empty slot
+};
+
+#endif  // KLD_SAMPLING_H_
@@ -1,163 +1,122 @@
 #include <math.h>
+#include <string.h>
 #include <uWS/uWS.h>
+#include <algorithm>
 #include <iostream>
 #include <string>
-#include "json.hpp"
+#include <thread>
+#include "metrics.h"
 #include "particle_filter.h"
+#include "session_manager.h"
 
 // for convenience
-using nlohmann::json;
 using std::string;
-using std::vector;
 
-// Checks if the SocketIO event has JSON data.
-// If there is data the JSON object in string format will be returned,
-// else the empty string "" will be returned.
-string hasData(string s) {
-  auto found_null = s.find("null");
-  auto b1 = s.find_first_of("[");
-  auto b2 = s.find_first_of("]");
-  if (found_null != string::npos) {
-    return "";
-  } else if (b1 != string::npos && b2 != string::npos) {
-    return s.substr(b1, b2 - b1 + 1);
+// Filter settings of every session
+void configureFilter(ParticleFilter& pf) {
+  int num_threads = 1;  // Threads used to weigh the particles of one filter
+  pf.setNumThreads(num_threads);
+  pf.setWeightMode(ParticleFilter::LOG_WEIGHTS);
+  pf.setResampleMethod(ParticleFilter::SYSTEMATIC_RESAMPLING);
+  pf.setKldSampling(true);
+  pf.setEssGating(true);
+  pf.setRangeCache(true);
+}
+
+// Value of the vehicle query parameter of a connection URL
+//   (ws://host:4567/?vehicle=ID), empty without one
+string vehicleOf(uWS::HttpRequest& req) {
+  uWS::Header url = req.getUrl();
+  if (!url.value) {
+    return string();
+  }
+  string target(url.value, url.valueLength);
+  size_t query = target.find('?');
+  if (query == string::npos) {
+    return string();
+  }
+  const string key = "vehicle=";
+  size_t begin = query + 1;
+  while (begin < target.size()) {
+    size_t end = std::min(target.find('&', begin), target.size());
+    if (target.compare(begin, key.size(), key) == 0) {
+      return target.substr(begin + key.size(), end - begin - key.size());
+    }
+    begin = end + 1;
   }
-  return "";
+  return string();
 }
 
-int main() {
+int main(int argc, char* argv[]) {
   uWS::Hub h;
 
   // Set up parameters here
-  double delta_t = 0.1;  // Time elapsed between measurements [sec]
-  double sensor_range = 50;  // Sensor range [m]
+  SessionConfig config;
+  config.delta_t = 0.1;  // Time elapsed between measurements [sec]
+  config.sensor_range = 50;  // Sensor range [m]
+  config.accept_binary = true;  // Answer binary frames (binary_protocol.h)
+  config.debug_associations = true;  // Best particle's associations in replies
+  config.publish_mean = true;  // Weighted mean pose instead of best particle
+  config.coalesce_frames = true;  // Skip weighting stale frames when behind
+  config.configure = &configureFilter;
+  config.tile_memory = 64 << 20;  // Resident tiles per session [bytes]
+  // Warm start of reconnecting or restarted sessions, per vehicle
+  config.snapshot_file = "pf_snapshot.bin";
+  config.snapshot_interval = 10;  // Frames between snapshots
+  config.snapshot_max_age = 60.0;  // [s]
+  config.snapshot_gate = 3.0;  // Restored mean to first GPS fix [m]
 
   // GPS measurement uncertainty [x [m], y [m], theta [rad]]
-  double sigma_pos[3] = {0.3, 0.3, 0.01};
+  config.sigma_pos[0] = 0.3;
+  config.sigma_pos[1] = 0.3;
+  config.sigma_pos[2] = 0.01;
   // Landmark measurement uncertainty [x [m], y [m]]
-  double sigma_landmark[2] = {0.3, 0.3};
+  config.sigma_landmark[0] = 0.3;
+  config.sigma_landmark[1] = 0.3;
 
-  // Read map data
+  // Workers stepping the filters; each connection gets its own filter
+  int num_workers = std::max(1u, std::thread::hardware_concurrency());
+
+  // Read map data, text or binary (pf_map_convert). A tiled map is
+  //   streamed by each session around its own vehicle instead.
+  string map_file = argc > 1 ? argv[1] : "../data/map_data.txt";
   Map map;
-  if (!read_map_data("../data/map_data.txt", map)) {
+  if (TiledMap::isTiledMap(map_file)) {
+    config.tiled_map = map_file;
+  } else if (!read_map_data(map_file, map)) {
     std::cout << "Error: Could not open map file" << std::endl;
     return -1;
   }
 
-  // Create particle filter
-  ParticleFilter pf;
-
-  h.onMessage([&pf, &map, &delta_t, &sensor_range, &sigma_pos, &sigma_landmark]
-              (uWS::WebSocket<uWS::SERVER> ws, char *data, size_t length,
-               uWS::OpCode opCode) {
-    // "42" at the start of the message means there's a websocket message event.
-    // The 4 signifies a websocket message
-    // The 2 signifies a websocket event
-    if (length && length > 2 && data[0] == '4' && data[1] == '2') {
-      auto s = hasData(string(data));
-
-      if (s != "") {
-        auto j = json::parse(s);
-
-        string event = j[0].get<string>();
-
-        if (event == "telemetry") {
-          // j[1] is the data JSON object
-          if (!pf.initialized()) {
-            // Sense noisy position data from the simulator
-            double sense_x = std::stod(j[1]["sense_x"].get<string>());
-            double sense_y = std::stod(j[1]["sense_y"].get<string>());
-            double sense_theta = std::stod(j[1]["sense_theta"].get<string>());
-
-            pf.init(sense_x, sense_y, sense_theta, sigma_pos);
-          } else {
-            // Predict the vehicle's next state from previous
-            //   (noiseless control) data.
-            double previous_velocity = std::stod(j[1]["previous_velocity"].get<string>());
-            double previous_yawrate = std::stod(j[1]["previous_yawrate"].get<string>());
-
-            pf.prediction(delta_t, sigma_pos, previous_velocity, previous_yawrate);
-          }
-
-          // receive noisy observation data from the simulator
-          // sense_observations in JSON format 
-          //   [{obs_x,obs_y},{obs_x,obs_y},...{obs_x,obs_y}] 
-          vector<LandmarkObs> noisy_observations;
-          string sense_observations_x = j[1]["sense_observations_x"];
-          string sense_observations_y = j[1]["sense_observations_y"];
-
-          vector<float> x_sense;
-          std::istringstream iss_x(sense_observations_x);
+  SessionManager sessions(map, config, num_workers, h.getLoop());
 
-          std::copy(std::istream_iterator<float>(iss_x),
-          std::istream_iterator<float>(),
-          std::back_inserter(x_sense));
-
-          vector<float> y_sense;
-          std::istringstream iss_y(sense_observations_y);
-
-          std::copy(std::istream_iterator<float>(iss_y),
-          std::istream_iterator<float>(),
-          std::back_inserter(y_sense));
-
-          for (int i = 0; i < x_sense.size(); ++i) {
-            LandmarkObs obs;
-            obs.x = x_sense[i];
-            obs.y = y_sense[i];
-            noisy_observations.push_back(obs);
-          }
-
-          // Update the weights and resample
-          pf.updateWeights(sensor_range, sigma_landmark, noisy_observations, map);
-          pf.resample();
-
-          // Calculate and output the average weighted error of the particle 
-          //   filter over all time steps so far.
-          vector<Particle> particles = pf.particles;
-          int num_particles = particles.size();
-          double highest_weight = -1.0;
-          Particle best_particle;
-          double weight_sum = 0.0;
-          for (int i = 0; i < num_particles; ++i) {
-            if (particles[i].weight > highest_weight) {
-              highest_weight = particles[i].weight;
-              best_particle = particles[i];
-            }
-
-            weight_sum += particles[i].weight;
-          }
-
-          std::cout << "highest w " << highest_weight << std::endl;
-          std::cout << "average w " << weight_sum/num_particles << std::endl;
-
-          json msgJson;
-          msgJson["best_particle_x"] = best_particle.x;
-          msgJson["best_particle_y"] = best_particle.y;
-          msgJson["best_particle_theta"] = best_particle.theta;
-
-          // Optional message data used for debugging particle's sensing 
-          //   and associations
-          msgJson["best_particle_associations"] = pf.getAssociations(best_particle);
-          msgJson["best_particle_sense_x"] = pf.getSenseCoord(best_particle, "X");
-          msgJson["best_particle_sense_y"] = pf.getSenseCoord(best_particle, "Y");
-
-          auto msg = "42[\"best_particle\"," + msgJson.dump() + "]";
-          // std::cout << msg << std::endl;
-          ws.send(msg.data(), msg.length(), uWS::OpCode::TEXT);
-        }  // end "telemetry" if
-      } else {
-        string msg = "42[\"manual\",{}]";
-        ws.send(msg.data(), msg.length(), uWS::OpCode::TEXT);
-      }
-    }  // end websocket message if
+  // The event loop only queues frames; the session's worker answers
+  h.onMessage([&sessions](uWS::WebSocket<uWS::SERVER> ws, char *data,
+                          size_t length, uWS::OpCode opCode) {
+    sessions.post(ws, data, length, opCode);
   }); // end h.onMessage
 
-  h.onConnection([&h](uWS::WebSocket<uWS::SERVER> ws, uWS::HttpRequest req) {
-    std::cout << "Connected!!!" << std::endl;
+  // Filter metrics in Prometheus text format at /metrics
+  h.onHttpRequest([](uWS::HttpResponse *res, uWS::HttpRequest req, char *data,
+                     size_t length, size_t remaining) {
+    uWS::Header url = req.getUrl();
+    if (url.valueLength == 8 && !strncmp(url.value, "/metrics", 8)) {
+      string body = metrics::formatPrometheus(metrics::snapshot());
+      res->end(body.data(), body.length());
+    } else {
+      res->end(NULL, 0);
+    }
+  });
+
+  h.onConnection([&h, &sessions](uWS::WebSocket<uWS::SERVER> ws,
+                                 uWS::HttpRequest req) {
+    sessions.open(ws, vehicleOf(req));
+    std::cout << "Connected!!! (" << sessions.size() << " sessions)" << std::endl;
   });
 
-  h.onDisconnection([&h](uWS::WebSocket<uWS::SERVER> ws, int code, 
-                         char *message, size_t length) {
+  h.onDisconnection([&h, &sessions](uWS::WebSocket<uWS::SERVER> ws, int code,
+                                    char *message, size_t length) {
+    sessions.close(ws);
     ws.close();
     std::cout << "Disconnected" << std::endl;
   });
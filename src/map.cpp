@@ -0,0 +1,218 @@
+/**
+ * map.cpp
+ * Binary map format: the landmark records and the prebuilt grid index of
+ * Map, laid out so that a mapped file is used in place.
+ *
+ * Layout, in host byte order (the header records it), 8-byte aligned:
+ *   MapFileHeader              64 bytes
+ *   single_landmark_s[count]   Landmark records, in landmark_list order
+ *   int32[cols * rows + 1]     Offset of each cell's run in the item array
+ *   int32[count]               Landmark indices grouped by cell
+ */
+
+#include "map.h"
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cmath>
+
+namespace {
+
+const char kMapMagic[8] = {'P', 'F', 'M', 'A', 'P', 0, 0, 0};
+const uint32_t kMapVersion = 1;
+const uint32_t kByteOrderMark = 0x01020304;
+
+struct MapFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;      // kByteOrderMark as written by the producer
+  uint32_t record_size;     // sizeof(Map::single_landmark_s)
+  int32_t cols;
+  int32_t rows;
+  uint32_t reserved;
+  uint64_t count;           // Number of landmarks
+  double cell_size;
+  double min_x;
+  double min_y;
+};
+
+inline uint64_t align8(uint64_t n) {
+  return (n + 7) & ~static_cast<uint64_t>(7);
+}
+
+struct Layout {
+  uint64_t landmarks;
+  uint64_t start;
+  uint64_t items;
+  uint64_t end;
+};
+
+Layout layoutOf(uint64_t count, uint64_t cells) {
+  Layout l;
+  l.landmarks = align8(sizeof(MapFileHeader));
+  l.start = align8(l.landmarks + count * sizeof(Map::single_landmark_s));
+  l.items = align8(l.start + (cells + 1) * sizeof(int32_t));
+  l.end = l.items + count * sizeof(int32_t);
+  return l;
+}
+
+bool writeAll(FILE* f, const void* data, size_t n, uint64_t* pos) {
+  *pos += n;
+  return n == 0 || fwrite(data, 1, n, f) == n;
+}
+
+bool padTo(FILE* f, uint64_t target, uint64_t* pos) {
+  static const char zeros[8] = {0};
+  return writeAll(f, zeros, target - *pos, pos);
+}
+
+}  // namespace
+
+struct Map::MappedFile {
+  void* addr;
+  size_t length;
+
+  MappedFile(void* a, size_t n) : addr(a), length(n) {}
+  ~MappedFile() {
+    munmap(addr, length);
+  }
+};
+
+bool Map::writeBinary(const std::string& filename) const {
+  Map indexed_copy;
+  const Map* m = this;
+  if (!indexed()) {
+    indexed_copy.landmark_list.assign(landmarks(), landmarks() + size());
+    indexed_copy.buildIndex();
+    m = &indexed_copy;
+  }
+  const int* start = m->mapping ? m->mapped_start : m->cell_start.data();
+  const int* items = m->mapping ? m->mapped_items : m->cell_items.data();
+  uint64_t cells = static_cast<uint64_t>(m->cols) * m->rows;
+
+  MapFileHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kMapMagic, sizeof(kMapMagic));
+  header.version = kMapVersion;
+  header.byte_order = kByteOrderMark;
+  header.record_size = sizeof(single_landmark_s);
+  header.cols = m->cols;
+  header.rows = m->rows;
+  header.count = m->size();
+  header.cell_size = m->cell_size;
+  header.min_x = m->min_x;
+  header.min_y = m->min_y;
+  Layout layout = layoutOf(header.count, cells);
+
+  FILE* f = fopen(filename.c_str(), "wb");
+  if (!f) {
+    return false;
+  }
+  uint64_t pos = 0;
+  bool ok = writeAll(f, &header, sizeof(header), &pos) &&
+            padTo(f, layout.landmarks, &pos) &&
+            writeAll(f, m->landmarks(), header.count * sizeof(single_landmark_s),
+                     &pos) &&
+            padTo(f, layout.start, &pos);
+  // An empty map has no grid; its start array is the single 0 entry
+  int32_t empty_start = 0;
+  if (cells == 0) {
+    ok = ok && writeAll(f, &empty_start, sizeof(empty_start), &pos);
+  } else {
+    ok = ok && writeAll(f, start, (cells + 1) * sizeof(int32_t), &pos);
+  }
+  ok = ok && padTo(f, layout.items, &pos) &&
+       writeAll(f, items, header.count * sizeof(int32_t), &pos);
+  return fclose(f) == 0 && ok;
+}
+
+bool Map::loadBinary(const std::string& filename) {
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 ||
+      static_cast<size_t>(st.st_size) < sizeof(MapFileHeader)) {
+    ::close(fd);
+    return false;
+  }
+  size_t length = st.st_size;
+  void* addr = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (addr == MAP_FAILED) {
+    return false;
+  }
+  std::shared_ptr<const MappedFile> file(new MappedFile(addr, length));
+
+  // Validate everything the views point at before using any of it
+  const char* base = static_cast<const char*>(addr);
+  const MapFileHeader* header = reinterpret_cast<const MapFileHeader*>(base);
+  if (memcmp(header->magic, kMapMagic, sizeof(kMapMagic)) != 0 ||
+      header->version != kMapVersion || header->byte_order != kByteOrderMark ||
+      header->record_size != sizeof(single_landmark_s) || header->cols < 0 ||
+      header->rows < 0 || header->count > 0x7fffffff ||
+      (header->count > 0 && (header->cols == 0 || header->rows == 0))) {
+    return false;
+  }
+  // queryRange divides by the cell size and casts cell coordinates to int
+  if (header->count > 0 &&
+      (!(header->cell_size > 0.0) || !std::isfinite(header->cell_size) ||
+       !std::isfinite(header->min_x) || !std::isfinite(header->min_y))) {
+    return false;
+  }
+  uint64_t cells = static_cast<uint64_t>(header->cols) * header->rows;
+  Layout layout = layoutOf(header->count, cells);
+  if (cells > 0x7fffffff || layout.end > length) {
+    return false;
+  }
+  const int* start = reinterpret_cast<const int*>(base + layout.start);
+  const int* items = reinterpret_cast<const int*>(base + layout.items);
+  if (start[0] != 0 || static_cast<uint64_t>(start[cells]) != header->count) {
+    return false;
+  }
+  for (uint64_t c = 0; c < cells; ++c) {
+    if (start[c] > start[c + 1]) {
+      return false;
+    }
+  }
+  for (uint64_t k = 0; k < header->count; ++k) {
+    if (items[k] < 0 || static_cast<uint64_t>(items[k]) >= header->count) {
+      return false;
+    }
+  }
+
+  landmark_list.clear();
+  cell_start.clear();
+  cell_items.clear();
+  cell_size = header->cell_size;
+  min_x = header->min_x;
+  min_y = header->min_y;
+  cols = header->count > 0 ? header->cols : 0;
+  rows = header->count > 0 ? header->rows : 0;
+  mapped_landmarks =
+      reinterpret_cast<const single_landmark_s*>(base + layout.landmarks);
+  mapped_count = header->count;
+  mapped_start = start;
+  mapped_items = items;
+  mapping = file;
+  map_revision = nextRevision();
+  return true;
+}
+
+bool Map::isBinaryMap(const std::string& filename) {
+  FILE* f = fopen(filename.c_str(), "rb");
+  if (!f) {
+    return false;
+  }
+  char magic[sizeof(kMapMagic)];
+  bool binary = fread(magic, 1, sizeof(magic), f) == sizeof(magic) &&
+                memcmp(magic, kMapMagic, sizeof(kMapMagic)) == 0;
+  fclose(f);
+  return binary;
+}
@@ -8,6 +8,11 @@
 #ifndef MAP_H_
 #define MAP_H_
 
+#include <math.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <string>
 #include <vector>
 
 class Map {
@@ -18,7 +23,227 @@ class Map {
     float y_f;  // Landmark y-position in the map (global coordinates)
   };
 
-  std::vector<single_landmark_s> landmark_list;  // List of landmarks in the map
+  // List of landmarks in the map. Empty while the map is backed by a
+  //   mapped binary file; read landmarks through landmarks() and size().
+  std::vector<single_landmark_s> landmark_list;
+
+  Map()
+      : cell_size(0.0), min_x(0.0), min_y(0.0), cols(0), rows(0),
+        mapped_landmarks(NULL), mapped_count(0), mapped_start(NULL),
+        mapped_items(NULL), map_revision(nextRevision()) {}
+
+  /**
+   * revision Returns a process-wide unique stamp of the landmark and index
+   *   contents, renewed by buildIndex and loadBinary. Caches keyed on a
+   *   map compare it to notice changes.
+   */
+  unsigned long revision() const {
+    return map_revision;
+  }
+
+  /**
+   * landmarks Returns the landmark array, in memory or in the mapped file.
+   */
+  const single_landmark_s* landmarks() const {
+    return mapping ? mapped_landmarks : landmark_list.data();
+  }
+
+  /**
+   * size Returns the number of landmarks.
+   */
+  size_t size() const {
+    return mapping ? mapped_count : landmark_list.size();
+  }
+
+  /**
+   * writeBinary Saves the landmarks and the spatial index in the binary
+   *   map format (see map.cpp), building the index first if needed.
+   * @output True if the file was written
+   */
+  bool writeBinary(const std::string& filename) const;
+
+  /**
+   * loadBinary Memory-maps a binary map file and uses its landmarks and
+   *   index in place. The pages are shared read-only between all processes
+   *   mapping the same file. Copies of the Map share the mapping.
+   * @output False if the file could not be mapped or is not a valid map
+   */
+  bool loadBinary(const std::string& filename);
+
+  /**
+   * isBinaryMap Returns whether filename starts with the binary map magic.
+   */
+  static bool isBinaryMap(const std::string& filename);
+
+  /**
+   * buildIndex Buckets landmark_list into a uniform grid so that range
+   *   queries only visit the cells overlapping the query disk.
+   *   Must be called again whenever landmark_list changes.
+   * @param size Edge length of a grid cell [m]
+   */
+  void buildIndex(double size = 50.0) {
+    // A mapped map is materialized first, the file cannot be changed
+    if (mapping) {
+      landmark_list.assign(mapped_landmarks, mapped_landmarks + mapped_count);
+      mapping.reset();
+    }
+    cell_start.clear();
+    cell_items.clear();
+    cols = rows = 0;
+    map_revision = nextRevision();
+    if (landmark_list.empty() || size <= 0.0) {
+      return;
+    }
+
+    float lo_x = landmark_list[0].x_f, hi_x = lo_x;
+    float lo_y = landmark_list[0].y_f, hi_y = lo_y;
+    for (size_t i = 1; i < landmark_list.size(); ++i) {
+      lo_x = std::min(lo_x, landmark_list[i].x_f);
+      hi_x = std::max(hi_x, landmark_list[i].x_f);
+      lo_y = std::min(lo_y, landmark_list[i].y_f);
+      hi_y = std::max(hi_y, landmark_list[i].y_f);
+    }
+
+    // Keep the grid to a sane number of cells for sparse, very wide maps
+    const double max_cells = 4.0 * landmark_list.size() + 1024.0;
+    cell_size = size;
+    while (((hi_x - lo_x) / cell_size + 1) * ((hi_y - lo_y) / cell_size + 1)
+           > max_cells) {
+      cell_size *= 2.0;
+    }
+    min_x = lo_x;
+    min_y = lo_y;
+    cols = static_cast<int>((hi_x - lo_x) / cell_size) + 1;
+    rows = static_cast<int>((hi_y - lo_y) / cell_size) + 1;
+
+    // Counting sort of landmark indices by cell (CSR layout)
+    cell_start.assign(cols * rows + 1, 0);
+    for (size_t i = 0; i < landmark_list.size(); ++i) {
+      cell_start[cellOf(landmark_list[i]) + 1]++;
+    }
+    for (int c = 0; c < cols * rows; ++c) {
+      cell_start[c + 1] += cell_start[c];
+    }
+    cell_items.resize(landmark_list.size());
+    std::vector<int> fill(cell_start.begin(), cell_start.end() - 1);
+    for (size_t i = 0; i < landmark_list.size(); ++i) {
+      cell_items[fill[cellOf(landmark_list[i])]++] = i;
+    }
+  }
+
+  /**
+   * indexed Returns whether buildIndex has been run on a non-empty map.
+   */
+  bool indexed() const {
+    return cols > 0;
+  }
+
+  /**
+   * queryRange Appends the landmark_list index of every landmark within
+   *   range of (x, y). Falls back to a linear scan if the map is not indexed.
+   * @param (x,y) Query position in map coordinates [m]
+   * @param range Query radius [m]
+   * @param out Vector the matching indices are appended to
+   */
+  void queryRange(double x, double y, double range,
+                  std::vector<int>& out) const {
+    const single_landmark_s* lm = landmarks();
+    if (!indexed()) {
+      for (size_t i = 0; i < size(); ++i) {
+        if (inRange(lm[i], x, y, range)) {
+          out.push_back(i);
+        }
+      }
+      return;
+    }
+
+    int c0 = std::max(0, static_cast<int>(floor((x - range - min_x) / cell_size)));
+    int c1 = std::min(cols - 1, static_cast<int>(floor((x + range - min_x) / cell_size)));
+    int r0 = std::max(0, static_cast<int>(floor((y - range - min_y) / cell_size)));
+    int r1 = std::min(rows - 1, static_cast<int>(floor((y + range - min_y) / cell_size)));
+
+    const int* start = mapping ? mapped_start : cell_start.data();
+    const int* items = mapping ? mapped_items : cell_items.data();
+    for (int r = r0; r <= r1; ++r) {
+      for (int c = c0; c <= c1; ++c) {
+        int cell = r * cols + c;
+        for (int k = start[cell]; k < start[cell + 1]; ++k) {
+          if (inRange(lm[items[k]], x, y, range)) {
+            out.push_back(items[k]);
+          }
+        }
+      }
+    }
+  }
+
+  /**
+   * Read-only view of the spatial index, for consumers that replicate
+   *   queryRange elsewhere (e.g. on a GPU). Valid while the Map is.
+   */
+  struct IndexView {
+    double cell_size;    // Edge length of a grid cell [m]
+    double min_x;        // Map-coordinate origin of the grid [m]
+    double min_y;
+    int cols;            // Grid dimensions in cells
+    int rows;
+    const int* start;    // cols * rows + 1 offsets into items
+    const int* items;    // Landmark indices, grouped by cell
+  };
+
+  /**
+   * indexView Returns the grid of buildIndex; cols is 0 if not indexed.
+   */
+  IndexView indexView() const {
+    IndexView view;
+    view.cell_size = cell_size;
+    view.min_x = min_x;
+    view.min_y = min_y;
+    view.cols = cols;
+    view.rows = rows;
+    view.start = mapping ? mapped_start : cell_start.data();
+    view.items = mapping ? mapped_items : cell_items.data();
+    return view;
+  }
+
+  /**
+   * inRange The range test used by queryRange.
+   */
+  static bool inRange(const single_landmark_s& lm, double x, double y,
+                      double range) {
+    double dx = lm.x_f - x;
+    double dy = lm.y_f - y;
+    return sqrt(dx * dx + dy * dy) <= range;
+  }
+
+ private:
+  static unsigned long nextRevision() {
+    static std::atomic<unsigned long> counter(0);
+    return ++counter;
+  }
+
+  int cellOf(const single_landmark_s& lm) const {
+    int c = std::min(cols - 1, static_cast<int>((lm.x_f - min_x) / cell_size));
+    int r = std::min(rows - 1, static_cast<int>((lm.y_f - min_y) / cell_size));
+    return r * cols + c;
+  }
+
+  double cell_size;  // Edge length of a grid cell [m]
+  double min_x;      // Map-coordinate origin of the grid [m]
+  double min_y;
+  int cols;          // Grid dimensions in cells
+  int rows;
+  std::vector<int> cell_start;  // Offset of each cell's run in cell_items
+  std::vector<int> cell_items;  // landmark_list indices, grouped by cell
+
+  // Views into the mapped binary file, valid while mapping is set
+  struct MappedFile;
+  std::shared_ptr<const MappedFile> mapping;
+  const single_landmark_s* mapped_landmarks;
+  size_t mapped_count;
+  const int* mapped_start;
+  const int* mapped_items;
+
+  unsigned long map_revision;
 };
 
 #endif  // MAP_H_
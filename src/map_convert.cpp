@@ -0,0 +1,90 @@
+/**
+ * map_convert.cpp
+ * Converts a text map (x y id per line) to the memory-mappable binary
+ * format read by read_map_data and Map::loadBinary, or with --tile-size to
+ * the tiled format streamed by TiledMap.
+ *
+ * Usage: pf_map_convert [--cell-size M | --tile-size M] <text_map> <out_map>
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+#include <string>
+
+#include "helper_functions.h"
+#include "map.h"
+#include "tiled_map.h"
+
+namespace {
+
+void usage() {
+  std::cerr << "Usage: pf_map_convert [--cell-size M | --tile-size M] "
+            << "<text_map> <out_map>" << std::endl;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  double cell_size = 50.0;  // Grid cell edge, as in Map::buildIndex [m]
+  double tile_size = 0.0;  // Tile edge of a tiled map, 0 for a binary map [m]
+  std::string input;
+  std::string output;
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "--cell-size") && i + 1 < argc) {
+      cell_size = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "--tile-size") && i + 1 < argc) {
+      tile_size = atof(argv[++i]);
+      if (tile_size <= 0.0) {
+        usage();
+        return -1;
+      }
+    } else if (argv[i][0] != '-' && input.empty()) {
+      input = argv[i];
+    } else if (argv[i][0] != '-' && output.empty()) {
+      output = argv[i];
+    } else {
+      usage();
+      return -1;
+    }
+  }
+  if (input.empty() || output.empty() || cell_size <= 0.0) {
+    usage();
+    return -1;
+  }
+
+  Map map;
+  if (!read_map_data(input, map)) {
+    std::cout << "Error: Could not open map file " << input << std::endl;
+    return -1;
+  }
+  if (tile_size > 0.0) {
+    TiledMap check;
+    if (!TiledMap::write(map, tile_size, output)) {
+      std::cout << "Error: Could not write " << output << std::endl;
+      return -1;
+    }
+    if (!check.open(output)) {
+      std::cout << "Error: " << output << " does not read back" << std::endl;
+      return -1;
+    }
+    std::cout << "Wrote " << map.size() << " landmarks in " << tile_size
+              << " m tiles to " << output << std::endl;
+    return 0;
+  }
+
+  map.buildIndex(cell_size);
+  if (!map.writeBinary(output)) {
+    std::cout << "Error: Could not write " << output << std::endl;
+    return -1;
+  }
+
+  // Read it back the way the filter will
+  Map check;
+  if (!check.loadBinary(output) || check.size() != map.size()) {
+    std::cout << "Error: " << output << " does not read back" << std::endl;
+    return -1;
+  }
+  std::cout << "Wrote " << map.size() << " landmarks to " << output << std::endl;
+  return 0;
+}
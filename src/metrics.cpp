@@ -0,0 +1,194 @@
+/**
+ * metrics.cpp
+ * Low-overhead hot-path instrumentation: per-stage latency histograms and
+ * event counters.
+ */
+
+#include "metrics.h"
+
+#include <stdio.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+namespace metrics {
+
+namespace {
+
+// Recording slot owned by a single thread. Only the owner writes, so the
+// increments are a relaxed load and store rather than a locked RMW.
+struct ThreadSlot {
+  std::atomic<uint64_t> count[NUM_STAGES];
+  std::atomic<uint64_t> sum_ns[NUM_STAGES];
+  std::atomic<uint64_t> buckets[NUM_STAGES][NUM_BUCKETS];
+  std::atomic<uint64_t> counters[NUM_COUNTERS];
+
+  ThreadSlot() {
+    for (int s = 0; s < NUM_STAGES; ++s) {
+      count[s].store(0, std::memory_order_relaxed);
+      sum_ns[s].store(0, std::memory_order_relaxed);
+      for (int b = 0; b < NUM_BUCKETS; ++b) {
+        buckets[s][b].store(0, std::memory_order_relaxed);
+      }
+    }
+    for (int c = 0; c < NUM_COUNTERS; ++c) {
+      counters[c].store(0, std::memory_order_relaxed);
+    }
+  }
+};
+
+inline void bump(std::atomic<uint64_t>& v, uint64_t by) {
+  v.store(v.load(std::memory_order_relaxed) + by, std::memory_order_relaxed);
+}
+
+std::atomic<bool> recording(true);
+
+// Slots of every thread that has recorded. Slots are never freed, so the
+// totals of finished threads stay in the snapshot.
+std::mutex registry_mutex;
+std::vector<ThreadSlot*>& registry() {
+  static std::vector<ThreadSlot*> slots;
+  return slots;
+}
+
+ThreadSlot& localSlot() {
+  static thread_local ThreadSlot* slot = NULL;
+  if (!slot) {
+    slot = new ThreadSlot();
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    registry().push_back(slot);
+  }
+  return *slot;
+}
+
+int bucketOf(uint64_t ns) {
+  int b = 0;
+  while (ns != 0 && b < NUM_BUCKETS - 1) {
+    ns >>= 1;
+    ++b;
+  }
+  return b;
+}
+
+const char* const stage_names[NUM_STAGES] = {
+  "prediction", "range_query", "association", "weighting", "resample"
+};
+
+const char* const counter_names[NUM_COUNTERS] = {
+  "frames", "particles", "observations", "in_range_landmarks",
+  "range_cache_hits", "range_cache_misses", "gated_observations",
+  "early_outs"
+};
+
+}  // namespace
+
+uint64_t Histogram::percentile(double p) const {
+  if (count == 0) {
+    return 0;
+  }
+  uint64_t rank = static_cast<uint64_t>(p / 100.0 * (count - 1)) + 1;
+  uint64_t seen = 0;
+  for (int b = 0; b < NUM_BUCKETS; ++b) {
+    seen += buckets[b];
+    if (seen >= rank) {
+      return b == 0 ? 0 : (1ULL << b) - 1;
+    }
+  }
+  return (1ULL << (NUM_BUCKETS - 1)) - 1;
+}
+
+void setEnabled(bool enabled) {
+  recording.store(enabled, std::memory_order_relaxed);
+}
+
+bool enabled() {
+  return recording.load(std::memory_order_relaxed);
+}
+
+void record(Stage stage, uint64_t ns) {
+  ThreadSlot& slot = localSlot();
+  bump(slot.count[stage], 1);
+  bump(slot.sum_ns[stage], ns);
+  bump(slot.buckets[stage][bucketOf(ns)], 1);
+}
+
+void add(Counter counter, uint64_t value) {
+  bump(localSlot().counters[counter], value);
+}
+
+Snapshot snapshot() {
+  Snapshot snap;
+  for (int s = 0; s < NUM_STAGES; ++s) {
+    snap.stages[s].count = 0;
+    snap.stages[s].sum_ns = 0;
+    for (int b = 0; b < NUM_BUCKETS; ++b) {
+      snap.stages[s].buckets[b] = 0;
+    }
+  }
+  for (int c = 0; c < NUM_COUNTERS; ++c) {
+    snap.counters[c] = 0;
+  }
+
+  std::lock_guard<std::mutex> lock(registry_mutex);
+  const std::vector<ThreadSlot*>& slots = registry();
+  for (size_t t = 0; t < slots.size(); ++t) {
+    const ThreadSlot& slot = *slots[t];
+    for (int s = 0; s < NUM_STAGES; ++s) {
+      snap.stages[s].count += slot.count[s].load(std::memory_order_relaxed);
+      snap.stages[s].sum_ns += slot.sum_ns[s].load(std::memory_order_relaxed);
+      for (int b = 0; b < NUM_BUCKETS; ++b) {
+        snap.stages[s].buckets[b] +=
+            slot.buckets[s][b].load(std::memory_order_relaxed);
+      }
+    }
+    for (int c = 0; c < NUM_COUNTERS; ++c) {
+      snap.counters[c] += slot.counters[c].load(std::memory_order_relaxed);
+    }
+  }
+  return snap;
+}
+
+const char* stageName(Stage stage) {
+  return stage_names[stage];
+}
+
+const char* counterName(Counter counter) {
+  return counter_names[counter];
+}
+
+std::string formatPrometheus(const Snapshot& snap) {
+  std::string out;
+  char line[512];
+
+  out += "# TYPE pf_stage_seconds histogram\n";
+  for (int s = 0; s < NUM_STAGES; ++s) {
+    const Histogram& h = snap.stages[s];
+    uint64_t cumulative = 0;
+    for (int b = 0; b < NUM_BUCKETS; ++b) {
+      cumulative += h.buckets[b];
+      double le = b == 0 ? 0.0 : ((1ULL << b) - 1) * 1e-9;
+      snprintf(line, sizeof(line),
+               "pf_stage_seconds_bucket{stage=\"%s\",le=\"%g\"} %llu\n",
+               stage_names[s], le, static_cast<unsigned long long>(cumulative));
+      out += line;
+    }
+    snprintf(line, sizeof(line),
+             "pf_stage_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %llu\n"
+             "pf_stage_seconds_sum{stage=\"%s\"} %.9f\n"
+             "pf_stage_seconds_count{stage=\"%s\"} %llu\n",
+             stage_names[s], static_cast<unsigned long long>(h.count),
+             stage_names[s], h.sum_ns * 1e-9,
+             stage_names[s], static_cast<unsigned long long>(h.count));
+    out += line;
+  }
+
+  for (int c = 0; c < NUM_COUNTERS; ++c) {
+    snprintf(line, sizeof(line), "# TYPE pf_%s_total counter\npf_%s_total %llu\n",
+             counter_names[c], counter_names[c],
+             static_cast<unsigned long long>(snap.counters[c]));
+    out += line;
+  }
+  return out;
+}
+
+}  // namespace metrics
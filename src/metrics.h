@@ -0,0 +1,127 @@
+/**
+ * metrics.h
+ * Low-overhead hot-path instrumentation: per-stage latency histograms and
+ * event counters.
+ *
+ * Every thread records into its own slot with plain relaxed atomic stores,
+ * so recording never takes a lock or contends on a cache line. snapshot()
+ * sums the slots of all threads that have recorded so far.
+ */
+
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include <stdint.h>
+#include <chrono>
+#include <string>
+
+namespace metrics {
+
+// Timed stages of a filter frame
+enum Stage {
+  STAGE_PREDICTION,   // ParticleFilter::prediction
+  STAGE_RANGE_QUERY,  // Gathering in-range landmarks, per weighing thread
+                      //   (estimated from a sample of the particles)
+  STAGE_ASSOCIATION,  // Transform, association and likelihood, per thread
+                      //   (estimated from a sample of the particles)
+  STAGE_WEIGHTING,    // ParticleFilter::updateWeights as a whole
+  STAGE_RESAMPLE,     // ParticleFilter::resample
+  NUM_STAGES
+};
+
+// Monotonic event counters
+enum Counter {
+  COUNTER_FRAMES,               // updateWeights calls
+  COUNTER_PARTICLES,            // Particles weighed
+  COUNTER_OBSERVATIONS,         // Observations processed
+  COUNTER_IN_RANGE_LANDMARKS,   // In-range landmarks over all particles
+  COUNTER_RANGE_CACHE_HITS,     // Particles served from the range cache
+  COUNTER_RANGE_CACHE_MISSES,   // Range cache entries gathered from the map
+  COUNTER_GATED_OBSERVATIONS,   // Associations rejected as outliers
+  COUNTER_EARLY_OUTS,           // Particles whose weighing stopped early
+  NUM_COUNTERS
+};
+
+// Histogram bucket b holds durations in [2^(b-1), 2^b) ns; bucket 0 is 0 ns
+const int NUM_BUCKETS = 40;
+
+struct Histogram {
+  uint64_t count;
+  uint64_t sum_ns;
+  uint64_t buckets[NUM_BUCKETS];
+
+  /**
+   * percentile Returns the upper bound [ns] of the bucket holding the p-th
+   *   percentile (0..100), or 0 for an empty histogram.
+   */
+  uint64_t percentile(double p) const;
+};
+
+struct Snapshot {
+  Histogram stages[NUM_STAGES];
+  uint64_t counters[NUM_COUNTERS];
+};
+
+/**
+ * setEnabled Turns recording on or off process-wide (on by default).
+ */
+void setEnabled(bool enabled);
+bool enabled();
+
+/**
+ * nowNs Returns a monotonic timestamp [ns].
+ */
+inline uint64_t nowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * record Adds one duration sample to the histogram of stage.
+ */
+void record(Stage stage, uint64_t ns);
+
+/**
+ * add Increments counter by value.
+ */
+void add(Counter counter, uint64_t value);
+
+/**
+ * snapshot Returns the sum of all threads' histograms and counters.
+ */
+Snapshot snapshot();
+
+const char* stageName(Stage stage);
+const char* counterName(Counter counter);
+
+/**
+ * formatPrometheus Renders a snapshot in the Prometheus text exposition
+ *   format (histograms in seconds).
+ */
+std::string formatPrometheus(const Snapshot& snap);
+
+/**
+ * Records the lifetime of the object as one sample of a stage.
+ */
+class ScopedTimer {
+ public:
+  explicit ScopedTimer(Stage stage)
+      : stage_(stage), start_(enabled() ? nowNs() : 0) {}
+
+  ~ScopedTimer() {
+    if (start_ != 0) {
+      record(stage_, nowNs() - start_);
+    }
+  }
+
+ private:
+  ScopedTimer(const ScopedTimer&);
+  ScopedTimer& operator=(const ScopedTimer&);
+
+  Stage stage_;
+  uint64_t start_;  // 0 when recording was disabled at construction
+};
+
+}  // namespace metrics
+
+#endif  // METRICS_H_
@@ -0,0 +1,94 @@
+/**
+ * motion_model.cpp
+ * Batched CTRV motion update over structure-of-arrays particle state.
+ */
+
+#include "motion_model.h"
+
+#include <math.h>
+
+#include "fast_math.h"
+
+CtrvStep ctrvStep(double delta_t, double velocity, double yaw_rate) {
+  // Both CTRV branches reduce to an update linear in sin/cos of the current
+  //   heading, using sin(t+a) - sin(t) = sin(t)(cos(a)-1) + cos(t)sin(a)
+  //   and cos(t) - cos(t+a) = sin(t)sin(a) - cos(t)(cos(a)-1).
+  //   That leaves one sincos per particle for either branch.
+  CtrvStep step;
+  if (fabs(yaw_rate) > 0.00001) {
+    step.dtheta = yaw_rate*delta_t;
+    double k = velocity/yaw_rate;
+    double h = sin(0.5*step.dtheta);
+    double cm1 = -2.0*h*h;  // cos(dtheta) - 1 without cancellation
+    double sa = sin(step.dtheta);
+    step.xs = k*cm1;
+    step.xc = k*sa;
+    step.ys = k*sa;
+    step.yc = -k*cm1;
+  } else {
+    step.dtheta = 0.0;
+    step.xs = 0.0;
+    step.xc = velocity*delta_t;
+    step.ys = velocity*delta_t;
+    step.yc = 0.0;
+  }
+  return step;
+}
+
+void predictCTRV(double* x, double* y, double* theta, int n, double delta_t,
+                 double velocity, double yaw_rate) {
+  const CtrvStep step = ctrvStep(delta_t, velocity, yaw_rate);
+  const double xs = step.xs;
+  const double xc = step.xc;
+  const double ys = step.ys;
+  const double yc = step.yc;
+  const double dtheta = step.dtheta;
+
+  int i = 0;
+#if defined(__AVX2__)
+  const __m256d v_xs = _mm256_set1_pd(xs);
+  const __m256d v_xc = _mm256_set1_pd(xc);
+  const __m256d v_ys = _mm256_set1_pd(ys);
+  const __m256d v_yc = _mm256_set1_pd(yc);
+  const __m256d v_dt = _mm256_set1_pd(dtheta);
+  for ( ; i + 4 <= n ; i += 4) {
+    __m256d t = _mm256_loadu_pd(theta + i);
+    __m256d s, c;
+    fast_math::sincos4(t, &s, &c);
+    __m256d px = _mm256_loadu_pd(x + i);
+    __m256d py = _mm256_loadu_pd(y + i);
+    px = fast_math::fmadd(v_xs, s, fast_math::fmadd(v_xc, c, px));
+    py = fast_math::fmadd(v_ys, s, fast_math::fmadd(v_yc, c, py));
+    _mm256_storeu_pd(x + i, px);
+    _mm256_storeu_pd(y + i, py);
+    _mm256_storeu_pd(theta + i, _mm256_add_pd(t, v_dt));
+  }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+  const float64x2_t v_xs = vdupq_n_f64(xs);
+  const float64x2_t v_xc = vdupq_n_f64(xc);
+  const float64x2_t v_ys = vdupq_n_f64(ys);
+  const float64x2_t v_yc = vdupq_n_f64(yc);
+  const float64x2_t v_dt = vdupq_n_f64(dtheta);
+  for ( ; i + 2 <= n ; i += 2) {
+    float64x2_t t = vld1q_f64(theta + i);
+    float64x2_t s, c;
+    fast_math::sincos2(t, &s, &c);
+    float64x2_t px = vld1q_f64(x + i);
+    float64x2_t py = vld1q_f64(y + i);
+    px = vfmaq_f64(vfmaq_f64(px, v_xc, c), v_xs, s);
+    py = vfmaq_f64(vfmaq_f64(py, v_yc, c), v_ys, s);
+    vst1q_f64(x + i, px);
+    vst1q_f64(y + i, py);
+    vst1q_f64(theta + i, vaddq_f64(t, v_dt));
+  }
+#endif
+
+  // Scalar tail (or the whole set when no SIMD path is compiled in)
+  for ( ; i < n ; i++) {
+    double s, c;
+    fast_math::sincos(theta[i], &s, &c);
+    x[i] += xs*s + xc*c;
+    y[i] += ys*s + yc*c;
+    theta[i] += dtheta;
+  }
+}
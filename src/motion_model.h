@@ -0,0 +1,39 @@
+/**
+ * motion_model.h
+ * Batched CTRV motion update over structure-of-arrays particle state.
+ */
+
+#ifndef MOTION_MODEL_H_
+#define MOTION_MODEL_H_
+
+/**
+ * Coefficients of one CTRV step, linear in the sin and cos of the heading:
+ *   x += xs * sin(theta) + xc * cos(theta), y += ys * sin(theta) +
+ *   yc * cos(theta), theta += dtheta.
+ */
+struct CtrvStep {
+  double xs, xc;
+  double ys, yc;
+  double dtheta;
+};
+
+/**
+ * ctrvStep Returns the step of the CTRV model for the given controls.
+ */
+CtrvStep ctrvStep(double delta_t, double velocity, double yaw_rate);
+
+/**
+ * predictCTRV Applies the noiseless constant turn rate and velocity model
+ *   to n particles in place. Uses AVX2 or NEON when the build enables them.
+ * @param x Array of n particle x positions [m]
+ * @param y Array of n particle y positions [m]
+ * @param theta Array of n particle headings [rad]
+ * @param n Number of particles
+ * @param delta_t Time between time step t and t+1 [s]
+ * @param velocity Velocity of car from t to t+1 [m/s]
+ * @param yaw_rate Yaw rate of car from t to t+1 [rad/s]
+ */
+void predictCTRV(double* x, double* y, double* theta, int n, double delta_t,
+                 double velocity, double yaw_rate);
+
+#endif  // MOTION_MODEL_H_
@@ -0,0 +1,45 @@
+/**
+ * observation_transform.cpp
+ * Batched vehicle-to-map transform of the observation set of a frame.
+ */
+
+#include "observation_transform.h"
+
+#include "fast_math.h"
+
+void transformObservations(const double* obs_x, const double* obs_y, int m,
+                           double x, double y, double s, double c,
+                           double* map_x, double* map_y) {
+  int j = 0;
+#if defined(__AVX2__)
+  const __m256d v_x = _mm256_set1_pd(x);
+  const __m256d v_y = _mm256_set1_pd(y);
+  const __m256d v_s = _mm256_set1_pd(s);
+  const __m256d v_c = _mm256_set1_pd(c);
+  const __m256d v_ns = _mm256_set1_pd(-s);
+  for ( ; j + 4 <= m ; j += 4) {
+    __m256d ox = _mm256_loadu_pd(obs_x + j);
+    __m256d oy = _mm256_loadu_pd(obs_y + j);
+    _mm256_storeu_pd(map_x + j, fast_math::fmadd(v_ns, oy,
+                                                fast_math::fmadd(v_c, ox, v_x)));
+    _mm256_storeu_pd(map_y + j, fast_math::fmadd(v_c, oy,
+                                                fast_math::fmadd(v_s, ox, v_y)));
+  }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+  const float64x2_t v_x = vdupq_n_f64(x);
+  const float64x2_t v_y = vdupq_n_f64(y);
+  const float64x2_t v_s = vdupq_n_f64(s);
+  const float64x2_t v_c = vdupq_n_f64(c);
+  for ( ; j + 2 <= m ; j += 2) {
+    float64x2_t ox = vld1q_f64(obs_x + j);
+    float64x2_t oy = vld1q_f64(obs_y + j);
+    vst1q_f64(map_x + j, vfmsq_f64(vfmaq_f64(v_x, v_c, ox), v_s, oy));
+    vst1q_f64(map_y + j, vfmaq_f64(vfmaq_f64(v_y, v_s, ox), v_c, oy));
+  }
+#endif
+
+  for ( ; j < m ; j++) {
+    map_x[j] = fast_math::fmadd(-s, obs_y[j], fast_math::fmadd(c, obs_x[j], x));
+    map_y[j] = fast_math::fmadd(c, obs_y[j], fast_math::fmadd(s, obs_x[j], y));
+  }
+}
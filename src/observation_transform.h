@@ -0,0 +1,27 @@
+/**
+ * observation_transform.h
+ * Batched vehicle-to-map transform of the observation set of a frame.
+ */
+
+#ifndef OBSERVATION_TRANSFORM_H_
+#define OBSERVATION_TRANSFORM_H_
+
+/**
+ * transformObservations Rotates m observations by the particle heading and
+ *   translates them by the particle position:
+ *   [map_x; map_y] = [x; y] + [c -s; s c] * [obs_x; obs_y]
+ * @param obs_x Array of m observation x coordinates, vehicle frame [m]
+ * @param obs_y Array of m observation y coordinates, vehicle frame [m]
+ * @param m Number of observations
+ * @param x Particle x position [m]
+ * @param y Particle y position [m]
+ * @param s sin of the particle heading
+ * @param c cos of the particle heading
+ * @param map_x Output array of m x coordinates, map frame [m]
+ * @param map_y Output array of m y coordinates, map frame [m]
+ */
+void transformObservations(const double* obs_x, const double* obs_y, int m,
+                           double x, double y, double s, double c,
+                           double* map_x, double* map_y);
+
+#endif  // OBSERVATION_TRANSFORM_H_
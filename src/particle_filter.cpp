@@ -8,24 +8,109 @@
 #include "particle_filter.h"
 
 #include <math.h>
+#include <stdio.h>
 #include <algorithm>
 #include <iostream>
-#include <iterator>
 #include <numeric>
 #include <random>
 #include <string>
 #include <vector>
 
+#include "association.h"
+#include "fast_math.h"
 #include "helper_functions.h"
+#include "metrics.h"
+#include "motion_model.h"
+#include "observation_transform.h"
+#include "resampler.h"
 
 using std::string;
 using std::vector;
-using std::normal_distribution;
 using std::numeric_limits;
 using std::uniform_int_distribution;
 using std::uniform_real_distribution;
 
-static std::default_random_engine gen;
+namespace {
+
+// Particles per block of the weight statistics
+const int kStatsBlock = 256;
+
+// Observations associated by a scan before a particle gets a k-d tree
+//   when early termination is on
+const int kEarlyOutScan = 4;
+
+}  // namespace
+
+template <typename Fn>
+void ParticleFilter::parallelFor(int n, const Fn& fn) {
+  if (pool) {
+    pool->parallelFor(n, fn);
+  } else if (n > 0) {
+    fn(0, n, 0);
+  }
+}
+
+void ParticleFilter::setSeed(uint64_t seed) {
+  random_seed = seed;
+  noise_frame = 0;
+  rng.reseed(mixSeed(seed, 0));
+}
+
+void ParticleFilter::addNoise(const double std[]) {
+  // Each block of kNoiseBlock particles draws from its own stream keyed on
+  //   the seed, the call and the block, so the noise does not depend on
+  //   the thread count
+  const int kNoiseBlock = 64;
+  const uint64_t call_seed = mixSeed(random_seed, ++noise_frame);
+  const int num_blocks = (num_particles + kNoiseBlock - 1) / kNoiseBlock;
+  parallelFor(num_blocks, [&](int begin, int end, int chunk) {
+    Xoshiro256 block_rng;
+    for (int b = begin ; b < end ; b++) {
+      block_rng.reseed(mixSeed(call_seed, b));
+      int first = b * kNoiseBlock;
+      int count = std::min(kNoiseBlock, num_particles - first);
+      addGaussian(block_rng, std[0], particles.x.data() + first, count);
+      addGaussian(block_rng, std[1], particles.y.data() + first, count);
+      addGaussian(block_rng, std[2], particles.theta.data() + first, count);
+    }
+  });
+}
+
+void ParticleFilter::predictCompact(double delta_t, const double std_pos[],
+                                    double velocity, double yaw_rate) {
+  // Same noise streams and draws as addNoise, added in the compact units
+  const int kNoiseBlock = 64;
+  const uint64_t call_seed = mixSeed(random_seed, ++noise_frame);
+  const int num_blocks = (num_particles + kNoiseBlock - 1) / kNoiseBlock;
+  const CtrvStep step = ctrvStep(delta_t, velocity, yaw_rate);
+  particles.resize(num_particles);
+  parallelFor(num_blocks, [&](int begin, int end, int chunk) {
+    Xoshiro256 block_rng;
+    double noise[3][kNoiseBlock];
+    for (int b = begin ; b < end ; b++) {
+      block_rng.reseed(mixSeed(call_seed, b));
+      int first = b * kNoiseBlock;
+      int count = std::min(kNoiseBlock, num_particles - first);
+      for (int d = 0 ; d < 3 ; d++) {
+        std::fill(noise[d], noise[d] + count, 0.0);
+        addGaussian(block_rng, std_pos[d], noise[d], count);
+      }
+      compact.predict(first, first + count, step, noise[0], noise[1],
+                      noise[2]);
+      compact.unpack(first, first + count, false, particles);
+    }
+  });
+  compact_current = false;
+}
+
+void ParticleFilter::unpackCompact() {
+  particles.resize(num_particles);
+  parallelFor(num_particles, [&](int begin, int end, int chunk) {
+    compact.unpack(begin, end, true, particles);
+  });
+  compact_current = false;
+  compact_weights = false;
+}
 
 void ParticleFilter::init(double x, double y, double theta, double std[]) {
   /**
@@ -40,25 +125,61 @@ void ParticleFilter::init(double x, double y, double theta, double std[]) {
     return;
   }
 
-  num_particles = 100;  // Set the number of particles
-
-  // Creates a normal (Gaussian) distribution for x, y and theta
-  normal_distribution<double> dist_x(x, std[0]);
-  normal_distribution<double> dist_y(y, std[1]);
-  normal_distribution<double> dist_theta(theta, std[2]);
+  // Set the number of particles; an adaptive filter starts wide, at its
+  //   upper bound, since the GPS prior is not yet narrowed down
+  num_particles = kld_enabled ? kld_params.max_particles : initial_particles;
+  reserveBuffers();
 
+  particles.resize(num_particles);
   for (int i = 0 ; i < num_particles ; i++) {
-    Particle p;
-    p.id = i;
-    p.x = dist_x(gen);
-    p.y = dist_y(gen);
-    p.theta = dist_theta(gen);
-    p.weight = 1.0;
-    particles.push_back(p);
+    particles.id[i] = i;
+    particles.x[i] = x;
+    particles.y[i] = y;
+    particles.theta[i] = theta;
+    particles.weight[i] = 1.0;
   }
+
+  // Gaussian noise for x, y and theta
+  addNoise(std);
   is_initialized = true;
 }
 
+void ParticleFilter::reserveBuffers() {
+  // Size every per-particle buffer for the largest set up front, so the
+  //   frame loop does not allocate once the first frame has been weighed
+  int capacity = std::max(num_particles,
+                          kld_enabled ? kld_params.max_particles
+                                      : initial_particles);
+  particles.reserve(capacity);
+  resampled.reserve(capacity);
+  log_weights.reserve(capacity);
+  particle_cells.reserve(capacity);
+  particle_sin.reserve(capacity);
+  particle_cos.reserve(capacity);
+  resample_idx.reserve(capacity);
+  resample_u.reserve(capacity);
+  stats_blocks.reserve(capacity / 256 + 1);
+  if (compact_state) {
+    compact.reserve(capacity);
+  }
+  if (kld_enabled) {
+    kld_bins.reserve(capacity);
+  }
+}
+
+void ParticleFilter::reset() {
+  is_initialized = false;
+  num_particles = 0;
+  particles.clear();
+  weight_stats = ParticleStats();
+  has_stats = false;
+  pending_weights = false;
+  carry_weights = false;
+  compact_current = false;
+  compact_weights = false;
+  debug_map = NULL;
+}
+
 void ParticleFilter::prediction(double delta_t, double std_pos[],
                                 double velocity, double yaw_rate) {
   /**
@@ -68,30 +189,20 @@ void ParticleFilter::prediction(double delta_t, double std_pos[],
    *  http://en.cppreference.com/w/cpp/numeric/random/normal_distribution
    *  http://www.cplusplus.com/reference/random/default_random_engine/
    */
+  metrics::ScopedTimer timer(metrics::STAGE_PREDICTION);
 
-  // Creates a normal (Gaussian) distribution for x, y and theta
-  normal_distribution<double> dist_x(0, std_pos[0]);
-  normal_distribution<double> dist_y(0, std_pos[1]);
-  normal_distribution<double> dist_theta(0, std_pos[2]);
+  // Survivors stored compactly move in that form
+  if (compact_current) {
+    predictCompact(delta_t, std_pos, velocity, yaw_rate);
+    return;
+  }
 
-  for (int i = 0 ; i < num_particles ; i++) {
-    Particle p = particles[i];
-
-    // Check if yaw_rate is not equal to zero.
-    if(fabs(yaw_rate) > 0.00001) {
-      particles[i].x += (velocity/yaw_rate)*(sin(p.theta+yaw_rate*delta_t) - sin(p.theta));
-      particles[i].y += (velocity/yaw_rate)*(cos(p.theta) - cos(p.theta+yaw_rate*delta_t));
-      particles[i].theta += yaw_rate*delta_t;
-    } else {
-      particles[i].x += velocity*delta_t*cos(p.theta);
-      particles[i].y += velocity*delta_t*sin(p.theta);
-    }
+  // Noiseless motion update for the whole set
+  predictCTRV(particles.x.data(), particles.y.data(), particles.theta.data(),
+              num_particles, delta_t, velocity, yaw_rate);
 
-    // Add Noice
-    particles[i].x += dist_x(gen);
-    particles[i].y += dist_y(gen);
-    particles[i].theta += dist_theta(gen);
-  }
+  // Add Noise
+  addNoise(std_pos);
 }
 
 void ParticleFilter::dataAssociation(vector<LandmarkObs> predicted, 
@@ -104,25 +215,151 @@ void ParticleFilter::dataAssociation(vector<LandmarkObs> predicted,
    *   probably find it useful to implement this method and use it as a helper 
    *   during the updateWeights phase.
    */
+  LandmarkKdTree tree;
+  bool use_tree = useKdTree(predicted.size(), observations.size());
+  if (use_tree) {
+    tree.build(predicted);
+  }
   for (int j = 0 ; j < observations.size() ; j++) {
-    double minDist = numeric_limits<double>::max();
-    int mapId = -1;
-    for (int k = 0 ; k < predicted.size() ; k++) {
-      double xDist = observations[j].x - predicted[k].x;
-      double yDist = observations[j].y - predicted[k].y;
-      double distance = xDist*xDist + yDist*yDist;
-      if (distance < minDist) {
-        minDist = distance;
-        mapId = predicted[k].id;
+    int k = use_tree ? tree.nearest(observations[j].x, observations[j].y)
+                     : nearestBruteForce(predicted, observations[j].x,
+                                         observations[j].y);
+    if (k >= 0) {
+      observations[j].id = predicted[k].id;
+    }
+  }
+}
+
+void ParticleFilter::gatherPredictions(const Map& map_landmarks, double x,
+                                       double y, double sensor_range,
+                                       int cell,
+                                       WeightScratch& scratch) const {
+  const Map::single_landmark_s* landmarks = map_landmarks.landmarks();
+  vector<int>& in_range = scratch.in_range;
+  in_range.clear();
+  if (cell >= 0) {
+    const vector<int>& candidates = range_cache.candidates(cell);
+    const int num_candidates = candidates.size();
+    for (int j = 0 ; j < num_candidates ; j++) {
+      if (Map::inRange(landmarks[candidates[j]], x, y, sensor_range)) {
+        in_range.push_back(candidates[j]);
       }
-      observations[j].id = mapId;
     }
+  } else {
+    map_landmarks.queryRange(x, y, sensor_range, in_range);
+  }
+
+  vector<LandmarkObs>& predictions = scratch.predictions;
+  predictions.clear();
+  const int num_in_range = in_range.size();
+  for (int j = 0 ; j < num_in_range ; j++) {
+    const Map::single_landmark_s& landmark = landmarks[in_range[j]];
+    LandmarkObs lm;
+    lm.id = landmark.id_i;
+    lm.x = landmark.x_f;
+    lm.y = landmark.y_f;
+    predictions.push_back(lm);
+  }
+}
+
+bool ParticleFilter::useKdTree(int num_predicted, int num_observations) const {
+  // Below these sizes building the tree costs more than the scan saves
+  const int kMinTreePredictions = 32;
+  const int kMinTreeObservations = 16;
+  switch (association_method) {
+    case KD_TREE_ASSOCIATION:
+      return true;
+    case AUTO_ASSOCIATION:
+      return num_predicted >= kMinTreePredictions &&
+             num_observations >= kMinTreeObservations;
+    default:
+      return false;
   }
 }
 
 void ParticleFilter::updateWeights(double sensor_range, double std_landmark[],
                                    const vector<LandmarkObs> &observations,
                                    const Map &map_landmarks) {
+  weighObservations(sensor_range, std_landmark, observations, map_landmarks,
+                    true);
+}
+
+void ParticleFilter::foldObservations(double sensor_range,
+                                      double std_landmark[],
+                                      const vector<LandmarkObs> &observations,
+                                      const Map &map_landmarks) {
+  weighObservations(sensor_range, std_landmark, observations, map_landmarks,
+                    false);
+}
+
+void ParticleFilter::finishWeights() {
+  if (!pending_weights) {
+    return;
+  }
+  // Batches folded without finishing kept no statistics; gather them from
+  //   the accumulated weights in one pass
+  const bool log_domain = weight_mode == LOG_WEIGHTS;
+  const int num_blocks = resetStatsBlocks();
+  parallelFor(num_blocks, [&](int block_begin, int block_end, int chunk) {
+    const int begin = block_begin * kStatsBlock;
+    const int end = std::min(num_particles, block_end * kStatsBlock);
+    for (int i = begin ; i < end ; i++) {
+      StatsAccumulator& block_stats = stats_blocks[i / kStatsBlock];
+      if (log_domain) {
+        block_stats.addLog(log_weights[i], particles.id[i], particles.x[i],
+                           particles.y[i], particles.theta[i]);
+      } else {
+        block_stats.add(particles.weight[i], particles.id[i], particles.x[i],
+                        particles.y[i], particles.theta[i]);
+      }
+    }
+  });
+  finishStats(num_blocks);
+}
+
+int ParticleFilter::resetStatsBlocks() {
+  // Weight statistics are gathered per block of kStatsBlock particles and
+  //   merged in block order, so they do not depend on the thread count.
+  //   Moments are taken about the first particle.
+  const bool log_domain = weight_mode == LOG_WEIGHTS;
+  const int num_blocks = (num_particles + kStatsBlock - 1) / kStatsBlock;
+  stats_blocks.resize(num_blocks);
+  for (int b = 0 ; b < num_blocks ; b++) {
+    stats_blocks[b].reset(log_domain, particles.x[0], particles.y[0],
+                          particles.theta[0]);
+  }
+  return num_blocks;
+}
+
+void ParticleFilter::finishStats(int num_blocks) {
+  const bool log_domain = weight_mode == LOG_WEIGHTS;
+  StatsAccumulator& total = stats_blocks[0];
+  for (int b = 1 ; b < num_blocks ; b++) {
+    total.merge(stats_blocks[b]);
+  }
+  total.finish(log_domain ? total.sum() : 1.0, weight_stats);
+  has_stats = true;
+  pending_weights = false;
+  compact_weights = false;
+
+  if (log_domain) {
+    // Log-sum-exp normalization; the accumulated largest log-weight and
+    //   the sum relative to it are the max and sum passes
+    const double max_lw = total.logScale();
+    const double sum = total.sum();
+    weight_log_norm = max_lw + log(sum);
+    parallelFor(num_particles, [&](int begin, int end, int chunk) {
+      for (int i = begin ; i < end ; i++) {
+        particles.weight[i] = exp(log_weights[i] - max_lw) / sum;
+      }
+    });
+  }
+}
+
+void ParticleFilter::weighObservations(double sensor_range,
+                                       double std_landmark[],
+                                       const vector<LandmarkObs> &observations,
+                                       const Map &map_landmarks, bool finish) {
   /**
    * Update the weights of each particle using a mult-variate Gaussian 
    *   distribution. You can read more about this distribution here: 
@@ -136,61 +373,233 @@ void ParticleFilter::updateWeights(double sensor_range, double std_landmark[],
    *   and the following is a good resource for the actual equation to implement
    *   (look at equation 3.33) http://planning.cs.uiuc.edu/node99.html
    */
+  metrics::ScopedTimer timer(metrics::STAGE_WEIGHTING);
+  const bool timed = metrics::enabled();
 
-  vector<Map::single_landmark_s> landmarks = map_landmarks.landmark_list;
+  // Weighed without a motion update since a compact resample
+  if (compact_current) {
+    unpackCompact();
+  }
 
-  for (int i = 0 ; i < num_particles ; i++) {
-    double particleX = particles[i].x;
-    double particleY = particles[i].y;
-    double theta = particles[i].theta;
-
-    // Landmarks which map location with the sensor range of the particle
-    vector<LandmarkObs> predictions;
-    for (int j = 0 ; j < landmarks.size() ; j++) {
-      int l_id = landmarks[j].id_i;
-      float x_f = landmarks[j].x_f;
-      float y_f = landmarks[j].y_f;
-      double distance = dist(particleX, particleY, x_f, y_f);
-      if (distance <= sensor_range) {
-        LandmarkObs lm;
-        lm.id = l_id;
-        lm.x = x_f;
-        lm.y = y_f;
-        predictions.push_back(lm);
-      }
+  const GaussianLikelihood likelihood(std_landmark[0], std_landmark[1]);
+  const bool log_domain = weight_mode == LOG_WEIGHTS;
+  log_weights.resize(num_particles);
+  if (weight_scratch.size() < static_cast<size_t>(numThreads())) {
+    weight_scratch.resize(numThreads());
+  }
+
+  // Resolve the cached candidate set of every particle up front; the
+  //   cache is not thread-safe, the lookups are cheap
+  if (range_cache_enabled) {
+    uint64_t hits = range_cache.hits();
+    uint64_t misses = range_cache.misses();
+    range_cache.beginFrame(map_landmarks, sensor_range);
+    particle_cells.resize(num_particles);
+    for (int i = 0 ; i < num_particles ; i++) {
+      particle_cells[i] = range_cache.lookup(particles.x[i], particles.y[i]);
+    }
+    if (timed) {
+      metrics::add(metrics::COUNTER_RANGE_CACHE_HITS, range_cache.hits() - hits);
+      metrics::add(metrics::COUNTER_RANGE_CACHE_MISSES,
+                   range_cache.misses() - misses);
     }
+  }
 
-    particles[i].weight = 1.0;
-    for (int j = 0 ; j < observations.size() ; j++) {
-      LandmarkObs obs;
-      double x_obs = observations[j].x;
-      double y_obs = observations[j].y;
+  // Observations in contiguous buffers and the heading sincos of every
+  //   particle, so the per-particle transform is a small batch
+  const int num_obs = observations.size();
+  obs_x.resize(num_obs);
+  obs_y.resize(num_obs);
+  for (int j = 0 ; j < num_obs ; j++) {
+    obs_x[j] = observations[j].x;
+    obs_y[j] = observations[j].y;
+  }
 
+  // debugParticle() associates against the same frame later, so it keeps
+  //   every batch folded into the frame, not only the last one
+  if (debug_associations) {
+    debug_map = &map_landmarks;
+    debug_range = sensor_range;
+    debug_std[0] = std_landmark[0];
+    debug_std[1] = std_landmark[1];
+    if (!pending_weights) {
+      debug_obs_x.clear();
+      debug_obs_y.clear();
+    }
+    debug_obs_x.insert(debug_obs_x.end(), obs_x.begin(), obs_x.end());
+    debug_obs_y.insert(debug_obs_y.end(), obs_y.begin(), obs_y.end());
+  }
+  particle_sin.resize(num_particles);
+  particle_cos.resize(num_particles);
+  fast_math::sincosBatch(particles.theta.data(), num_particles,
+                         particle_sin.data(), particle_cos.data());
+
+  // The statistics of the finishing batch are gathered in its weighting
+  //   pass; the batches folded before it only accumulate
+  int num_blocks = (num_particles + kStatsBlock - 1) / kStatsBlock;
+  if (finish) {
+    num_blocks = resetStatsBlocks();
+  }
+
+  // Gating replaces the exponent of outliers by that of outlier_distance.
+  //   Early termination compares bounds within a stats block, so it does
+  //   not depend on the thread count, and only in the finishing batch,
+  //   since later batches could still reorder the particles.
+  const bool gating = gating_enabled;
+  const double gate_exponent =
+      0.5 * gating_params.gate * gating_params.gate;
+  const double outlier_exponent =
+      0.5 * gating_params.outlier_distance * gating_params.outlier_distance;
+  const bool early_out = gating_enabled && log_domain && finish &&
+                         gating_params.early_out > 0.0;
+
+  // Particles are independent, so each thread weighs a contiguous run of
+  //   blocks with its own scratch buffers.
+  parallelFor(num_blocks, [&](int block_begin, int block_end, int chunk) {
+    const int begin = block_begin * kStatsBlock;
+    const int end = std::min(num_particles, block_end * kStatsBlock);
+    vector<int>& in_range = weight_scratch[chunk].in_range;
+    vector<LandmarkObs>& predictions = weight_scratch[chunk].predictions;
+    LandmarkKdTree& tree = weight_scratch[chunk].tree;
+    vector<double>& map_x = weight_scratch[chunk].map_x;
+    vector<double>& map_y = weight_scratch[chunk].map_y;
+    map_x.resize(num_obs);
+    map_y.resize(num_obs);
+    // Sub-stage timing samples one particle in kTimingStride and scales
+    //   the result, keeping clock reads off most iterations
+    const int kTimingStride = 8;
+    uint64_t range_ns = 0;
+    uint64_t association_ns = 0;
+    uint64_t in_range_total = 0;
+    uint64_t gated_total = 0;
+    uint64_t early_outs = 0;
+    int sampled = 0;
+    double block_best = -INFINITY;  // Best log-weight so far in the block
+
+    for (int i = begin ; i < end ; i++) {
+      if ((i - begin) % kStatsBlock == 0) {
+        block_best = -INFINITY;
+      }
+      const bool sample = timed && (i - begin) % kTimingStride == 0;
+      uint64_t t0 = sample ? metrics::nowNs() : 0;
+      double particleX = particles.x[i];
+      double particleY = particles.y[i];
+
+      // Landmarks which map location with the sensor range of the particle
+      gatherPredictions(map_landmarks, particleX, particleY, sensor_range,
+                        range_cache_enabled ? particle_cells[i] : -1,
+                        weight_scratch[chunk]);
+      in_range_total += in_range.size();
+
+      // With early termination the first observations are associated by a
+      //   scan, so particles dropped early never pay for a tree
+      bool use_tree = useKdTree(predictions.size(), num_obs);
+      int scan_until = 0;
+      if (use_tree && early_out) {
+        scan_until = std::min(num_obs, kEarlyOutScan);
+      } else if (use_tree) {
+        tree.build(predictions);
+      }
+      uint64_t t1 = sample ? metrics::nowNs() : 0;
+
+      // Batches folded earlier this frame, or else weights carried over a
+      //   skipped resample, act as the prior
+      double weight = log_domain ? 0.0 : 1.0;
+      if (pending_weights) {
+        weight = log_domain ? log_weights[i] : particles.weight[i];
+      } else if (carry_weights) {
+        weight = log_domain ? log(particles.weight[i]) : particles.weight[i];
+      }
       // Transform observations from vehicle coordinates to map coordinates
-      obs.x = particleX + (cos(theta) * x_obs) - (sin(theta) * y_obs);
-      obs.y = particleY + (sin(theta) * x_obs) + (cos(theta) * y_obs);
-
-      // Data Association
-      double minDist = numeric_limits<double>::max();
-      int mapId = -1;
-      double p_x = 0;
-      double p_y = 0;
-      for (int k = 0 ; k < predictions.size() ; k++) {
-        double xDist = obs.x - predictions[k].x;
-        double yDist = obs.y - predictions[k].y;
-        double distance = xDist*xDist + yDist*yDist;
-        if (distance < minDist) {
-          minDist = distance;
-          mapId = predictions[k].id;
+      transformObservations(obs_x.data(), obs_y.data(), num_obs, particleX,
+                            particleY, particle_sin[i], particle_cos[i],
+                            map_x.data(), map_y.data());
+      for (int j = 0 ; j < num_obs ; j++) {
+        // Hopeless even if every remaining observation matched exactly;
+        //   the bound is kept as its weight
+        if (early_out && weight + (num_obs - j) * likelihood.log_norm <
+                         block_best - gating_params.early_out) {
+          weight += (num_obs - j) * likelihood.log_norm;
+          early_outs++;
+          break;
+        }
+
+        // Survived the scan; the tree pays only for enough observations left
+        if (scan_until > 0 && j == scan_until) {
+          use_tree = useKdTree(predictions.size(), num_obs - j);
+          if (use_tree) {
+            tree.build(predictions);
+          }
+        }
+
+        // Data Association
+        int k = use_tree && j >= scan_until
+                    ? tree.nearest(map_x[j], map_y[j])
+                    : nearestBruteForce(predictions, map_x[j], map_y[j]);
+        double p_x = 0;
+        double p_y = 0;
+        if (k >= 0) {
           p_x = predictions[k].x;
           p_y = predictions[k].y;
         }
-        obs.id = mapId;
+
+        double exponent = likelihood.exponent(map_x[j] - p_x, map_y[j] - p_y);
+        if (gating && (k < 0 || exponent > gate_exponent)) {
+          exponent = outlier_exponent;
+          gated_total++;
+        }
+        if (log_domain) {
+          weight += likelihood.log_norm - exponent;
+        } else {
+          weight *= likelihood.gauss_norm * exp(-exponent);
+        }
       }
+      block_best = std::max(block_best, weight);
+      if (log_domain) {
+        log_weights[i] = weight;
+      } else {
+        particles.weight[i] = weight;
+      }
+      if (finish) {
+        StatsAccumulator& block_stats = stats_blocks[i / kStatsBlock];
+        if (log_domain) {
+          block_stats.addLog(weight, particles.id[i], particleX, particleY,
+                             particles.theta[i]);
+        } else {
+          block_stats.add(weight, particles.id[i], particleX, particleY,
+                          particles.theta[i]);
+        }
+      }
+      if (sample) {
+        uint64_t t2 = metrics::nowNs();
+        range_ns += t1 - t0;
+        association_ns += t2 - t1;
+        sampled++;
+      }
+    }
 
-      double w = multiv_prob(std_landmark[0], std_landmark[1], obs.x, obs.y, p_x, p_y);
-      particles[i].weight *= w;
+    if (timed) {
+      int n = end - begin;
+      metrics::record(metrics::STAGE_RANGE_QUERY, range_ns * n / sampled);
+      metrics::record(metrics::STAGE_ASSOCIATION, association_ns * n / sampled);
+      metrics::add(metrics::COUNTER_IN_RANGE_LANDMARKS, in_range_total);
+      metrics::add(metrics::COUNTER_GATED_OBSERVATIONS, gated_total);
+      metrics::add(metrics::COUNTER_EARLY_OUTS, early_outs);
     }
+  });
+
+  if (timed) {
+    metrics::add(metrics::COUNTER_FRAMES, 1);
+    metrics::add(metrics::COUNTER_PARTICLES, num_particles);
+    metrics::add(metrics::COUNTER_OBSERVATIONS, observations.size());
+  }
+
+  if (finish) {
+    finishStats(num_blocks);
+  } else {
+    // stats() describes no weighted set until the frame is finished
+    pending_weights = true;
+    has_stats = false;
   }
 }
 
@@ -201,35 +610,154 @@ void ParticleFilter::resample() {
    * NOTE: You may find std::discrete_distribution helpful here.
   *   http://en.cppreference.com/w/cpp/numeric/random/discrete_distribution
    */
+  // A frame still folding observations ends here
+  finishWeights();
+  if (compact_current || compact_weights) {
+    unpackCompact();
+  }
+
+  metrics::ScopedTimer timer(metrics::STAGE_RESAMPLE);
+
+  // Keep the weighted set while it is still diverse enough
+  double ess = has_stats ? weight_stats.ess : effectiveSampleSize();
+  if (ess_gating && ess >= ess_fraction * num_particles) {
+    carry_weights = true;
+    skipped_resamples++;
+    return;
+  }
+  carry_weights = false;
+
+  // Size of the new generation
+  int n_out = num_particles;
+  if (kld_enabled) {
+    n_out = kldParticleCount();
+  }
+
+  resample_idx.resize(n_out);
+  int* idx = resample_idx.data();
+  const double* w = particles.weight.data();
+  uniform_real_distribution<double> dist_u(0.0, 1.0);
+
+  switch (resample_method) {
+    case SYSTEMATIC_RESAMPLING:
+      systematicResample(w, num_particles, n_out, dist_u(rng), idx);
+      break;
+    case STRATIFIED_RESAMPLING:
+      resample_u.resize(n_out);
+      for (int i = 0 ; i < n_out ; i++) {
+        resample_u[i] = dist_u(rng);
+      }
+      stratifiedResample(w, num_particles, n_out, resample_u.data(), idx);
+      break;
+    case RESIDUAL_RESAMPLING:
+      resample_u.resize(num_particles);
+      residualResample(w, num_particles, n_out, dist_u(rng),
+                       resample_u.data(), idx);
+      break;
+    default:
+      resampleWheel(n_out, idx);
+      break;
+  }
+
+  // The stats describe the weighted set until the next updateWeights;
+  //   only the ESS and max weight of the resampled one are unknown
+  const bool fresh_log_weights = has_stats && weight_mode == LOG_WEIGHTS;
+  has_stats = false;
+
+  // Compact survivors, restored by the next prediction()
+  if (compact_state) {
+    compact.gather(particles, fresh_log_weights ? log_weights.data() : NULL,
+                   weight_log_norm, idx, n_out);
+    num_particles = n_out;
+    compact_current = true;
+    compact_weights = true;
+    return;
+  }
+
+  // Gather the survivors into the back buffer and swap it in
+  resampled.resize(n_out);
+  for (int i = 0 ; i < n_out ; i++) {
+    int index = idx[i];
+    resampled.id[i] = particles.id[index];
+    resampled.x[i] = particles.x[index];
+    resampled.y[i] = particles.y[index];
+    resampled.theta[i] = particles.theta[index];
+    resampled.weight[i] = particles.weight[index];
+  }
+  std::swap(particles, resampled);
+  num_particles = n_out;
+}
+
+double ParticleFilter::effectiveSampleSize() const {
+  double sum = 0.0;
+  double sum_sq = 0.0;
+  for (int i = 0 ; i < num_particles ; i++) {
+    double w = compact_weights ? exp(compact.log_weight[i])
+                               : particles.weight[i];
+    sum += w;
+    sum_sq += w * w;
+  }
+  if (!(sum_sq > 0.0)) {
+    return 0.0;
+  }
+  return sum * sum / sum_sq;
+}
 
+int ParticleFilter::kldParticleCount() {
+  // Bins are counted over particles with at least the mass that would
+  //   earn them one copy at the largest allowed set size
+  double sum = 0.0;
+  for (int i = 0 ; i < num_particles ; i++) {
+    sum += particles.weight[i];
+  }
+  double min_weight = sum / kld_params.max_particles;
+  int k = kld_bins.count(particles, min_weight, kld_params);
+  return kldSampleSize(k, kld_params);
+}
+
+void ParticleFilter::resampleWheel(int n_out, int* idx) {
   // Resampling Wheel
-  // Get the max weight
-  vector<double> w;
+  // Get the max weight, known from the weighting pass if it ran
+  const vector<double>& w = particles.weight;
   double maxWeight = numeric_limits<double>::min();
-  for (int i = 0 ; i < num_particles ; i++) {
-    w.push_back(particles[i].weight);
-    if (maxWeight < particles[i].weight) {
-      maxWeight = particles[i].weight;
+  if (has_stats) {
+    maxWeight = std::max(maxWeight, weight_stats.max_weight);
+  } else {
+    for (int i = 0 ; i < num_particles ; i++) {
+      if (maxWeight < w[i]) {
+        maxWeight = w[i];
+      }
     }
   }
 
   uniform_int_distribution<int> dist_i(0, num_particles - 1);
   uniform_real_distribution<double> dist_w(0.0, maxWeight);
-  int index = dist_i(gen);
+  int index = dist_i(rng);
   double beta = 0.0;
 
-  vector<Particle> resample_ps;
-  for (int i = 0 ; i < num_particles ; i++) {
-  beta += 2*dist_w(gen);
+  for (int i = 0 ; i < n_out ; i++) {
+    beta += 2*dist_w(rng);
     while (beta > w[index]) {
       beta -= w[index];
       index = (index+1) % num_particles;
     }
-    resample_ps.push_back(particles[index]);
+    idx[i] = index;
+  }
+}
+
+void ParticleFilter::setNumThreads(int num_threads) {
+  if (num_threads <= 1) {
+    pool.reset();
+  } else if (!pool || pool->size() != num_threads) {
+    pool.reset(new ThreadPool(num_threads));
   }
-  particles = resample_ps;
 }
 
+int ParticleFilter::numThreads() const {
+  return pool ? pool->size() : 1;
+}
+
+
 void ParticleFilter::SetAssociations(Particle& particle,
                                      const vector<int>& associations,
                                      const vector<double>& sense_x,
@@ -244,27 +772,124 @@ void ParticleFilter::SetAssociations(Particle& particle,
   particle.sense_y = sense_y;
 }
 
-string ParticleFilter::getAssociations(Particle best) {
-  vector<int> v = best.associations;
-  std::stringstream ss;
-  copy(v.begin(), v.end(), std::ostream_iterator<int>(ss, " "));
-  string s = ss.str();
-  s = s.substr(0, s.length()-1);  // get rid of the trailing space
-  return s;
+Particle ParticleFilter::getParticle(int i) const {
+  Particle p;
+  if (compact_current) {
+    p.id = compact.id[i];
+    p.x = compact.anchor_x + compact.dx[i];
+    p.y = compact.anchor_y + compact.dy[i];
+    p.theta = CompactParticleSet::headingAngle(compact.heading[i]);
+    p.weight = exp(compact.log_weight[i]);
+    return p;
+  }
+  p.id = particles.id[i];
+  p.x = particles.x[i];
+  p.y = particles.y[i];
+  p.theta = particles.theta[i];
+  p.weight = compact_weights ? exp(compact.log_weight[i])
+                             : particles.weight[i];
+  return p;
 }
 
-string ParticleFilter::getSenseCoord(Particle best, string coord) {
-  vector<double> v;
+Particle ParticleFilter::bestParticle() const {
+  Particle p;
+  p.id = weight_stats.best_id;
+  p.x = weight_stats.best_x;
+  p.y = weight_stats.best_y;
+  p.theta = weight_stats.best_theta;
+  p.weight = weight_stats.max_weight;
+  return p;
+}
 
-  if (coord == "X") {
-    v = best.sense_x;
-  } else {
-    v = best.sense_y;
+const Particle& ParticleFilter::debugParticle(const Particle& particle) {
+  Particle& p = debug_particle;
+  p.id = particle.id;
+  p.x = particle.x;
+  p.y = particle.y;
+  p.theta = particle.theta;
+  p.weight = particle.weight;
+  p.associations.clear();
+  p.sense_x.clear();
+  p.sense_y.clear();
+  if (!debug_associations || !debug_map) {
+    return p;
+  }
+
+  // Same range query, transform and gate as updateWeights; gated outliers
+  //   carry no association. The nearest neighbor is always a scan.
+  WeightScratch& scratch = weight_scratch[0];
+  const int cell = range_cache_enabled ? range_cache.lookup(p.x, p.y) : -1;
+  gatherPredictions(*debug_map, p.x, p.y, debug_range, cell, scratch);
+  const vector<LandmarkObs>& predictions = scratch.predictions;
+
+  const int num_obs = debug_obs_x.size();
+  scratch.map_x.resize(num_obs);
+  scratch.map_y.resize(num_obs);
+  double sin_theta;
+  double cos_theta;
+  fast_math::sincos(p.theta, &sin_theta, &cos_theta);
+  transformObservations(debug_obs_x.data(), debug_obs_y.data(), num_obs,
+                        p.x, p.y, sin_theta, cos_theta, scratch.map_x.data(),
+                        scratch.map_y.data());
+  const GaussianLikelihood likelihood(debug_std[0], debug_std[1]);
+  const double gate_exponent =
+      0.5 * gating_params.gate * gating_params.gate;
+  for (int j = 0 ; j < num_obs ; j++) {
+    int k = nearestBruteForce(predictions, scratch.map_x[j], scratch.map_y[j]);
+    if (k < 0) {
+      continue;
+    }
+    double exponent = likelihood.exponent(scratch.map_x[j] - predictions[k].x,
+                                          scratch.map_y[j] - predictions[k].y);
+    if (gating_enabled && exponent > gate_exponent) {
+      continue;
+    }
+    p.associations.push_back(predictions[k].id);
+    p.sense_x.push_back(scratch.map_x[j]);
+    p.sense_y.push_back(scratch.map_y[j]);
+  }
+  return p;
+}
+
+namespace {
+
+// Appends the values separated by single spaces, as the simulator expects
+template <typename T>
+void appendList(const std::vector<T>& values, const char* format,
+                string& out) {
+  char buf[32];
+  for (size_t i = 0; i < values.size(); ++i) {
+    int n = snprintf(buf, sizeof(buf), format, values[i]);
+    if (i > 0) {
+      out += ' ';
+    }
+    out.append(buf, n);
   }
+}
+
+}  // namespace
+
+void ParticleFilter::formatAssociations(const Particle& particle,
+                                        string& associations, string& sense_x,
+                                        string& sense_y) {
+  associations.clear();
+  sense_x.clear();
+  sense_y.clear();
+  appendList(particle.associations, "%d", associations);
+  // %g at float precision, as the former ostream_iterator<float>
+  appendList(particle.sense_x, "%.6g", sense_x);
+  appendList(particle.sense_y, "%.6g", sense_y);
+}
 
-  std::stringstream ss;
-  copy(v.begin(), v.end(), std::ostream_iterator<float>(ss, " "));
-  string s = ss.str();
-  s = s.substr(0, s.length()-1);  // get rid of the trailing space
+string ParticleFilter::getAssociations(const Particle& best) {
+  string s;
+  appendList(best.associations, "%d", s);
   return s;
-}
\ No newline at end of file
+}
+
+string ParticleFilter::getSenseCoord(const Particle& best,
+                                     const string& coord) {
+  string s;
+  appendList(coord == "X" ? best.sense_x : best.sense_y, "%.6g", s);
+  return s;
+}
@@ -9,10 +9,23 @@
 #ifndef PARTICLE_FILTER_H_
 #define PARTICLE_FILTER_H_
 
+#include <memory>
 #include <string>
 #include <vector>
+#include "association.h"
+#include "compact_particle_set.h"
 #include "helper_functions.h"
+#include "kld_sampling.h"
+#include "particle_set.h"
+#include "particle_stats.h"
+#include "range_cache.h"
+#include "rng.h"
+#include "thread_pool.h"
 
+/**
+ * Single particle as seen at the API boundary, together with its
+ *   association debug data. The filter itself stores a ParticleSet.
+ */
 struct Particle {
   int id;
   double x;
@@ -27,9 +40,52 @@ struct Particle {
 
 class ParticleFilter {
  public:
+  /**
+   * How updateWeights combines the per-observation likelihoods.
+   *   LINEAR_WEIGHTS multiplies raw probabilities (underflows to 0 for
+   *   large observation counts). LOG_WEIGHTS sums log-likelihoods and
+   *   normalizes with log-sum-exp, leaving weights that sum to 1.
+   */
+  enum WeightMode { LINEAR_WEIGHTS, LOG_WEIGHTS };
+
+  /**
+   * Nearest-neighbor search used for data association.
+   *   BRUTE_FORCE_ASSOCIATION scans every prediction, KD_TREE_ASSOCIATION
+   *   builds a 2-d tree over each particle's predictions, and
+   *   AUTO_ASSOCIATION uses the tree only for large prediction and
+   *   observation sets. All three associate identically.
+   */
+  enum AssociationMethod {
+    BRUTE_FORCE_ASSOCIATION,
+    KD_TREE_ASSOCIATION,
+    AUTO_ASSOCIATION
+  };
+
+  /**
+   * Resampling scheme used by resample(). WHEEL_RESAMPLING is the original
+   *   resampling wheel, whose cost depends on the weight distribution.
+   *   The others are strictly O(N) (see resampler.h).
+   */
+  enum ResampleMethod {
+    WHEEL_RESAMPLING,
+    SYSTEMATIC_RESAMPLING,
+    STRATIFIED_RESAMPLING,
+    RESIDUAL_RESAMPLING
+  };
+
   // Constructor
   // @param num_particles Number of particles
-  ParticleFilter() : num_particles(0), is_initialized(false) {}
+  ParticleFilter()
+      : num_particles(0), is_initialized(false), weight_mode(LINEAR_WEIGHTS),
+        association_method(AUTO_ASSOCIATION), range_cache_enabled(false),
+        resample_method(WHEEL_RESAMPLING), initial_particles(100),
+        kld_enabled(false), gating_enabled(false), ess_gating(false),
+        ess_fraction(0.5), carry_weights(false), skipped_resamples(0),
+        random_seed(0), noise_frame(0), rng(mixSeed(0, 0)), has_stats(false),
+        pending_weights(false), compact_state(false), compact_current(false),
+        compact_weights(false), weight_log_norm(0.0),
+        debug_associations(false),
+        debug_map(NULL), debug_range(0.0), debug_std() {}
 
   // Destructor
   ~ParticleFilter() {}
@@ -78,6 +134,28 @@ class ParticleFilter {
   void updateWeights(double sensor_range, double std_landmark[],
                      const std::vector<LandmarkObs> &observations,
                      const Map &map_landmarks);
+
+  /**
+   * foldObservations Folds the likelihood of a batch of new observations
+   *   into the weights of the current frame, for sensors that deliver a
+   *   frame in several batches between two predictions. Normalization and
+   *   stats() are deferred to the batch passed to updateWeights, or to
+   *   finishWeights(); resample() finishes a pending frame itself. Only
+   *   the observations since the previous batch are passed.
+   * @param sensor_range Range [m] of sensor
+   * @param std_landmark[] Landmark measurement uncertainty [x [m], y [m]]
+   * @param observations Observations new since the previous batch
+   * @param map Map class containing map landmarks
+   */
+  void foldObservations(double sensor_range, double std_landmark[],
+                        const std::vector<LandmarkObs> &observations,
+                        const Map &map_landmarks);
+
+  /**
+   * finishWeights Normalizes the weights folded by foldObservations and
+   *   gathers stats(). A no-op when no batch is pending.
+   */
+  void finishWeights();
   
   /**
    * resample Resamples from the updated set of particles to form
@@ -95,6 +173,156 @@ class ParticleFilter {
                        const std::vector<double>& sense_x,
                        const std::vector<double>& sense_y);
 
+  /**
+   * setWeightMode Selects linear or log-domain weighting for updateWeights.
+   * @param mode LINEAR_WEIGHTS (default) or LOG_WEIGHTS
+   */
+  void setWeightMode(WeightMode mode) {
+    weight_mode = mode;
+  }
+
+  /**
+   * setAssociationMethod Selects the nearest-neighbor search used by
+   *   updateWeights and dataAssociation.
+   * @param method One of the AssociationMethod values (default AUTO)
+   */
+  void setAssociationMethod(AssociationMethod method) {
+    association_method = method;
+  }
+
+  /**
+   * setSeed Restarts all random draws of the filter from seed. Runs with
+   *   the same seed and inputs are reproducible, at any thread count.
+   */
+  void setSeed(uint64_t seed);
+
+  /**
+   * setRangeCache Lets updateWeights share in-range landmark candidates
+   *   between particles in the same cell_size x cell_size cell and across
+   *   frames (see range_cache.h). Results are unchanged.
+   * @param enabled Whether to cache range queries
+   * @param cell_size Cell edge length [m]
+   */
+  void setRangeCache(bool enabled, double cell_size = 2.0) {
+    range_cache_enabled = enabled;
+    range_cache.setCellSize(cell_size);
+  }
+
+  /**
+   * setResampleMethod Selects the resampling scheme used by resample().
+   * @param method One of the ResampleMethod values (default WHEEL_RESAMPLING)
+   */
+  void setResampleMethod(ResampleMethod method) {
+    resample_method = method;
+  }
+
+  /**
+   * setNumParticles Sets the particle count used by init() for a filter
+   *   that does not adapt its size.
+   * @param n Number of particles (default 100)
+   */
+  void setNumParticles(int n) {
+    initial_particles = n;
+  }
+
+  /**
+   * setKldSampling Lets resample() adapt the particle count by KLD-sampling
+   *   within [params.min_particles, params.max_particles], growing the set
+   *   while the posterior is spread out and shrinking it once converged.
+   * @param enabled Whether to adapt the particle count
+   * @param params KLD-sampling parameters
+   */
+  void setKldSampling(bool enabled, const KldParams& params = KldParams()) {
+    kld_enabled = enabled;
+    kld_params = params;
+  }
+
+  /**
+   * setEssGating Makes resample() a no-op while the effective sample size
+   *   is at least fraction * size(). The weights are then carried into the
+   *   next updateWeights instead of being reset.
+   * @param enabled Whether to gate resampling on the ESS
+   * @param fraction ESS threshold as a fraction of the particle count
+   */
+  void setEssGating(bool enabled, double fraction = 0.5) {
+    ess_gating = enabled;
+    ess_fraction = fraction;
+  }
+
+  /**
+   * setGating Makes updateWeights robust to clutter and cheaper on hopeless
+   *   particles: outlier associations only cost a bounded penalty, and
+   *   particles certain to end up negligible skip their remaining
+   *   observations (see GatingParams). Off by default.
+   * @param enabled Whether to gate associations and terminate early
+   * @param params Gate, outlier floor and early termination margin
+   */
+  void setGating(bool enabled, const GatingParams& params = GatingParams()) {
+    gating_enabled = enabled;
+    gating_params = params;
+  }
+
+  /**
+   * setCompactState Keeps the particles in a CompactParticleSet (18 instead
+   *   of 36 bytes per particle) from resample() through the next
+   *   prediction(), so the bandwidth-bound resample gather and motion
+   *   update move half the memory. Full precision is restored after the
+   *   motion update, for updateWeights and the API. Positions keep float
+   *   precision relative to the cloud and headings 16 bits.
+   * @param enabled Whether to store resampled particles compactly
+   */
+  void setCompactState(bool enabled) {
+    compact_state = enabled;
+  }
+
+  /**
+   * effectiveSampleSize Returns (sum w)^2 / sum w^2 of the current weights,
+   *   between 1 (one particle holds all mass) and size() (uniform).
+   */
+  double effectiveSampleSize() const;
+
+  /**
+   * skippedResamples Returns how many resample() calls the ESS gate skipped.
+   */
+  unsigned long skippedResamples() const {
+    return skipped_resamples;
+  }
+
+  /**
+   * stats Returns the best particle, weighted mean pose, weight statistics
+   *   and pose covariance of the last updateWeights, gathered in its
+   *   weighting pass. They describe the weighted set, so they still hold
+   *   after resample() has redrawn the particles.
+   */
+  const ParticleStats& stats() const {
+    return weight_stats;
+  }
+
+  /**
+   * bestParticle Returns the highest-weight particle of stats().
+   */
+  Particle bestParticle() const;
+
+  /**
+   * size Returns the current number of particles.
+   */
+  int size() const {
+    return num_particles;
+  }
+
+  /**
+   * setNumThreads Sets how many threads updateWeights splits the particles
+   *   across. 1 (the default) runs everything on the calling thread.
+   *   Results do not depend on the thread count.
+   * @param num_threads Number of threads, including the calling thread
+   */
+  void setNumThreads(int num_threads);
+
+  /**
+   * numThreads Returns the number of threads used by updateWeights.
+   */
+  int numThreads() const;
+
   /**
    * initialized Returns whether particle filter is initialized yet or not.
    */
@@ -102,14 +330,80 @@ class ParticleFilter {
     return is_initialized;
   }
 
+  /**
+   * setDebugAssociations Lets debugParticle() recover the associations of
+   *   a particle. Off by default; updateWeights then keeps no debug state.
+   */
+  void setDebugAssociations(bool enabled) {
+    debug_associations = enabled;
+    debug_map = NULL;
+  }
+
+  /**
+   * debugAssociations Returns whether debugParticle() fills associations.
+   */
+  bool debugAssociations() const {
+    return debug_associations;
+  }
+
+  /**
+   * debugParticle Returns particle together with the landmark each
+   *   observation of the last frame associates with and the observation
+   *   in map coordinates; a frame folded in batches contributes every
+   *   batch up to the one that finished it. Only this particle is associated
+   *   again, on demand; the map of the last updateWeights must still be
+   *   alive. The reference is valid until the next call.
+   * @param particle Pose to associate, e.g. bestParticle()
+   */
+  const Particle& debugParticle(const Particle& particle);
+
   /**
    * Used for obtaining debugging information related to particles.
    */
-  std::string getAssociations(Particle best);
-  std::string getSenseCoord(Particle best, std::string coord);
+  std::string getAssociations(const Particle& best);
+  std::string getSenseCoord(const Particle& best, const std::string& coord);
 
-  // Set of current particles
-  std::vector<Particle> particles;
+  /**
+   * formatAssociations Writes the space-separated associations and sense
+   *   coordinates of particle into the given strings, reusing their storage.
+   */
+  static void formatAssociations(const Particle& particle,
+                                 std::string& associations,
+                                 std::string& sense_x, std::string& sense_y);
+
+  /**
+   * saveState Serializes the full filter state into out, reusing its
+   *   storage: particles, weights, statistics, random state and frame
+   *   counter (layout in filter_snapshot.cpp). Settings are not included.
+   */
+  void saveState(std::vector<char>& out) const;
+
+  /**
+   * restoreState Replaces the filter state by a snapshot of saveState.
+   *   The filter continues exactly where the saved one stopped if it is
+   *   configured the same way (weight mode, resampling, KLD, compact
+   *   state); no re-init() or reconvergence is needed.
+   * @param data Snapshot of size bytes
+   * @output False if data is not a valid snapshot for this filter's weight
+   *   mode; the filter is then unchanged
+   */
+  bool restoreState(const char* data, size_t size);
+
+  /**
+   * reset Forgets the particle set, so that the next init() starts over.
+   */
+  void reset();
+
+  /**
+   * getParticle Gathers particle i out of the particle set.
+   * @param i Index of the particle
+   */
+  Particle getParticle(int i) const;
+
+  // Set of current particles. With setCompactState() it still holds the
+  //   weighted set between resample() and the next prediction() or
+  //   updateWeights; getParticle() reads the survivors.
+  ParticleSet particles;
 
  private:
   // Number of particles to draw
@@ -120,6 +414,147 @@ class ParticleFilter {
 
   // Vector of weights of all particles
   std::vector<double> weights;
+
+  // Weighting mode of updateWeights
+  WeightMode weight_mode;
+
+  // Per-particle log-weights of the last update in LOG_WEIGHTS mode
+  std::vector<double> log_weights;
+
+  // Nearest-neighbor search of the association step
+  AssociationMethod association_method;
+
+  // Cache of in-range landmark candidates and each particle's entry in it
+  bool range_cache_enabled;
+  RangeCache range_cache;
+  std::vector<int> particle_cells;
+
+  // Resampling scheme of resample()
+  ResampleMethod resample_method;
+
+  // Back buffer resample() gathers into before swapping with particles
+  ParticleSet resampled;
+
+  // Ancestor indices and random draws reused across resample() calls
+  std::vector<int> resample_idx;
+  std::vector<double> resample_u;
+
+  // Particle count of init() when not adapting
+  int initial_particles;
+
+  // KLD-sampling state
+  bool kld_enabled;
+  KldParams kld_params;
+  KldBinCounter kld_bins;
+
+  // Association gating and early termination of updateWeights
+  bool gating_enabled;
+  GatingParams gating_params;
+
+  // ESS-gated resampling state
+  bool ess_gating;
+  double ess_fraction;
+  bool carry_weights;  // Last resample() was skipped, weights are the prior
+  unsigned long skipped_resamples;
+
+  // Random state: the seed, the number of addNoise calls since seeding
+  //   and the generator of resample()
+  uint64_t random_seed;
+  unsigned long noise_frame;
+  Xoshiro256 rng;
+
+  // Statistics of the last updateWeights, gathered per block of particles;
+  //   has_stats is cleared once resample() redraws the weights
+  ParticleStats weight_stats;
+  std::vector<StatsAccumulator> stats_blocks;
+  bool has_stats;
+
+  // Some batches of the current frame were folded without finishing it
+  bool pending_weights;
+
+  // Weighs the particles by observations on top of the pending batches;
+  //   finish normalizes them and gathers the statistics in the same pass
+  void weighObservations(double sensor_range, double std_landmark[],
+                         const std::vector<LandmarkObs> &observations,
+                         const Map &map_landmarks, bool finish);
+
+  // Resets one stats accumulator per block, returns the block count
+  int resetStatsBlocks();
+
+  // Merges the block statistics into weight_stats and normalizes log weights
+  void finishStats(int num_blocks);
+
+  // Compact state: the survivors of the last resample() live only in
+  //   compact while compact_current is set, and their weights until the
+  //   next weighting pass replaces them while compact_weights is set.
+  //   weight_log_norm is the log normalizer of the last log-domain weights.
+  bool compact_state;
+  CompactParticleSet compact;
+  bool compact_current;
+  bool compact_weights;
+  double weight_log_norm;
+
+  // Moves the compact particles and restores their poses to full precision
+  void predictCompact(double delta_t, const double std_pos[], double velocity,
+                      double yaw_rate);
+
+  // Restores the compact particles and weights without moving them
+  void unpackCompact();
+
+  // Sizes the per-particle buffers for the largest set the filter may hold
+  void reserveBuffers();
+
+  // Adds Gaussian noise of std[] (x, y, theta) to every particle
+  void addNoise(const double std[]);
+
+  // Resampling wheel, writes n_out ancestor indices to idx
+  void resampleWheel(int n_out, int* idx);
+
+  // Particle count for the next generation under KLD-sampling
+  int kldParticleCount();
+
+  // Whether association uses the k-d tree for sets of these sizes
+  bool useKdTree(int num_predicted, int num_observations) const;
+
+  // Worker pool for the per-particle loops, NULL when single-threaded
+  std::unique_ptr<ThreadPool> pool;
+
+  // Per-thread buffers reused by every updateWeights call
+  struct WeightScratch {
+    std::vector<int> in_range;
+    std::vector<LandmarkObs> predictions;
+    LandmarkKdTree tree;
+    std::vector<double> map_x;  // Observations transformed by one particle
+    std::vector<double> map_y;
+  };
+  std::vector<WeightScratch> weight_scratch;
+
+  // Fills scratch.in_range and scratch.predictions with the landmarks
+  //   within sensor_range of (x, y), from range cache entry cell if >= 0
+  void gatherPredictions(const Map& map_landmarks, double x, double y,
+                         double sensor_range, int cell,
+                         WeightScratch& scratch) const;
+
+  // Observations of the current frame and the heading sin/cos of every
+  //   particle, filled once per updateWeights
+  std::vector<double> obs_x;
+  std::vector<double> obs_y;
+  std::vector<double> particle_sin;
+  std::vector<double> particle_cos;
+
+  // Association debug state: the map, range, noise and observations of all
+  //   batches of the last frame and the particle debugParticle() fills
+  bool debug_associations;
+  const Map* debug_map;
+  double debug_range;
+  double debug_std[2];
+  std::vector<double> debug_obs_x;
+  std::vector<double> debug_obs_y;
+  Particle debug_particle;
+
+  // Runs fn(begin, end, chunk) over [0, n) on the pool, or inline
+  template <typename Fn>
+  void parallelFor(int n, const Fn& fn);
 };
 
 #endif  // PARTICLE_FILTER_H_
\ No newline at end of file
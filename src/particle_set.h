@@ -0,0 +1,48 @@
+/**
+ * particle_set.h
+ * Structure-of-arrays storage for the particles of a filter.
+ */
+
+#ifndef PARTICLE_SET_H_
+#define PARTICLE_SET_H_
+
+#include <vector>
+
+/**
+ * Contiguous per-field particle state. Element i of every array belongs to
+ *   particle i, so the motion and weighting loops stream through memory and
+ *   vectorize. Association debug data is kept in Particle, not here.
+ */
+struct ParticleSet {
+  std::vector<int> id;
+  std::vector<double> x;
+  std::vector<double> y;
+  std::vector<double> theta;
+  std::vector<double> weight;
+
+  int size() const {
+    return static_cast<int>(x.size());
+  }
+
+  void resize(int n) {
+    id.resize(n);
+    x.resize(n);
+    y.resize(n);
+    theta.resize(n);
+    weight.resize(n);
+  }
+
+  void reserve(int n) {
+    id.reserve(n);
+    x.reserve(n);
+    y.reserve(n);
+    theta.reserve(n);
+    weight.reserve(n);
+  }
+
+  void clear() {
+    resize(0);
+  }
+};
+
+#endif  // PARTICLE_SET_H_
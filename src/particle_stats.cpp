@@ -0,0 +1,88 @@
+/**
+ * particle_stats.cpp
+ * Weight statistics and pose moments of a weighted particle set.
+ */
+
+#include "particle_stats.h"
+
+#include <algorithm>
+
+void StatsAccumulator::rescale(double f) {
+  sw *= f;
+  sw2 *= f * f;
+  sx *= f;
+  sy *= f;
+  st *= f;
+  sxx *= f;
+  syy *= f;
+  stt *= f;
+  sxy *= f;
+  sxt *= f;
+  syt *= f;
+  if (best_id >= 0) {
+    max_w *= f;
+  }
+}
+
+void StatsAccumulator::merge(const StatsAccumulator& other) {
+  if (other.best_id < 0) {
+    return;
+  }
+  if (best_id < 0) {
+    *this = other;
+    return;
+  }
+
+  // Bring both to the larger unit
+  double scale = std::max(log_scale, other.log_scale);
+  double f = exp(other.log_scale - scale);
+  rescale(exp(log_scale - scale));
+  log_scale = scale;
+
+  sw += f * other.sw;
+  sw2 += f * f * other.sw2;
+  sx += f * other.sx;
+  sy += f * other.sy;
+  st += f * other.st;
+  sxx += f * other.sxx;
+  syy += f * other.syy;
+  stt += f * other.stt;
+  sxy += f * other.sxy;
+  sxt += f * other.sxt;
+  syt += f * other.syt;
+  if (f * other.max_w > max_w) {
+    max_w = f * other.max_w;
+    best_id = other.best_id;
+    best_x = other.best_x;
+    best_y = other.best_y;
+    best_theta = other.best_theta;
+  }
+}
+
+void StatsAccumulator::finish(double normalizer, ParticleStats& stats) const {
+  stats = ParticleStats();
+  stats.best_id = best_id;
+  stats.best_x = best_x;
+  stats.best_y = best_y;
+  stats.best_theta = best_theta;
+  if (best_id < 0 || !(sw > 0.0)) {
+    return;
+  }
+  stats.max_weight = max_w / normalizer;
+  stats.weight_sum = sw / normalizer;
+  stats.ess = sw * sw / sw2;
+
+  // Moments about the reference pose, then shifted to the mean
+  double mx = sx / sw;
+  double my = sy / sw;
+  double mt = st / sw;
+  stats.mean_x = rx + mx;
+  stats.mean_y = ry + my;
+  stats.mean_theta = rt + mt;
+  stats.covariance[0][0] = sxx / sw - mx * mx;
+  stats.covariance[1][1] = syy / sw - my * my;
+  stats.covariance[2][2] = stt / sw - mt * mt;
+  stats.covariance[0][1] = stats.covariance[1][0] = sxy / sw - mx * my;
+  stats.covariance[0][2] = stats.covariance[2][0] = sxt / sw - mx * mt;
+  stats.covariance[1][2] = stats.covariance[2][1] = syt / sw - my * mt;
+}
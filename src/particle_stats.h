@@ -0,0 +1,154 @@
+/**
+ * particle_stats.h
+ * Weight statistics and pose moments of a weighted particle set, gathered
+ * while updateWeights weighs the particles.
+ */
+
+#ifndef PARTICLE_STATS_H_
+#define PARTICLE_STATS_H_
+
+#include <math.h>
+
+/**
+ * Summary of the weighted set of the last updateWeights. Weights are
+ *   scaled like the filter's own: normalized to sum 1 in log mode, raw
+ *   likelihood products in linear mode.
+ */
+struct ParticleStats {
+  int best_id;        // Id of the highest-weight particle, -1 if none
+  double best_x;      // Pose of that particle
+  double best_y;
+  double best_theta;
+  double max_weight;  // Its weight
+  double weight_sum;  // Sum of all weights
+  double ess;         // Effective sample size, (sum w)^2 / sum w^2
+  double mean_x;      // Weighted mean pose
+  double mean_y;
+  double mean_theta;
+  double covariance[3][3];  // Weighted covariance of (x, y, theta)
+
+  ParticleStats()
+      : best_id(-1), best_x(0.0), best_y(0.0), best_theta(0.0),
+        max_weight(0.0), weight_sum(0.0), ess(0.0), mean_x(0.0),
+        mean_y(0.0), mean_theta(0.0) {
+    for (int r = 0; r < 3; ++r) {
+      for (int c = 0; c < 3; ++c) {
+        covariance[r][c] = 0.0;
+      }
+    }
+  }
+};
+
+/**
+ * Streaming accumulator behind ParticleStats. Poses are taken relative to
+ *   a reference pose (headings wrapped around it), so the single-pass
+ *   moments stay accurate far from the origin. Log weights are rescaled
+ *   online against the largest seen so far, as in log-sum-exp, which also
+ *   yields the normalizer of the weights without another pass.
+ */
+class StatsAccumulator {
+ public:
+  /**
+   * reset Clears the sums.
+   * @param log_domain Whether weights are added with addLog
+   * @param (ref_x,ref_y,ref_theta) Reference pose of the moments
+   */
+  void reset(bool log_domain, double ref_x, double ref_y, double ref_theta) {
+    log_scale = log_domain ? -INFINITY : 0.0;
+    rx = ref_x;
+    ry = ref_y;
+    rt = ref_theta;
+    sw = sw2 = 0.0;
+    sx = sy = st = 0.0;
+    sxx = syy = stt = sxy = sxt = syt = 0.0;
+    max_w = -1.0;
+    best_id = -1;
+    best_x = best_y = best_theta = 0.0;
+  }
+
+  /**
+   * add Adds a particle of linear weight w.
+   */
+  void add(double w, int id, double x, double y, double theta) {
+    if (w > max_w) {
+      max_w = w;
+      best_id = id;
+      best_x = x;
+      best_y = y;
+      best_theta = theta;
+    }
+    double dx = x - rx;
+    double dy = y - ry;
+    double dt = theta - rt;
+    if (fabs(dt) > M_PI) {
+      dt = remainder(dt, 2.0 * M_PI);
+    }
+    double wx = w * dx;
+    double wy = w * dy;
+    double wt = w * dt;
+    sw += w;
+    sw2 += w * w;
+    sx += wx;
+    sy += wy;
+    st += wt;
+    sxx += wx * dx;
+    syy += wy * dy;
+    stt += wt * dt;
+    sxy += wx * dy;
+    sxt += wx * dt;
+    syt += wy * dt;
+  }
+
+  /**
+   * addLog Adds a particle of log-weight lw.
+   */
+  void addLog(double lw, int id, double x, double y, double theta) {
+    if (lw == -INFINITY) {
+      return;
+    }
+    if (lw > log_scale) {
+      rescale(exp(log_scale - lw));
+      log_scale = lw;
+    }
+    add(exp(lw - log_scale), id, x, y, theta);
+  }
+
+  /**
+   * merge Adds the sums of other, which must share the reference pose.
+   */
+  void merge(const StatsAccumulator& other);
+
+  /**
+   * logScale Returns the log of the unit the sums are kept in; a weight
+   *   w contributes w * exp(-logScale()). Always 0 for linear weights.
+   */
+  double logScale() const {
+    return log_scale;
+  }
+
+  /**
+   * sum Returns the weight sum in units of exp(logScale()).
+   */
+  double sum() const {
+    return sw;
+  }
+
+  /**
+   * finish Writes the statistics, with weights divided by normalizer.
+   */
+  void finish(double normalizer, ParticleStats& stats) const;
+
+ private:
+  void rescale(double f);
+
+  double log_scale;
+  double rx, ry, rt;
+  double sw, sw2;
+  double sx, sy, st;
+  double sxx, syy, stt, sxy, sxt, syt;
+  double max_w;
+  int best_id;
+  double best_x, best_y, best_theta;
+};
+
+#endif  // PARTICLE_STATS_H_
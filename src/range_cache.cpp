@@ -0,0 +1,132 @@
+/**
+ * range_cache.cpp
+ * Cache of candidate landmark sets keyed on a coarse cell of the particle
+ * position, shared by all particles in the cell and across frames.
+ */
+
+#include "range_cache.h"
+
+#include <math.h>
+
+namespace {
+
+uint64_t cellKey(int64_t cx, int64_t cy) {
+  return (static_cast<uint64_t>(cx) << 32) ^ (static_cast<uint64_t>(cy) & 0xFFFFFFFFULL);
+}
+
+size_t hashKey(uint64_t key) {
+  return static_cast<size_t>((key * 0x9E3779B97F4A7C15ULL) >> 32);
+}
+
+}  // namespace
+
+RangeCache::RangeCache(double cell_size)
+    : cell_size(cell_size), map(NULL), map_revision(0), range(0.0), frame(0),
+      live_count(0), hit_count(0), miss_count(0) {
+  rebuildIndex();
+}
+
+void RangeCache::setCellSize(double size) {
+  cell_size = size;
+  clear();
+}
+
+void RangeCache::clear() {
+  free_list.clear();
+  for (size_t e = 0; e < entries.size(); ++e) {
+    entries[e].live = false;
+    free_list.push_back(e);
+  }
+  live_count = 0;
+  rebuildIndex();
+}
+
+void RangeCache::beginFrame(const Map& m, double sensor_range) {
+  ++frame;
+  if (&m != map || m.revision() != map_revision || sensor_range != range) {
+    map = &m;
+    map_revision = m.revision();
+    range = sensor_range;
+    clear();
+    return;
+  }
+
+  // Lazy invalidation: cells the particle cloud has left get recycled
+  bool evicted = false;
+  for (size_t e = 0; e < entries.size(); ++e) {
+    if (entries[e].live && entries[e].last_used + 1 < frame) {
+      entries[e].live = false;
+      free_list.push_back(e);
+      live_count--;
+      evicted = true;
+    }
+  }
+  if (evicted) {
+    rebuildIndex();
+  }
+}
+
+void RangeCache::rebuildIndex() {
+  size_t capacity = 16;
+  while (capacity < 2 * static_cast<size_t>(live_count) + 2) {
+    capacity <<= 1;
+  }
+  table.assign(capacity, -1);
+  for (size_t e = 0; e < entries.size(); ++e) {
+    if (entries[e].live) {
+      table[findSlot(entries[e].key)] = e;
+    }
+  }
+}
+
+size_t RangeCache::findSlot(uint64_t key) const {
+  const size_t mask = table.size() - 1;
+  size_t slot = hashKey(key) & mask;
+  while (table[slot] >= 0 && entries[table[slot]].key != key) {
+    slot = (slot + 1) & mask;
+  }
+  return slot;
+}
+
+int RangeCache::lookup(double x, double y) {
+  int64_t cx = static_cast<int64_t>(floor(x / cell_size));
+  int64_t cy = static_cast<int64_t>(floor(y / cell_size));
+  uint64_t key = cellKey(cx, cy);
+
+  size_t slot = findSlot(key);
+  if (table[slot] >= 0) {
+    hit_count++;
+    entries[table[slot]].last_used = frame;
+    return table[slot];
+  }
+  miss_count++;
+
+  int id;
+  if (!free_list.empty()) {
+    id = free_list.back();
+    free_list.pop_back();
+  } else {
+    id = entries.size();
+    entries.push_back(Entry());
+  }
+  Entry& entry = entries[id];
+  entry.key = key;
+  entry.last_used = frame;
+  entry.live = true;
+  entry.landmarks.clear();
+
+  // Conservative padding: the farthest point of the cell from its center,
+  //   plus a margin for rounding in the cell computation
+  double center_x = (cx + 0.5) * cell_size;
+  double center_y = (cy + 0.5) * cell_size;
+  double pad = 0.5 * sqrt(2.0) * cell_size + 1e-6;
+  map->queryRange(center_x, center_y, range + pad, entry.landmarks);
+
+  live_count++;
+  if (2 * static_cast<size_t>(live_count) + 2 > table.size()) {
+    rebuildIndex();
+  } else {
+    table[slot] = id;
+  }
+  return id;
+}
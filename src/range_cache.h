@@ -0,0 +1,85 @@
+/**
+ * range_cache.h
+ * Cache of candidate landmark sets keyed on a coarse cell of the particle
+ * position, shared by all particles in the cell and across frames.
+ *
+ * An entry holds every landmark within sensor_range + half the cell
+ * diagonal of the cell center, which is a superset of the in-range set of
+ * any position inside the cell. Callers filter the candidates with the
+ * exact range test, so results match an uncached Map::queryRange.
+ */
+
+#ifndef RANGE_CACHE_H_
+#define RANGE_CACHE_H_
+
+#include <stdint.h>
+#include <vector>
+#include "map.h"
+
+class RangeCache {
+ public:
+  explicit RangeCache(double cell_size = 2.0);
+
+  /**
+   * setCellSize Changes the cell edge length [m] and drops all entries.
+   */
+  void setCellSize(double cell_size);
+
+  /**
+   * beginFrame Starts a frame. Drops everything if the map or range
+   *   changed, and otherwise evicts entries no particle has used in the
+   *   last frame.
+   * @param map Map the candidates are gathered from
+   * @param sensor_range Range [m] of sensor
+   */
+  void beginFrame(const Map& map, double sensor_range);
+
+  /**
+   * lookup Returns the entry for the cell containing (x, y), gathering
+   *   its candidates on a miss. Not thread-safe.
+   */
+  int lookup(double x, double y);
+
+  /**
+   * candidates Returns the landmark_list indices of an entry.
+   */
+  const std::vector<int>& candidates(int entry) const {
+    return entries[entry].landmarks;
+  }
+
+  // Lookup statistics since construction
+  uint64_t hits() const {
+    return hit_count;
+  }
+  uint64_t misses() const {
+    return miss_count;
+  }
+
+ private:
+  struct Entry {
+    uint64_t key;
+    unsigned long last_used;  // Frame the entry was last looked up in
+    bool live;
+    std::vector<int> landmarks;
+  };
+
+  void clear();
+  void rebuildIndex();
+  size_t findSlot(uint64_t key) const;
+
+  double cell_size;
+  const Map* map;
+  unsigned long map_revision;
+  double range;
+  unsigned long frame;
+
+  std::vector<Entry> entries;    // Pool; dead entries keep their storage
+  std::vector<int> free_list;    // Dead entry ids
+  std::vector<int> table;        // Open addressing: entry id or -1
+  int live_count;
+
+  uint64_t hit_count;
+  uint64_t miss_count;
+};
+
+#endif  // RANGE_CACHE_H_
@@ -0,0 +1,643 @@
+/**
+ * replay.cpp
+ * Offline driver: streams a recorded drive through the particle filter as
+ * fast as possible and reports per-stage latency, throughput and accuracy.
+ *
+ * Usage: pf_replay [options] <log_dir>
+ *   --map FILE        Map file: text, binary or tiled (default
+ *                     ../data/map_data.txt)
+ *   --tile-memory MB  Resident tile cap for a tiled map (default 64)
+ *   --synthesize N    Write a synthetic N-frame drive to log_dir first
+ *   --particles N     Fixed particle count instead of KLD-sampling
+ *   --threads N       Threads used by the filter
+ *   --seed N          Seed of the filter's random draws (default 0)
+ *   --metrics         Print the metrics snapshot in Prometheus format
+ *   --compact         Keep resampled particles in the compact state
+ *   --gating          Gate outlier associations and stop weighing
+ *                     hopeless particles early (GatingParams defaults)
+ *   --batches N       Deliver each frame's observations in N batches,
+ *                     folded into the weights one at a time
+ *   --restart N       Every N frames, snapshot the filter to
+ *                     log_dir/snapshot.bin, reset it and restore it from
+ *                     the file; results are the same as without
+ *   --fleet K         Localize K trajectories at once through FilterBatch:
+ *                     prefixes of the drive from half to full length, each
+ *                     with its own seed and GPS fix
+ *   --template T      Run BasicParticleFilter<T> (float or double) with
+ *                     --particles particles, 512 by default, instead
+ *   --gpu N           Run N particles on the CUDA backend instead (builds
+ *                     with -DPF_ENABLE_CUDA=ON only)
+ *   --global          With --gpu, start spread over the whole map
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "alloc_counter.h"
+#include "basic_particle_filter.h"
+#include "filter_batch.h"
+#include "filter_snapshot.h"
+#ifdef PF_HAVE_CUDA
+#include "gpu_filter.h"
+#endif
+#include "metrics.h"
+#include "particle_filter.h"
+#include "sim_data.h"
+#include "tiled_map.h"
+
+using std::string;
+using std::vector;
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+double elapsedUs(Clock::time_point start, Clock::time_point end) {
+  return std::chrono::duration<double, std::micro>(end - start).count();
+}
+
+// Returns the p-th percentile (0..100) of samples, reordering them
+double percentile(vector<double>& samples, double p) {
+  if (samples.empty()) {
+    return 0.0;
+  }
+  size_t k = static_cast<size_t>(p / 100.0 * (samples.size() - 1) + 0.5);
+  std::nth_element(samples.begin(), samples.begin() + k, samples.end());
+  return samples[k];
+}
+
+void printStage(const char* name, vector<double> samples) {
+  double p50 = percentile(samples, 50);
+  double p90 = percentile(samples, 90);
+  double p99 = percentile(samples, 99);
+  double max = percentile(samples, 100);
+  printf("  %-14s %10.1f %10.1f %10.1f %10.1f\n", name, p50, p90, p99, max);
+}
+
+void usage() {
+  std::cerr << "Usage: pf_replay [--map FILE] [--tile-memory MB] [--synthesize N] "
+            << "[--particles N] [--threads N] [--seed N] [--metrics] "
+            << "[--compact] [--gating] [--batches N] [--restart N] [--fleet K] "
+            << "[--template float|double] [--gpu N [--global]] "
+            << "<log_dir>"
+            << std::endl;
+}
+
+#ifdef PF_HAVE_CUDA
+// Replays the drive on the CUDA backend; reports throughput and the
+//   accuracy of the weighted mean pose
+int replayGpu(const DriveLog& drive, const Map& map, int num_particles,
+              bool global, unsigned long long seed, double delta_t,
+              double sensor_range, double sigma_pos[],
+              double sigma_landmark[]) {
+  if (!GpuParticleFilter::available()) {
+    std::cout << "Error: no CUDA device" << std::endl;
+    return -1;
+  }
+  GpuParticleFilter pf(num_particles);
+  pf.setSeed(seed);
+  if (!pf.setMap(map)) {
+    std::cout << "Error: " << pf.error() << std::endl;
+    return -1;
+  }
+
+  int frames = drive.size();
+  double total_error[3] = {0.0, 0.0, 0.0};
+  Clock::time_point start = Clock::now();
+  for (int i = 0; i < frames && pf.ok(); ++i) {
+    if (!pf.initialized()) {
+      if (global) {
+        pf.initUniform();
+      } else {
+        pf.init(drive.gt[i].x, drive.gt[i].y, drive.gt[i].theta, sigma_pos);
+      }
+    } else {
+      pf.prediction(delta_t, sigma_pos, drive.controls[i - 1].velocity,
+                    drive.controls[i - 1].yawrate);
+    }
+    pf.updateWeights(sensor_range, sigma_landmark, drive.observations[i]);
+    pf.resample();
+
+    const ParticleStats& stats = pf.stats();
+    double* error = getError(drive.gt[i].x, drive.gt[i].y, drive.gt[i].theta,
+                             stats.mean_x, stats.mean_y, stats.mean_theta);
+    for (int k = 0; k < 3; ++k) {
+      total_error[k] += error[k];
+    }
+  }
+  if (!pf.ok()) {
+    std::cout << "Error: " << pf.error() << std::endl;
+    return -1;
+  }
+  double us = elapsedUs(start, Clock::now());
+  printf("gpu: frames %d, particles %d\n", frames, num_particles);
+  printf("throughput %.1f frames/s\n", frames / (us * 1e-6));
+  printf("mean pose error x %.4f y %.4f yaw %.4f\n", total_error[0] / frames,
+         total_error[1] / frames, total_error[2] / frames);
+  return 0;
+}
+#endif
+
+// Localizes num_filters trajectories of different lengths in lockstep;
+//   reports throughput and the accuracy of the best particles
+int replayFleet(const DriveLog& drive, const Map& map, int num_filters,
+                int num_threads, int num_particles, bool compact,
+                unsigned long long seed, const BatchConfig& config,
+                double max_translation_error, double max_yaw_error) {
+  FilterBatch batch(map, config, num_threads);
+  batch.resize(num_filters);
+  vector<int> lengths(num_filters);
+  int frames = drive.size();
+  for (int k = 0; k < num_filters; ++k) {
+    ParticleFilter& pf = batch.filter(k);
+    pf.setSeed(seed + k);
+    pf.setWeightMode(ParticleFilter::LOG_WEIGHTS);
+    pf.setResampleMethod(ParticleFilter::SYSTEMATIC_RESAMPLING);
+    if (num_particles > 0) {
+      pf.setNumParticles(num_particles);
+    } else {
+      pf.setKldSampling(true);
+    }
+    pf.setEssGating(true);
+    pf.setRangeCache(true);
+    pf.setCompactState(compact);
+    lengths[k] = frames - frames / 2 * k / num_filters;
+  }
+
+  std::default_random_engine gen;
+  std::normal_distribution<double> n_x(0.0, config.sigma_pos[0]);
+  std::normal_distribution<double> n_y(0.0, config.sigma_pos[1]);
+  std::normal_distribution<double> n_theta(0.0, config.sigma_pos[2]);
+
+  vector<FilterInput> inputs(num_filters);
+  double total_error[3] = {0.0, 0.0, 0.0};
+  long filter_frames = 0;
+  long particle_frames = 0;
+  double filter_us = 0.0;
+  for (int i = 0; i < frames; ++i) {
+    for (int k = 0; k < num_filters; ++k) {
+      FilterInput& input = inputs[k];
+      input.active = i < lengths[k];
+      input.init = i == 0;
+      if (input.init) {
+        input.x = drive.gt[i].x + n_x(gen);
+        input.y = drive.gt[i].y + n_y(gen);
+        input.theta = drive.gt[i].theta + n_theta(gen);
+      } else {
+        input.velocity = drive.controls[i - 1].velocity;
+        input.yaw_rate = drive.controls[i - 1].yawrate;
+      }
+      input.observations = &drive.observations[i];
+    }
+    Clock::time_point t0 = Clock::now();
+    batch.step(inputs);
+    filter_us += elapsedUs(t0, Clock::now());
+
+    for (int k = 0; k < num_filters; ++k) {
+      if (!inputs[k].active) {
+        continue;
+      }
+      const ParticleStats& stats = batch.filter(k).stats();
+      double* error = getError(drive.gt[i].x, drive.gt[i].y,
+                               drive.gt[i].theta, stats.best_x, stats.best_y,
+                               stats.best_theta);
+      for (int c = 0; c < 3; ++c) {
+        total_error[c] += error[c];
+      }
+      filter_frames++;
+      particle_frames += batch.filter(k).size();
+    }
+  }
+
+  printf("fleet: filters %d, filter frames %ld, mean particles %.1f, "
+         "threads %d, steals %lu\n", num_filters, filter_frames,
+         static_cast<double>(particle_frames) / filter_frames,
+         batch.numThreads(), batch.steals());
+  printf("throughput %.1f filter frames/s\n",
+         filter_frames / (filter_us * 1e-6));
+  printf("mean error x %.4f y %.4f yaw %.4f\n", total_error[0] / filter_frames,
+         total_error[1] / filter_frames, total_error[2] / filter_frames);
+  if (total_error[0] / filter_frames > max_translation_error ||
+      total_error[1] / filter_frames > max_translation_error ||
+      total_error[2] / filter_frames > max_yaw_error) {
+    std::cout << "Error: accuracy outside of the allowed bounds" << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+// Replays the drive on BasicParticleFilter<Scalar>, whose noise is the
+//   compile-time DefaultNoise (the values below); reports per-stage
+//   latency and the accuracy of the best particle
+template <typename Scalar>
+int replayBasic(const DriveLog& drive, const Map& map, const char* name,
+                int num_particles, unsigned long long seed, double delta_t,
+                double sensor_range, double sigma_pos[],
+                double max_translation_error, double max_yaw_error) {
+  BasicParticleFilter<Scalar> pf(num_particles);
+  pf.setSeed(seed);
+
+  std::default_random_engine gen;
+  std::normal_distribution<double> n_x(0.0, sigma_pos[0]);
+  std::normal_distribution<double> n_y(0.0, sigma_pos[1]);
+  std::normal_distribution<double> n_theta(0.0, sigma_pos[2]);
+
+  int frames = drive.size();
+  vector<double> t_predict, t_update, t_resample, t_frame;
+  t_predict.reserve(frames);
+  t_update.reserve(frames);
+  t_resample.reserve(frames);
+  t_frame.reserve(frames);
+  double total_error[3] = {0.0, 0.0, 0.0};
+  double filter_us = 0.0;
+  for (int i = 0; i < frames; ++i) {
+    Clock::time_point t0 = Clock::now();
+    if (!pf.initialized()) {
+      pf.init(drive.gt[i].x + n_x(gen), drive.gt[i].y + n_y(gen),
+              drive.gt[i].theta + n_theta(gen));
+    } else {
+      pf.prediction(delta_t, drive.controls[i - 1].velocity,
+                    drive.controls[i - 1].yawrate);
+    }
+    Clock::time_point t1 = Clock::now();
+    pf.updateWeights(sensor_range, drive.observations[i], map);
+    Clock::time_point t2 = Clock::now();
+    pf.resample();
+    Clock::time_point t3 = Clock::now();
+
+    if (i > 0) {
+      t_predict.push_back(elapsedUs(t0, t1));
+    }
+    t_update.push_back(elapsedUs(t1, t2));
+    t_resample.push_back(elapsedUs(t2, t3));
+    t_frame.push_back(elapsedUs(t0, t3));
+    filter_us += elapsedUs(t0, t3);
+
+    const ParticleStats& stats = pf.stats();
+    double* error = getError(drive.gt[i].x, drive.gt[i].y, drive.gt[i].theta,
+                             stats.best_x, stats.best_y, stats.best_theta);
+    for (int k = 0; k < 3; ++k) {
+      total_error[k] += error[k];
+    }
+  }
+
+  printf("template %s: frames %d, particles %d\n", name, frames, pf.size());
+  printf("  %-14s %10s %10s %10s %10s\n", "stage [us]", "p50", "p90", "p99",
+         "max");
+  printStage("prediction", t_predict);
+  printStage("updateWeights", t_update);
+  printStage("resample", t_resample);
+  printStage("frame", t_frame);
+  printf("throughput %.1f frames/s\n", frames / (filter_us * 1e-6));
+  printf("mean error x %.4f y %.4f yaw %.4f\n", total_error[0] / frames,
+         total_error[1] / frames, total_error[2] / frames);
+  if (total_error[0] / frames > max_translation_error ||
+      total_error[1] / frames > max_translation_error ||
+      total_error[2] / frames > max_yaw_error) {
+    std::cout << "Error: accuracy outside of the allowed bounds" << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  // Set up parameters here, matching main.cpp
+  double delta_t = 0.1;  // Time elapsed between measurements [sec]
+  double sensor_range = 50;  // Sensor range [m]
+  int num_threads = 1;  // Threads used to weigh the particles
+  int num_particles = 0;  // Fixed particle count, 0 for KLD-sampling
+  unsigned long long seed = 0;  // Seed of the filter's random draws
+
+  // GPS measurement uncertainty [x [m], y [m], theta [rad]]
+  double sigma_pos[3] = {0.3, 0.3, 0.01};
+  // Landmark measurement uncertainty [x [m], y [m]]
+  double sigma_landmark[2] = {0.3, 0.3};
+
+  // Accuracy the filter has to reach on average
+  double max_translation_error = 1.0;  // [m]
+  double max_yaw_error = 0.05;  // [rad]
+
+  string map_file = "../data/map_data.txt";
+  string log_dir;
+  int synthesize = 0;
+  bool print_metrics = false;
+  int batches = 1;  // Observation batches per frame
+  int restart = 0;  // Frames between snapshot round trips, 0 for none
+  int fleet = 0;  // Trajectories localized by one FilterBatch, 0 for one filter
+  bool compact = false;  // Compact particle state
+  bool gating = false;  // Association gating and early termination
+  string scalar;  // BasicParticleFilter scalar type, empty for ParticleFilter
+  double tile_memory = 64.0;  // [MB]
+  int gpu_particles = 0;  // Particles on the CUDA backend, 0 for the CPU
+#ifdef PF_HAVE_CUDA
+  bool gpu_global = false;  // Start the CUDA backend spread over the map
+#endif
+  for (int i = 1; i < argc; ++i) {
+    bool has_value = i + 1 < argc;
+    if (!strcmp(argv[i], "--map") && has_value) {
+      map_file = argv[++i];
+    } else if (!strcmp(argv[i], "--tile-memory") && has_value) {
+      tile_memory = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "--synthesize") && has_value) {
+      synthesize = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--particles") && has_value) {
+      num_particles = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--threads") && has_value) {
+      num_threads = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--seed") && has_value) {
+      seed = strtoull(argv[++i], NULL, 10);
+    } else if (!strcmp(argv[i], "--metrics")) {
+      print_metrics = true;
+    } else if (!strcmp(argv[i], "--compact")) {
+      compact = true;
+    } else if (!strcmp(argv[i], "--gating")) {
+      gating = true;
+    } else if (!strcmp(argv[i], "--template") && has_value) {
+      scalar = argv[++i];
+    } else if (!strcmp(argv[i], "--batches") && has_value) {
+      batches = std::max(1, atoi(argv[++i]));
+    } else if (!strcmp(argv[i], "--restart") && has_value) {
+      restart = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--fleet") && has_value) {
+      fleet = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--gpu") && has_value) {
+      gpu_particles = atoi(argv[++i]);
+#ifdef PF_HAVE_CUDA
+    } else if (!strcmp(argv[i], "--global")) {
+      gpu_global = true;
+#endif
+    } else if (argv[i][0] != '-' && log_dir.empty()) {
+      log_dir = argv[i];
+    } else {
+      usage();
+      return -1;
+    }
+  }
+  if (log_dir.empty()) {
+    usage();
+    return -1;
+  }
+
+  // Read map data; a tiled map is streamed around the particles instead
+  Map map;
+  TiledMap tiled_map;
+  bool tiled = TiledMap::isTiledMap(map_file);
+  if (tiled) {
+    if (!tiled_map.open(map_file)) {
+      std::cout << "Error: Could not open tiled map file" << std::endl;
+      return -1;
+    }
+    tiled_map.setMemoryLimit(static_cast<size_t>(tile_memory * (1 << 20)));
+    if (synthesize > 0) {
+      std::cout << "Error: --synthesize needs a text or binary map" << std::endl;
+      return -1;
+    }
+  } else if (!read_map_data(map_file, map)) {
+    std::cout << "Error: Could not open map file" << std::endl;
+    return -1;
+  }
+
+  if (synthesize > 0) {
+    DriveLog synthetic;
+    simulateDrive(map, synthesize, delta_t, sensor_range, sigma_landmark, 1,
+                  synthetic);
+    if (!writeDriveLog(log_dir, synthetic)) {
+      std::cout << "Error: Could not write drive log to " << log_dir << std::endl;
+      return -1;
+    }
+  }
+
+  DriveLog drive;
+  if (!readDriveLog(log_dir, drive) || drive.size() == 0 ||
+      drive.controls.size() < drive.gt.size()) {
+    std::cout << "Error: Could not read drive log from " << log_dir << std::endl;
+    return -1;
+  }
+
+  if (gpu_particles > 0) {
+#ifdef PF_HAVE_CUDA
+    if (tiled) {
+      std::cout << "Error: --gpu needs a text or binary map" << std::endl;
+      return -1;
+    }
+    return replayGpu(drive, map, gpu_particles, gpu_global, seed, delta_t,
+                     sensor_range, sigma_pos, sigma_landmark);
+#else
+    std::cout << "Error: built without the CUDA backend (PF_ENABLE_CUDA)"
+              << std::endl;
+    return -1;
+#endif
+  }
+
+  if (!scalar.empty()) {
+    if (tiled) {
+      std::cout << "Error: --template needs a text or binary map" << std::endl;
+      return -1;
+    }
+    int n = num_particles > 0 ? num_particles : 512;
+    if (scalar == "float") {
+      return replayBasic<float>(drive, map, "float", n, seed, delta_t,
+                                sensor_range, sigma_pos, max_translation_error,
+                                max_yaw_error);
+    }
+    if (scalar == "double") {
+      return replayBasic<double>(drive, map, "double", n, seed, delta_t,
+                                 sensor_range, sigma_pos,
+                                 max_translation_error, max_yaw_error);
+    }
+    usage();
+    return -1;
+  }
+
+  if (fleet > 0) {
+    if (tiled) {
+      std::cout << "Error: --fleet needs a text or binary map" << std::endl;
+      return -1;
+    }
+    BatchConfig config;
+    config.delta_t = delta_t;
+    config.sensor_range = sensor_range;
+    std::copy(sigma_pos, sigma_pos + 3, config.sigma_pos);
+    std::copy(sigma_landmark, sigma_landmark + 2, config.sigma_landmark);
+    return replayFleet(drive, map, fleet, num_threads, num_particles, compact,
+                       seed, config, max_translation_error, max_yaw_error);
+  }
+
+  // Create particle filter, configured like main.cpp
+  ParticleFilter pf;
+  pf.setNumThreads(num_threads);
+  pf.setSeed(seed);
+  pf.setWeightMode(ParticleFilter::LOG_WEIGHTS);
+  pf.setResampleMethod(ParticleFilter::SYSTEMATIC_RESAMPLING);
+  if (num_particles > 0) {
+    pf.setNumParticles(num_particles);
+  } else {
+    pf.setKldSampling(true);
+  }
+  pf.setEssGating(true);
+  pf.setRangeCache(true);
+  pf.setCompactState(compact);
+  pf.setGating(gating);
+
+  // Noisy GPS fix for the first frame
+  std::default_random_engine gen;
+  std::normal_distribution<double> n_x(0.0, sigma_pos[0]);
+  std::normal_distribution<double> n_y(0.0, sigma_pos[1]);
+  std::normal_distribution<double> n_theta(0.0, sigma_pos[2]);
+
+  int frames = drive.size();
+  vector<double> t_predict, t_update, t_resample, t_frame;
+  t_predict.reserve(frames);
+  t_update.reserve(frames);
+  t_resample.reserve(frames);
+  t_frame.reserve(frames);
+
+  double total_error[3] = {0.0, 0.0, 0.0};
+  double max_error[3] = {0.0, 0.0, 0.0};
+  double total_mean_error[3] = {0.0, 0.0, 0.0};
+  long particle_frames = 0;
+  unsigned long steady_allocs = 0;
+  double filter_us = 0.0;
+  // Sized for the largest frame, so the batch copies never allocate
+  vector<LandmarkObs> batch;
+  size_t max_observations = 0;
+  for (int i = 0; i < frames; ++i) {
+    max_observations =
+        std::max(max_observations, drive.observations[i].size());
+  }
+  batch.reserve(max_observations);
+  string snapshot_file = log_dir + "/snapshot.bin";
+  vector<char> snapshot;
+  vector<double> t_restore;
+
+  for (int i = 0; i < frames; ++i) {
+    unsigned long allocs_before = alloc_counter::count();
+    Clock::time_point t0 = Clock::now();
+    double velocity = 0.0;
+    double yaw_rate = 0.0;
+    if (!pf.initialized()) {
+      pf.init(drive.gt[i].x + n_x(gen), drive.gt[i].y + n_y(gen),
+              drive.gt[i].theta + n_theta(gen), sigma_pos);
+    } else {
+      velocity = drive.controls[i - 1].velocity;
+      yaw_rate = drive.controls[i - 1].yawrate;
+      pf.prediction(delta_t, sigma_pos, velocity, yaw_rate);
+    }
+    Clock::time_point t1 = Clock::now();
+    const Map& frame_map = tiled
+        ? tiled_map.focus(pf.particles, sensor_range, velocity, yaw_rate)
+        : map;
+    // All but the last batch are folded in as they arrive
+    const vector<LandmarkObs>& observations = drive.observations[i];
+    size_t first = 0;
+    for (int b = 1; b < batches; ++b) {
+      size_t last = observations.size() * b / batches;
+      batch.assign(observations.begin() + first, observations.begin() + last);
+      pf.foldObservations(sensor_range, sigma_landmark, batch, frame_map);
+      first = last;
+    }
+    batch.assign(observations.begin() + first, observations.end());
+    pf.updateWeights(sensor_range, sigma_landmark, batch, frame_map);
+    Clock::time_point t2 = Clock::now();
+    pf.resample();
+    Clock::time_point t3 = Clock::now();
+
+    // Warm-up frames grow the buffers; later frames still allocate when
+    //   a buffer passes its high-water mark (more observations or
+    //   landmarks in range than any frame before)
+    if (i >= 10) {
+      steady_allocs += alloc_counter::count() - allocs_before;
+    }
+
+    // Restart from a snapshot file, as after a failover
+    if (restart > 0 && (i + 1) % restart == 0) {
+      pf.saveState(snapshot);
+      if (!writeSnapshotFile(snapshot_file, snapshot) ||
+          !readSnapshotFile(snapshot_file, snapshot)) {
+        std::cout << "Error: Could not write snapshot " << snapshot_file
+                  << std::endl;
+        return -1;
+      }
+      pf.reset();
+      Clock::time_point t4 = Clock::now();
+      if (!pf.restoreState(snapshot.data(), snapshot.size())) {
+        std::cout << "Error: Could not restore snapshot" << std::endl;
+        return -1;
+      }
+      t_restore.push_back(elapsedUs(t4, Clock::now()));
+    }
+
+    if (i > 0) {
+      t_predict.push_back(elapsedUs(t0, t1));
+    }
+    t_update.push_back(elapsedUs(t1, t2));
+    t_resample.push_back(elapsedUs(t2, t3));
+    t_frame.push_back(elapsedUs(t0, t3));
+    filter_us += elapsedUs(t0, t3);
+    particle_frames += pf.size();
+
+    // Accuracy of the best particle and of the weighted mean
+    const ParticleStats& stats = pf.stats();
+    double* error = getError(drive.gt[i].x, drive.gt[i].y, drive.gt[i].theta,
+                             stats.best_x, stats.best_y, stats.best_theta);
+    for (int k = 0; k < 3; ++k) {
+      total_error[k] += error[k];
+      max_error[k] = std::max(max_error[k], error[k]);
+    }
+    error = getError(drive.gt[i].x, drive.gt[i].y, drive.gt[i].theta,
+                     stats.mean_x, stats.mean_y, stats.mean_theta);
+    for (int k = 0; k < 3; ++k) {
+      total_mean_error[k] += error[k];
+    }
+  }
+
+  printf("frames %d, mean particles %.1f, threads %d, skipped resamples %lu\n",
+         frames, static_cast<double>(particle_frames) / frames,
+         pf.numThreads(), pf.skippedResamples());
+  printf("  %-14s %10s %10s %10s %10s\n", "stage [us]", "p50", "p90", "p99", "max");
+  printStage("prediction", t_predict);
+  printStage("updateWeights", t_update);
+  printStage("resample", t_resample);
+  printStage("frame", t_frame);
+  if (!t_restore.empty()) {
+    printStage("restore", t_restore);
+    printf("snapshot %zu bytes\n", snapshot.size());
+  }
+  printf("throughput %.1f frames/s\n", frames / (filter_us * 1e-6));
+  printf("mean error x %.4f y %.4f yaw %.4f\n", total_error[0] / frames,
+         total_error[1] / frames, total_error[2] / frames);
+  printf("max error  x %.4f y %.4f yaw %.4f\n", max_error[0], max_error[1],
+         max_error[2]);
+  printf("mean pose error x %.4f y %.4f yaw %.4f\n", total_mean_error[0] / frames,
+         total_mean_error[1] / frames, total_mean_error[2] / frames);
+  if (tiled) {
+    printf("tiles: %lu demand loads, %lu prefetched, %lu failed, %lu evicted, "
+           "%.1f KB resident\n",
+           tiled_map.demandLoads(), tiled_map.prefetchLoads(),
+           tiled_map.failedLoads(), tiled_map.evictions(),
+           tiled_map.residentBytes() / 1024.0);
+  }
+  if (alloc_counter::enabled()) {
+    printf("allocations after warm-up %lu\n", steady_allocs);
+  }
+  if (print_metrics) {
+    printf("%s", metrics::formatPrometheus(metrics::snapshot()).c_str());
+  }
+
+  if (total_error[0] / frames > max_translation_error ||
+      total_error[1] / frames > max_translation_error ||
+      total_error[2] / frames > max_yaw_error) {
+    std::cout << "Error: accuracy outside of the allowed bounds" << std::endl;
+    return 1;
+  }
+  return 0;
+}
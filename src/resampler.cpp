@@ -0,0 +1,90 @@
+/**
+ * resampler.cpp
+ * O(N) resampling schemes that turn particle weights into ancestor indices.
+ */
+
+#include "resampler.h"
+
+#include <math.h>
+
+namespace {
+
+double weightSum(const double* w, int n) {
+  double sum = 0.0;
+  for (int i = 0 ; i < n ; i++) {
+    sum += w[i];
+  }
+  return sum;
+}
+
+void uniformResample(int n_in, int n_out, int* out) {
+  for (int j = 0 ; j < n_out ; j++) {
+    out[j] = static_cast<int>(static_cast<long long>(j) * n_in / n_out);
+  }
+}
+
+// Walks the cumulative weights once for the increasing positions
+//   (j + u[j]) * step, so the cost is O(n_in + n_out).
+void cumulativeWalk(const double* w, int n_in, int n_out, double step,
+                    const double* u, bool shared_u, int* out) {
+  int i = 0;
+  double c = w[0];
+  for (int j = 0 ; j < n_out ; j++) {
+    double target = (j + (shared_u ? u[0] : u[j])) * step;
+    while (c < target && i < n_in - 1) {
+      c += w[++i];
+    }
+    out[j] = i;
+  }
+}
+
+}  // namespace
+
+void systematicResample(const double* w, int n_in, int n_out, double u,
+                        int* out) {
+  double sum = weightSum(w, n_in);
+  if (!(sum > 0.0)) {
+    uniformResample(n_in, n_out, out);
+    return;
+  }
+  cumulativeWalk(w, n_in, n_out, sum / n_out, &u, true, out);
+}
+
+void stratifiedResample(const double* w, int n_in, int n_out, const double* u,
+                        int* out) {
+  double sum = weightSum(w, n_in);
+  if (!(sum > 0.0)) {
+    uniformResample(n_in, n_out, out);
+    return;
+  }
+  cumulativeWalk(w, n_in, n_out, sum / n_out, u, false, out);
+}
+
+void residualResample(const double* w, int n_in, int n_out, double u,
+                      double* scratch, int* out) {
+  double sum = weightSum(w, n_in);
+  if (!(sum > 0.0)) {
+    uniformResample(n_in, n_out, out);
+    return;
+  }
+
+  // Deterministic copies, written in index order
+  double scale = n_out / sum;
+  int k = 0;
+  for (int i = 0 ; i < n_in ; i++) {
+    double expected = w[i] * scale;
+    int copies = static_cast<int>(floor(expected));
+    if (copies > n_out - k) {
+      copies = n_out - k;
+    }
+    for (int c = 0 ; c < copies ; c++) {
+      out[k++] = i;
+    }
+    scratch[i] = expected - copies;
+  }
+
+  // Remainder drawn from the fractional parts
+  if (k < n_out) {
+    systematicResample(scratch, n_in, n_out - k, u, out + k);
+  }
+}
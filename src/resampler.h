@@ -0,0 +1,44 @@
+/**
+ * resampler.h
+ * O(N) resampling schemes that turn particle weights into ancestor indices.
+ *
+ * All functions accept unnormalized, non-negative weights and write n_out
+ * indices into [0, n_in) to out. A set whose weights sum to zero is
+ * resampled uniformly.
+ */
+
+#ifndef RESAMPLER_H_
+#define RESAMPLER_H_
+
+/**
+ * systematicResample Low-variance resampling with a single random offset.
+ *   Indices come out in non-decreasing order.
+ * @param w Array of n_in weights
+ * @param n_in Number of weights
+ * @param n_out Number of indices to draw
+ * @param u Uniform random number in [0, 1)
+ * @param out Array of n_out ancestor indices
+ */
+void systematicResample(const double* w, int n_in, int n_out, double u,
+                        int* out);
+
+/**
+ * stratifiedResample Draws one index from each of n_out equal strata.
+ *   Indices come out in non-decreasing order.
+ * @param u Array of n_out uniform random numbers in [0, 1)
+ */
+void stratifiedResample(const double* w, int n_in, int n_out, const double* u,
+                        int* out);
+
+/**
+ * residualResample Copies floor(n_out * w_i) of each particle
+ *   deterministically and draws the remainder systematically from the
+ *   fractional parts. The deterministic copies come first, in index order,
+ *   followed by the remainder.
+ * @param u Uniform random number in [0, 1) for the remainder
+ * @param scratch Array of n_in doubles used for the residual weights
+ */
+void residualResample(const double* w, int n_in, int n_out, double u,
+                      double* scratch, int* out);
+
+#endif  // RESAMPLER_H_
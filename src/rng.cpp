@@ -0,0 +1,66 @@
+/**
+ * rng.cpp
+ * Random number generation for the filter: a small, fast xoshiro256**
+ * generator and bulk Gaussian noise.
+ */
+
+#include "rng.h"
+
+#include <math.h>
+
+#include "fast_math.h"
+
+namespace {
+
+uint64_t splitmix64(uint64_t* state) {
+  uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+// Box-Muller pairs generated per pass, sized to stay on the stack
+const int kPairsPerPass = 32;
+
+}  // namespace
+
+uint64_t mixSeed(uint64_t seed, uint64_t stream) {
+  uint64_t state = seed ^ (stream * 0xd1b54a32d192ed03ULL);
+  return splitmix64(&state);
+}
+
+void Xoshiro256::reseed(uint64_t seed) {
+  // Seeding through splitmix64 never yields the all-zero state
+  uint64_t state = seed;
+  for (int i = 0; i < 4; ++i) {
+    s[i] = splitmix64(&state);
+  }
+}
+
+void addGaussian(Xoshiro256& rng, double sigma, double* values, int n) {
+  const double two_pi = 6.283185307179586;
+  double radius[kPairsPerPass];
+  double angle[kPairsPerPass];
+  double s[kPairsPerPass];
+  double c[kPairsPerPass];
+
+  int i = 0;
+  while (i < n) {
+    int pairs = (n - i + 1) / 2;
+    if (pairs > kPairsPerPass) {
+      pairs = kPairsPerPass;
+    }
+    for (int k = 0; k < pairs; ++k) {
+      // 1 - u is in (0, 1], keeping log finite
+      radius[k] = sigma * sqrt(-2.0 * log(1.0 - rng.uniform()));
+      angle[k] = two_pi * rng.uniform();
+    }
+    fast_math::sincosBatch(angle, pairs, s, c);
+    for (int k = 0; k < pairs && i < n; ++k) {
+      values[i++] += radius[k] * c[k];
+      if (i < n) {
+        values[i++] += radius[k] * s[k];
+      }
+    }
+  }
+}
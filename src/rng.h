@@ -0,0 +1,99 @@
+/**
+ * rng.h
+ * Random number generation for the filter: a small, fast xoshiro256**
+ * generator and bulk Gaussian noise.
+ *
+ * Noise streams are keyed on (seed, frame, block) rather than drawn from
+ * one shared engine, so any thread can generate the noise of any block of
+ * particles and the result does not depend on how the work is split.
+ */
+
+#ifndef RNG_H_
+#define RNG_H_
+
+#include <stdint.h>
+
+/**
+ * mixSeed Derives a well-mixed 64-bit seed for a substream of seed
+ *   (splitmix64 finalizer).
+ */
+uint64_t mixSeed(uint64_t seed, uint64_t stream);
+
+/**
+ * xoshiro256** by Blackman and Vigna. Satisfies UniformRandomBitGenerator,
+ *   so it also drives the std:: distributions.
+ */
+class Xoshiro256 {
+ public:
+  typedef uint64_t result_type;
+
+  explicit Xoshiro256(uint64_t seed = 0) {
+    reseed(seed);
+  }
+
+  /**
+   * reseed Restarts the generator on the stream of seed.
+   */
+  void reseed(uint64_t seed);
+
+  static constexpr result_type min() {
+    return 0;
+  }
+  static constexpr result_type max() {
+    return ~static_cast<uint64_t>(0);
+  }
+
+  result_type operator()() {
+    uint64_t result = rotl(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 45);
+    return result;
+  }
+
+  /**
+   * getState, setState Save and restore the position of the generator,
+   *   e.g. for snapshots of the filter.
+   */
+  void getState(uint64_t out[4]) const {
+    for (int i = 0; i < 4; ++i) {
+      out[i] = s[i];
+    }
+  }
+
+  void setState(const uint64_t in[4]) {
+    for (int i = 0; i < 4; ++i) {
+      s[i] = in[i];
+    }
+  }
+
+  /**
+   * uniform Returns a double uniformly distributed on [0, 1).
+   */
+  double uniform() {
+    return ((*this)() >> 11) * (1.0 / 9007199254740992.0);
+  }
+
+ private:
+  static uint64_t rotl(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+  }
+
+  uint64_t s[4];
+};
+
+/**
+ * addGaussian Adds zero-mean Gaussian noise to n values in place. Draws
+ *   are made in blocks with Box-Muller, vectorizing the sincos.
+ * @param rng Generator the uniforms are drawn from
+ * @param sigma Standard deviation of the noise
+ * @param values Array of n values
+ * @param n Number of values
+ */
+void addGaussian(Xoshiro256& rng, double sigma, double* values, int n);
+
+#endif  // RNG_H_
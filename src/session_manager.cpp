@@ -0,0 +1,430 @@
+/**
+ * session_manager.cpp
+ * One particle filter per WebSocket connection, stepped on a worker pool.
+ */
+
+#include "session_manager.h"
+
+#include <ctype.h>
+#include <math.h>
+
+#include "binary_protocol.h"
+#include "json.hpp"
+#include "telemetry.h"
+
+using nlohmann::json;
+using std::string;
+
+SessionManager::SessionManager(const Map& map, const SessionConfig& config,
+                               int num_workers, uS::Loop* loop)
+    : map(map), config(config), open_sessions(0), dropped_messages(0),
+      coalesced_frames(0), restored_sessions(0), stopping(false),
+      async(new uS::Async(loop)) {
+  async->setData(this);
+  async->start(&SessionManager::onAsync);
+  for (int t = 0; t < (num_workers < 1 ? 1 : num_workers); ++t) {
+    workers.push_back(std::thread(&SessionManager::workerLoop, this));
+  }
+}
+
+SessionManager::~SessionManager() {
+  {
+    std::lock_guard<std::mutex> lock(task_mutex);
+    stopping = true;
+  }
+  task_cv.notify_all();
+  for (size_t t = 0; t < workers.size(); ++t) {
+    workers[t].join();
+  }
+  async->close();
+}
+
+void SessionManager::open(uWS::WebSocket<uWS::SERVER> ws,
+                          const string& vehicle) {
+  SessionPtr session = std::make_shared<Session>(ws);
+  if (config.configure) {
+    config.configure(session->pf);
+  }
+  session->pf.setDebugAssociations(config.debug_associations);
+  // Warm start from the vehicle's latest snapshot, if it is recent enough
+  session->vehicle = vehicle;
+  session->snapshots = claimSnapshots(vehicle);
+  SnapshotWriter* snapshots = session->snapshots;
+  SnapshotInfo info;
+  if (snapshots && snapshots->latest(restore_buffer) &&
+      readSnapshotInfo(restore_buffer.data(), restore_buffer.size(), info) &&
+      snapshotAge(info) <= config.snapshot_max_age &&
+      session->pf.restoreState(restore_buffer.data(),
+                               restore_buffer.size())) {
+    session->restored = session->pf.initialized();
+  }
+  if (!config.tiled_map.empty()) {
+    session->tiles.reset(new TiledMap());
+    session->tiles->setMemoryLimit(config.tile_memory);
+    if (!session->tiles->open(config.tiled_map)) {
+      session->tiles.reset();
+    }
+  }
+  ws.setUserData(new SessionPtr(session));
+  open_sessions++;
+}
+
+void SessionManager::close(uWS::WebSocket<uWS::SERVER> ws) {
+  SessionPtr* holder = static_cast<SessionPtr*>(ws.getUserData());
+  if (!holder) {
+    return;
+  }
+  ws.setUserData(NULL);
+  // Queued frames are drained unanswered by the stages; workers and
+  //   pending replies keep their own references
+  (*holder)->closed = true;
+  if ((*holder)->snapshots) {
+    snapshot_slots[(*holder)->vehicle].claimed = false;
+  }
+  wake(*holder, DECODE_STAGE);
+  delete holder;
+  open_sessions--;
+}
+
+void SessionManager::post(uWS::WebSocket<uWS::SERVER> ws, const char* data,
+                          size_t length, uWS::OpCode op_code) {
+  SessionPtr* holder = static_cast<SessionPtr*>(ws.getUserData());
+  if (!holder) {
+    return;
+  }
+  const SessionPtr& session = *holder;
+  Message* message = session->inbox.back();
+  if (!message) {
+    dropped_messages++;
+    return;
+  }
+  message->data.assign(data, length);
+  message->binary = op_code == uWS::OpCode::BINARY;
+  session->inbox.push();
+  wake(session, DECODE_STAGE);
+}
+
+void SessionManager::wake(const SessionPtr& session, Stage stage) {
+  if (session->scheduled[stage].exchange(true)) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(task_mutex);
+    tasks.push_back(Task());
+    tasks.back().session = session;
+    tasks.back().stage = stage;
+  }
+  task_cv.notify_one();
+}
+
+bool SessionManager::ready(Session& session, Stage stage) const {
+  switch (stage) {
+    case DECODE_STAGE:
+      return !session.inbox.empty() &&
+          (session.closed || !session.frames.full());
+    case FILTER_STAGE:
+      return !session.frames.empty() &&
+          (session.closed || !session.estimates.full());
+    default:
+      return !session.estimates.empty();
+  }
+}
+
+void SessionManager::workerLoop() {
+  for (;;) {
+    Task task;
+    {
+      std::unique_lock<std::mutex> lock(task_mutex);
+      task_cv.wait(lock, [this] { return stopping || !tasks.empty(); });
+      if (stopping) {
+        return;
+      }
+      task.session.swap(tasks.front().session);
+      task.stage = tasks.front().stage;
+      tasks.pop_front();
+    }
+
+    // One frame per turn, then back of the line, so a busy vehicle does
+    //   not starve the others
+    Session& session = *task.session;
+    if (ready(session, task.stage)) {
+      switch (task.stage) {
+        case DECODE_STAGE:
+          decodeStage(task.session);
+          break;
+        case FILTER_STAGE:
+          filterStage(task.session);
+          break;
+        default:
+          encodeStage(task.session);
+          break;
+      }
+    }
+
+    // Clear the flag before looking again, so that input queued meanwhile
+    //   is either seen here or wakes the stage itself
+    session.scheduled[task.stage] = false;
+    if (ready(session, task.stage)) {
+      wake(task.session, task.stage);
+    }
+  }
+}
+
+void SessionManager::decodeStage(const SessionPtr& session) {
+  Message* message = session->inbox.front();
+  if (session->closed) {
+    session->inbox.pop();
+    wake(session, FILTER_STAGE);
+    return;
+  }
+  Frame* frame = session->frames.back();
+  const char* data = message->data.data();
+  size_t length = message->data.size();
+
+  // Decode the event in place, straight into the frame's observation
+  //   buffer. Binary frames carry the same fields in a fixed layout.
+  frame->binary = message->binary;
+  if (message->binary && !config.accept_binary) {
+    frame->status = TELEMETRY_OTHER;
+  } else {
+    frame->status = message->binary
+        ? decodeBinaryTelemetry(data, length, frame->telemetry,
+                                frame->observations)
+        : parseTelemetry(data, length, frame->telemetry, frame->observations);
+  }
+  session->inbox.pop();
+  if (frame->status == TELEMETRY_OK || frame->status == TELEMETRY_NO_DATA) {
+    session->frames.push();
+    wake(session, FILTER_STAGE);
+  }
+}
+
+void SessionManager::filterStage(const SessionPtr& session) {
+  if (session->closed) {
+    session->frames.pop();
+    wake(session, DECODE_STAGE);
+    return;
+  }
+  // Behind: the older frames only move the particles. A frame without
+  //   data is still answered ("manual"), so coalescing stops at it.
+  if (config.coalesce_frames) {
+    while (session->frames.size() > 1 &&
+           session->frames.front()->status != TELEMETRY_NO_DATA) {
+      predictOnly(*session, *session->frames.front());
+      session->frames.pop();
+      coalesced_frames++;
+    }
+  }
+
+  Estimate* estimate = session->estimates.back();
+  bool answered = step(*session, *session->frames.front(), *estimate);
+  session->frames.pop();
+  if (answered) {
+    session->estimates.push();
+    wake(session, ENCODE_STAGE);
+  }
+  // Room for the decoder again
+  wake(session, DECODE_STAGE);
+}
+
+void SessionManager::encodeStage(const SessionPtr& session) {
+  const Estimate& estimate = *session->estimates.front();
+  Reply reply;
+  reply.session = session;
+  if (estimate.manual) {
+    reply.data = "42[\"manual\",{}]";
+    reply.binary = false;
+  } else if (estimate.binary) {
+    BinaryPose pose;
+    pose.x = estimate.x;
+    pose.y = estimate.y;
+    pose.theta = estimate.theta;
+    pose.weight = estimate.weight;
+    pose.num_particles = estimate.num_particles;
+    pose.num_observations = estimate.num_observations;
+    reply.data.resize(kBinaryPoseSize);
+    encodeBinaryPose(pose, &reply.data[0]);
+    reply.binary = true;
+  } else {
+    json msgJson;
+    msgJson["best_particle_x"] = estimate.x;
+    msgJson["best_particle_y"] = estimate.y;
+    msgJson["best_particle_theta"] = estimate.theta;
+
+    // Optional message data used for debugging particle's sensing
+    //   and associations
+    msgJson["best_particle_associations"] = estimate.associations;
+    msgJson["best_particle_sense_x"] = estimate.sense_x;
+    msgJson["best_particle_sense_y"] = estimate.sense_y;
+
+    reply.data = "42[\"best_particle\"," + msgJson.dump() + "]";
+    reply.binary = false;
+  }
+  session->estimates.pop();
+  // Room for the filter again
+  wake(session, FILTER_STAGE);
+
+  if (!session->closed) {
+    {
+      std::lock_guard<std::mutex> lock(reply_mutex);
+      replies.push_back(Reply());
+      replies.back().session.swap(reply.session);
+      replies.back().data.swap(reply.data);
+      replies.back().binary = reply.binary;
+    }
+    async->send();
+  }
+}
+
+void SessionManager::predictOnly(Session& session, const Frame& frame) {
+  ParticleFilter& pf = session.pf;
+  const Telemetry& telemetry = frame.telemetry;
+  if (frame.status != TELEMETRY_OK) {
+    return;
+  }
+  checkRestored(session, telemetry);
+  if (!pf.initialized()) {
+    if (telemetry.has_sense) {
+      pf.init(telemetry.sense_x, telemetry.sense_y, telemetry.sense_theta,
+              config.sigma_pos);
+    }
+  } else if (telemetry.has_control) {
+    pf.prediction(config.delta_t, config.sigma_pos,
+                  telemetry.previous_velocity, telemetry.previous_yawrate);
+  }
+}
+
+bool SessionManager::step(Session& session, const Frame& frame,
+                          Estimate& estimate) {
+  ParticleFilter& pf = session.pf;
+  const Telemetry& telemetry = frame.telemetry;
+  const std::vector<LandmarkObs>& observations = frame.observations;
+  if (frame.status == TELEMETRY_NO_DATA) {
+    estimate.manual = true;
+    return true;
+  }
+  estimate.manual = false;
+  estimate.binary = frame.binary;
+
+  checkRestored(session, telemetry);
+  if (!pf.initialized()) {
+    // Sense noisy position data from the simulator
+    if (!telemetry.has_sense) {
+      return false;
+    }
+    pf.init(telemetry.sense_x, telemetry.sense_y, telemetry.sense_theta,
+            config.sigma_pos);
+  } else if (telemetry.has_control) {
+    // Predict the vehicle's next state from previous
+    //   (noiseless control) data.
+    pf.prediction(config.delta_t, config.sigma_pos,
+                  telemetry.previous_velocity, telemetry.previous_yawrate);
+  }
+
+  // Landmarks around this vehicle when streaming a tiled map
+  const Map* frame_map = &map;
+  if (session.tiles) {
+    double velocity = telemetry.has_control ? telemetry.previous_velocity : 0.0;
+    double yaw_rate = telemetry.has_control ? telemetry.previous_yawrate : 0.0;
+    frame_map = &session.tiles->focus(pf.particles, config.sensor_range,
+                                      velocity, yaw_rate);
+  }
+
+  // Update the weights and resample
+  pf.updateWeights(config.sensor_range, config.sigma_landmark, observations,
+                   *frame_map);
+  pf.resample();
+
+  // Best particle and weighted mean, both from the weighting pass
+  const ParticleStats& stats = pf.stats();
+  Particle best = pf.bestParticle();
+  estimate.x = config.publish_mean ? stats.mean_x : best.x;
+  estimate.y = config.publish_mean ? stats.mean_y : best.y;
+  estimate.theta = config.publish_mean ? stats.mean_theta : best.theta;
+  estimate.weight = best.weight;
+  estimate.num_particles = pf.size();
+  estimate.num_observations = observations.size();
+
+  // The associations are only recovered for the best particle, and only
+  //   for the JSON reply
+  if (frame.binary) {
+    estimate.associations.clear();
+    estimate.sense_x.clear();
+    estimate.sense_y.clear();
+  } else {
+    ParticleFilter::formatAssociations(pf.debugParticle(best),
+                                       estimate.associations,
+                                       estimate.sense_x, estimate.sense_y);
+  }
+
+  // A closed session may have released its slot to a new one already
+  if (session.snapshots && !session.closed &&
+      ++session.unsaved_frames >= config.snapshot_interval) {
+    session.unsaved_frames = 0;
+    session.snapshots->submit(pf);
+  }
+  return true;
+}
+
+void SessionManager::checkRestored(Session& session,
+                                   const Telemetry& telemetry) {
+  if (!session.restored || !telemetry.has_sense) {
+    return;
+  }
+  session.restored = false;
+  const ParticleStats& stats = session.pf.stats();
+  if (hypot(stats.mean_x - telemetry.sense_x,
+            stats.mean_y - telemetry.sense_y) > config.snapshot_gate) {
+    session.pf.reset();
+  } else {
+    restored_sessions++;
+  }
+}
+
+SnapshotWriter* SessionManager::claimSnapshots(const string& vehicle) {
+  if (config.snapshot_file.empty()) {
+    return NULL;
+  }
+  // The identity becomes part of a file name
+  if (vehicle.size() > 64) {
+    return NULL;
+  }
+  for (size_t k = 0; k < vehicle.size(); ++k) {
+    char c = vehicle[k];
+    if (!isalnum(static_cast<unsigned char>(c)) && c != '-' && c != '_') {
+      return NULL;
+    }
+  }
+  SnapshotSlot& slot = snapshot_slots[vehicle];
+  if (slot.claimed) {
+    return NULL;
+  }
+  if (!slot.writer) {
+    slot.writer.reset(new SnapshotWriter(
+        vehicle.empty() ? config.snapshot_file
+                        : config.snapshot_file + "." + vehicle));
+  }
+  slot.claimed = true;
+  return slot.writer.get();
+}
+
+void SessionManager::onAsync(uS::Async* async) {
+  static_cast<SessionManager*>(async->getData())->flushReplies();
+}
+
+void SessionManager::flushReplies() {
+  {
+    std::lock_guard<std::mutex> lock(reply_mutex);
+    sending.swap(replies);
+  }
+  for (size_t i = 0; i < sending.size(); ++i) {
+    const Reply& reply = sending[i];
+    // The socket is only valid while its session is open
+    if (!reply.session->closed) {
+      reply.session->ws.send(reply.data.data(), reply.data.length(),
+                             reply.binary ? uWS::OpCode::BINARY
+                                          : uWS::OpCode::TEXT);
+    }
+  }
+  sending.clear();
+}
@@ -0,0 +1,296 @@
+/**
+ * session_manager.h
+ * One particle filter per WebSocket connection, stepped on a worker pool.
+ *
+ * The uWS event loop thread only does I/O: it copies incoming frames into
+ * the inbox of the connection's session and sends replies. Each session is
+ * a three-stage pipeline run by the workers, with bounded lock-free queues
+ * between the stages:
+ *
+ *   inbox -> decode -> frames -> filter -> estimates -> encode -> replies
+ *
+ * Each stage of a session runs on at most one worker at a time and in
+ * queue order, so frames are answered strictly in sequence, while the
+ * stages of one session overlap: frame N+1 is decoded while frame N is
+ * filtered and frame N-1 encoded. Different vehicles localize in parallel.
+ * A full queue stalls the stage feeding it; when the filter falls behind
+ * it coalesces the backlog, applying only the motion of stale frames and
+ * answering the newest; frames without data are still answered. Replies
+ * are handed back to the loop through a uS::Async, since uWS sockets may
+ * only be used from the loop thread.
+ *
+ * With a snapshot file the filters are snapshotted periodically in the
+ * background, and a new session starts from the latest snapshot of its
+ * vehicle instead of re-initializing from a GPS fix, after a reconnect or
+ * a restart. Snapshots are kept per vehicle identity, one file each, and
+ * each is used by one open session at a time.
+ */
+
+#ifndef SESSION_MANAGER_H_
+#define SESSION_MANAGER_H_
+
+#include <uWS/uWS.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "filter_snapshot.h"
+#include "particle_filter.h"
+#include "spsc_queue.h"
+#include "telemetry.h"
+#include "tiled_map.h"
+
+/**
+ * Filter parameters shared by all sessions.
+ */
+struct SessionConfig {
+  double delta_t;            // Time elapsed between measurements [sec]
+  double sensor_range;       // Sensor range [m]
+  double sigma_pos[3];       // GPS measurement uncertainty [m, m, rad]
+  double sigma_landmark[2];  // Landmark measurement uncertainty [m, m]
+  bool accept_binary;        // Answer binary frames (binary_protocol.h)
+  // Send the best particle's associations in JSON replies; the fields
+  //   are left empty and nothing is recorded when false
+  bool debug_associations;
+  // Publish the weighted mean pose instead of the best particle
+  bool publish_mean;
+  // Let a filter that falls behind skip the weighting of all but the
+  //   newest queued frame, instead of answering every frame; frames
+  //   without data are answered either way
+  bool coalesce_frames;
+  // Tiled map streamed by every session around its own vehicle, or empty
+  //   to share the manager's map
+  std::string tiled_map;
+  size_t tile_memory;        // Resident tile cap per session [bytes]
+  // Snapshot file of sessions without a vehicle identity, or empty for no
+  //   snapshots; vehicle V uses snapshot_file + "." + V
+  std::string snapshot_file;
+  int snapshot_interval;     // Answered frames between snapshots
+  double snapshot_max_age;   // Older snapshots are not restored [s]
+  // A restored filter whose mean is farther than this from the first GPS
+  //   fix of the session is re-initialized from the fix [m]
+  double snapshot_gate;
+  // Applied to the filter of every new session
+  void (*configure)(ParticleFilter& pf);
+};
+
+class SessionManager {
+ public:
+  /**
+   * Constructor Starts the workers.
+   * @param map Map shared read-only by all sessions; must outlive the
+   *   manager. Unused when config streams a tiled map.
+   * @param config Filter parameters
+   * @param num_workers Number of worker threads stepping filters
+   * @param loop Event loop replies are sent from
+   */
+  SessionManager(const Map& map, const SessionConfig& config, int num_workers,
+                 uS::Loop* loop);
+  ~SessionManager();
+
+  // Event loop side; call from the uWS callbacks only
+
+  /**
+   * open Creates the session of a new connection and attaches it to the
+   *   socket's user data.
+   * @param vehicle Identity of the vehicle, keying its snapshots; letters,
+   *   digits, '-' and '_' only, or empty. While another open session
+   *   holds the same identity the new one is not snapshotted or restored,
+   *   so filters of different vehicles never swap state.
+   */
+  void open(uWS::WebSocket<uWS::SERVER> ws,
+            const std::string& vehicle = std::string());
+
+  /**
+   * close Detaches the session of a closing connection. Work still queued
+   *   for it is dropped; a step in flight finishes but is not answered.
+   */
+  void close(uWS::WebSocket<uWS::SERVER> ws);
+
+  /**
+   * post Queues a frame for the connection's session.
+   */
+  void post(uWS::WebSocket<uWS::SERVER> ws, const char* data, size_t length,
+            uWS::OpCode op_code);
+
+  /**
+   * size Returns the number of open sessions.
+   */
+  int size() const {
+    return open_sessions;
+  }
+
+  /**
+   * droppedMessages Returns the number of frames discarded because a
+   *   session's inbox already held kMaxQueued frames.
+   */
+  unsigned long droppedMessages() const {
+    return dropped_messages.load();
+  }
+
+  /**
+   * coalescedFrames Returns the number of frames whose motion was applied
+   *   without weighting or a reply because newer frames were waiting.
+   */
+  unsigned long coalescedFrames() const {
+    return coalesced_frames.load();
+  }
+
+  /**
+   * restoredSessions Returns the number of sessions started from a
+   *   snapshot and kept after their first GPS fix.
+   */
+  unsigned long restoredSessions() const {
+    return restored_sessions.load();
+  }
+
+ private:
+  // Slots of each queue of a session
+  static const size_t kMaxQueued = 32;
+
+  enum Stage { DECODE_STAGE, FILTER_STAGE, ENCODE_STAGE, NUM_STAGES };
+
+  // Raw frame as received
+  struct Message {
+    std::string data;
+    bool binary;
+  };
+
+  // Decoded frame
+  struct Frame {
+    TelemetryStatus status;
+    Telemetry telemetry;
+    std::vector<LandmarkObs> observations;
+    bool binary;
+  };
+
+  // Filter output of a frame
+  struct Estimate {
+    bool manual;  // Answer "manual", no telemetry in the frame
+    bool binary;
+    double x;
+    double y;
+    double theta;
+    double weight;
+    int num_particles;
+    int num_observations;
+    // Formatted association debug fields
+    std::string associations;
+    std::string sense_x;
+    std::string sense_y;
+  };
+
+  struct Session {
+    uWS::WebSocket<uWS::SERVER> ws;
+    std::atomic<bool> closed;
+    ParticleFilter pf;
+    std::unique_ptr<TiledMap> tiles;  // Set when streaming a tiled map
+
+    // Stage queues; the loop thread produces the inbox
+    SpscQueue<Message> inbox;
+    SpscQueue<Frame> frames;
+    SpscQueue<Estimate> estimates;
+    std::atomic<bool> scheduled[NUM_STAGES];  // Queued on or running
+
+    // Snapshot slot held by the session, or NULL
+    std::string vehicle;
+    SnapshotWriter* snapshots;
+
+    // Filter stage state: restored from a snapshot and not yet checked
+    //   against a GPS fix, and frames answered since the last snapshot
+    bool restored;
+    int unsaved_frames;
+
+    explicit Session(uWS::WebSocket<uWS::SERVER> socket)
+        : ws(socket), closed(false), inbox(kMaxQueued), frames(kMaxQueued),
+          estimates(kMaxQueued), snapshots(NULL), restored(false),
+          unsaved_frames(0) {
+      for (int s = 0; s < NUM_STAGES; ++s) {
+        scheduled[s] = false;
+      }
+    }
+  };
+  typedef std::shared_ptr<Session> SessionPtr;
+
+  struct Task {
+    SessionPtr session;
+    Stage stage;
+  };
+
+  struct Reply {
+    SessionPtr session;
+    std::string data;
+    bool binary;
+  };
+
+  SessionManager(const SessionManager&);
+  SessionManager& operator=(const SessionManager&);
+
+  void workerLoop();
+
+  // Queues stage of session on the workers unless it already is
+  void wake(const SessionPtr& session, Stage stage);
+
+  // Whether stage has input and room for its output
+  bool ready(Session& session, Stage stage) const;
+
+  // Stage bodies; each moves at most one frame forward
+  void decodeStage(const SessionPtr& session);
+  void filterStage(const SessionPtr& session);
+  void encodeStage(const SessionPtr& session);
+
+  // Steps the filter with frame; false if there is no estimate
+  bool step(Session& session, const Frame& frame, Estimate& estimate);
+
+  // Applies only the motion of a frame that is being coalesced
+  void predictOnly(Session& session, const Frame& frame);
+
+  // Drops a restored filter that disagrees with the first GPS fix
+  void checkRestored(Session& session, const Telemetry& telemetry);
+
+  // Snapshot slot of vehicle for a new session, NULL if snapshots are off,
+  //   the identity is malformed or another session holds the slot
+  SnapshotWriter* claimSnapshots(const std::string& vehicle);
+
+  static void onAsync(uS::Async* async);
+  void flushReplies();
+
+  const Map& map;
+  SessionConfig config;
+  int open_sessions;
+  std::atomic<unsigned long> dropped_messages;
+  std::atomic<unsigned long> coalesced_frames;
+  std::atomic<unsigned long> restored_sessions;
+
+  // Background snapshots by vehicle identity, each written by its own
+  //   thread. Slots are only added and claimed on the loop thread and
+  //   live as long as the manager, so sessions keep plain pointers to
+  //   their writers. restore_buffer is the loop thread's copy of a
+  //   snapshot being restored.
+  struct SnapshotSlot {
+    std::unique_ptr<SnapshotWriter> writer;
+    bool claimed;  // Held by an open session
+
+    SnapshotSlot() : claimed(false) {}
+  };
+  std::map<std::string, SnapshotSlot> snapshot_slots;
+  std::vector<char> restore_buffer;
+
+  std::vector<std::thread> workers;
+  std::mutex task_mutex;
+  std::condition_variable task_cv;
+  std::deque<Task> tasks;  // Session stages with work
+  bool stopping;
+
+  uS::Async* async;
+  std::mutex reply_mutex;
+  std::vector<Reply> replies;
+  std::vector<Reply> sending;  // Loop-side buffer swapped with replies
+};
+
+#endif  // SESSION_MANAGER_H_
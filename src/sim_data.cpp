@@ -0,0 +1,154 @@
+/**
+ * sim_data.cpp
+ * Synthetic drives and recorded-log I/O for the offline drivers.
+ */
+
+#include "sim_data.h"
+
+#include <stdio.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <fstream>
+#include <random>
+
+using std::string;
+using std::vector;
+
+namespace {
+
+string observationFile(const string& dir, int frame) {
+  char name[64];
+  snprintf(name, sizeof(name), "/observation/observations_%06d.txt", frame + 1);
+  return dir + name;
+}
+
+}  // namespace
+
+void simulateMap(int num_landmarks, double spacing, unsigned seed, Map& map) {
+  double side = spacing * sqrt(static_cast<double>(num_landmarks));
+  std::mt19937 gen(seed);
+  std::uniform_real_distribution<double> position(0.0, side);
+  map.landmark_list.resize(num_landmarks);
+  for (int i = 0; i < num_landmarks; ++i) {
+    Map::single_landmark_s& lm = map.landmark_list[i];
+    lm.id_i = i + 1;
+    lm.x_f = position(gen);
+    lm.y_f = position(gen);
+  }
+  map.buildIndex();
+}
+
+void simulateDrive(const Map& map, int frames, double delta_t,
+                   double sensor_range, const double sigma_landmark[],
+                   unsigned seed, DriveLog& log) {
+  log.controls.clear();
+  log.gt.clear();
+  log.observations.assign(frames, vector<LandmarkObs>());
+  if (map.size() == 0 || frames <= 0) {
+    return;
+  }
+
+  const Map::single_landmark_s* landmarks = map.landmarks();
+  float min_x = landmarks[0].x_f, max_x = min_x;
+  float min_y = landmarks[0].y_f, max_y = min_y;
+  for (size_t i = 1; i < map.size(); ++i) {
+    min_x = std::min(min_x, landmarks[i].x_f);
+    max_x = std::max(max_x, landmarks[i].x_f);
+    min_y = std::min(min_y, landmarks[i].y_f);
+    max_y = std::max(max_y, landmarks[i].y_f);
+  }
+
+  // Cross the map along x within the requested number of frames
+  double velocity = (max_x - min_x) / (frames * delta_t);
+  velocity = std::max(1.0, std::min(20.0, velocity));
+
+  std::mt19937 gen(seed);
+  std::normal_distribution<double> noise_x(0.0, sigma_landmark[0]);
+  std::normal_distribution<double> noise_y(0.0, sigma_landmark[1]);
+  vector<int> in_range;
+
+  double x = min_x;
+  double y = 0.5 * (min_y + max_y);
+  double theta = 0.0;
+  for (int f = 0; f < frames; ++f) {
+    ground_truth pose;
+    pose.x = x;
+    pose.y = y;
+    pose.theta = theta;
+    log.gt.push_back(pose);
+
+    in_range.clear();
+    map.queryRange(x, y, sensor_range, in_range);
+    double c = cos(theta);
+    double s = sin(theta);
+    for (size_t k = 0; k < in_range.size(); ++k) {
+      const Map::single_landmark_s& lm = landmarks[in_range[k]];
+      double dx = lm.x_f - x;
+      double dy = lm.y_f - y;
+      LandmarkObs obs;
+      obs.id = -1;
+      obs.x = c * dx + s * dy + noise_x(gen);
+      obs.y = -s * dx + c * dy + noise_y(gen);
+      log.observations[f].push_back(obs);
+    }
+
+    control_s control;
+    control.velocity = velocity;
+    control.yawrate = 0.05 * sin(f * 0.02);
+    log.controls.push_back(control);
+
+    double yaw_rate = control.yawrate;
+    if (fabs(yaw_rate) > 0.00001) {
+      x += velocity / yaw_rate * (sin(theta + yaw_rate * delta_t) - sin(theta));
+      y += velocity / yaw_rate * (cos(theta) - cos(theta + yaw_rate * delta_t));
+      theta += yaw_rate * delta_t;
+    } else {
+      x += velocity * delta_t * cos(theta);
+      y += velocity * delta_t * sin(theta);
+    }
+  }
+}
+
+bool readDriveLog(const string& dir, DriveLog& log) {
+  log.controls.clear();
+  log.gt.clear();
+  log.observations.clear();
+  if (!read_control_data(dir + "/control_data.txt", log.controls) ||
+      !read_gt_data(dir + "/gt_data.txt", log.gt)) {
+    return false;
+  }
+  log.observations.resize(log.gt.size());
+  for (size_t f = 0; f < log.gt.size(); ++f) {
+    if (!read_landmark_data(observationFile(dir, f), log.observations[f])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool writeDriveLog(const string& dir, const DriveLog& log) {
+  mkdir(dir.c_str(), 0755);
+  mkdir((dir + "/observation").c_str(), 0755);
+
+  std::ofstream controls((dir + "/control_data.txt").c_str());
+  std::ofstream gt((dir + "/gt_data.txt").c_str());
+  if (!controls || !gt) {
+    return false;
+  }
+  controls.precision(10);
+  gt.precision(10);
+  for (int f = 0; f < log.size(); ++f) {
+    controls << log.controls[f].velocity << " " << log.controls[f].yawrate << "\n";
+    gt << log.gt[f].x << " " << log.gt[f].y << " " << log.gt[f].theta << "\n";
+
+    std::ofstream obs(observationFile(dir, f).c_str());
+    if (!obs) {
+      return false;
+    }
+    obs.precision(10);
+    for (size_t k = 0; k < log.observations[f].size(); ++k) {
+      obs << log.observations[f][k].x << " " << log.observations[f][k].y << "\n";
+    }
+  }
+  return true;
+}
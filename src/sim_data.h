@@ -0,0 +1,71 @@
+/**
+ * sim_data.h
+ * Synthetic drives and recorded-log I/O for the offline drivers.
+ */
+
+#ifndef SIM_DATA_H_
+#define SIM_DATA_H_
+
+#include <string>
+#include <vector>
+#include "helper_functions.h"
+
+/**
+ * A recorded drive: for frame i, gt[i] is the true pose, observations[i]
+ *   the landmark observations in vehicle coordinates and controls[i] the
+ *   velocity and yaw rate applied from frame i to frame i+1.
+ */
+struct DriveLog {
+  std::vector<control_s> controls;
+  std::vector<ground_truth> gt;
+  std::vector<std::vector<LandmarkObs> > observations;
+
+  int size() const {
+    return static_cast<int>(gt.size());
+  }
+};
+
+/**
+ * simulateMap Scatters num_landmarks landmarks uniformly over a square
+ *   holding one landmark per spacing x spacing on average, so a sensor
+ *   sees about as many landmarks on a large map as on a small one. Ids
+ *   count from 1 as in the project's map file; the index is built.
+ * @param num_landmarks Number of landmarks
+ * @param spacing Mean distance between neighboring landmarks [m]
+ * @param seed Seed of the position generator
+ * @param map Output map
+ */
+void simulateMap(int num_landmarks, double spacing, unsigned seed, Map& map);
+
+/**
+ * simulateDrive Drives a vehicle across the extent of the map with a
+ *   gently weaving CTRV trajectory and records noisy observations of the
+ *   landmarks within sensor range.
+ * @param map Map to drive through
+ * @param frames Number of frames to record
+ * @param delta_t Time between frames [s]
+ * @param sensor_range Range [m] of sensor
+ * @param sigma_landmark[] Observation noise [x [m], y [m]]
+ * @param seed Seed of the noise generator
+ * @param log Output drive log
+ */
+void simulateDrive(const Map& map, int frames, double delta_t,
+                   double sensor_range, const double sigma_landmark[],
+                   unsigned seed, DriveLog& log);
+
+/**
+ * readDriveLog Reads a drive recorded in the project's data layout:
+ *   control_data.txt, gt_data.txt and observation/observations_NNNNNN.txt
+ *   (numbered from 1) inside dir.
+ * @output True if all files could be read
+ */
+bool readDriveLog(const std::string& dir, DriveLog& log);
+
+/**
+ * writeDriveLog Writes log to dir in the layout readDriveLog expects.
+ *   dir and dir/observation are created if missing.
+ * @output True if all files could be written
+ */
+bool writeDriveLog(const std::string& dir, const DriveLog& log);
+
+#endif  // SIM_DATA_H_
@@ -0,0 +1,107 @@
+/**
+ * spsc_queue.h
+ * Bounded lock-free single-producer single-consumer queue.
+ */
+
+#ifndef SPSC_QUEUE_H_
+#define SPSC_QUEUE_H_
+
+#include <stddef.h>
+#include <atomic>
+#include <vector>
+
+/**
+ * Ring of preallocated slots. The producer fills back() in place and
+ *   publishes it with push(); the consumer reads front() in place and
+ *   releases it with pop(). Slots are reused, so elements holding buffers
+ *   (strings, vectors) keep their capacity and a warmed-up queue does not
+ *   allocate.
+ *
+ * At most one thread may produce and one consume at a time. Either role
+ *   may move to another thread as long as the handover itself
+ *   synchronizes (e.g. through a mutex).
+ */
+template <typename T>
+class SpscQueue {
+ public:
+  /**
+   * Constructor
+   * @param capacity Number of slots, rounded up to a power of two
+   */
+  explicit SpscQueue(size_t capacity) : head(0), tail(0) {
+    size_t n = 1;
+    while (n < capacity) {
+      n <<= 1;
+    }
+    slots.resize(n);
+    mask = n - 1;
+  }
+
+  /**
+   * back Producer side: returns the slot to fill next, or NULL if full.
+   */
+  T* back() {
+    size_t t = tail.load(std::memory_order_relaxed);
+    if (t - head.load(std::memory_order_acquire) > mask) {
+      return NULL;
+    }
+    return &slots[t & mask];
+  }
+
+  /**
+   * push Producer side: publishes the slot returned by back().
+   */
+  void push() {
+    tail.store(tail.load(std::memory_order_relaxed) + 1,
+               std::memory_order_release);
+  }
+
+  /**
+   * front Consumer side: returns the oldest element, or NULL if empty.
+   */
+  T* front() {
+    size_t h = head.load(std::memory_order_relaxed);
+    if (h == tail.load(std::memory_order_acquire)) {
+      return NULL;
+    }
+    return &slots[h & mask];
+  }
+
+  /**
+   * pop Consumer side: releases the element returned by front().
+   */
+  void pop() {
+    head.store(head.load(std::memory_order_relaxed) + 1,
+               std::memory_order_release);
+  }
+
+  /**
+   * size Returns the number of queued elements. Exact on the consumer
+   *   side; elsewhere it may count elements being popped concurrently.
+   */
+  size_t size() const {
+    // head first, so that the later tail is never behind it
+    size_t h = head.load(std::memory_order_acquire);
+    return tail.load(std::memory_order_acquire) - h;
+  }
+
+  bool empty() const {
+    return size() == 0;
+  }
+
+  bool full() const {
+    return size() > mask;
+  }
+
+ private:
+  SpscQueue(const SpscQueue&);
+  SpscQueue& operator=(const SpscQueue&);
+
+  std::vector<T> slots;
+  size_t mask;
+  // Consumer and producer indices on their own cache lines
+  alignas(64) std::atomic<size_t> head;
+  alignas(64) std::atomic<size_t> tail;
+};
+
+#endif  // SPSC_QUEUE_H_
@@ -0,0 +1,348 @@
+/**
+ * telemetry.cpp
+ * Zero-copy decoder for the simulator's SocketIO telemetry messages.
+ */
+
+#include "telemetry.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cmath>
+#include <string>
+
+namespace {
+
+// Exactly representable powers of ten
+const double kPow10[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+inline bool isDigit(char c) {
+  return c >= '0' && c <= '9';
+}
+
+inline bool isSpace(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+void skipSpace(const char** p, const char* end) {
+  while (*p < end && isSpace(**p)) {
+    ++*p;
+  }
+}
+
+bool expect(const char** p, const char* end, char c) {
+  skipSpace(p, end);
+  if (*p < end && **p == c) {
+    ++*p;
+    return true;
+  }
+  return false;
+}
+
+// Scans a JSON string starting at the opening quote and returns its raw
+//   contents [*begin, *stop). Escapes are skipped over, not decoded; no
+//   field of interest contains any.
+bool scanString(const char** p, const char* end, const char** begin,
+                const char** stop) {
+  if (!expect(p, end, '"')) {
+    return false;
+  }
+  *begin = *p;
+  while (*p < end && **p != '"') {
+    if (**p == '\\') {
+      ++*p;
+    }
+    ++*p;
+  }
+  if (*p >= end) {
+    return false;
+  }
+  *stop = (*p)++;
+  return true;
+}
+
+// Skips a JSON value of any type
+bool skipValue(const char** p, const char* end) {
+  skipSpace(p, end);
+  if (*p >= end) {
+    return false;
+  }
+  if (**p == '"') {
+    const char* b;
+    const char* e;
+    return scanString(p, end, &b, &e);
+  }
+  if (**p == '{' || **p == '[') {
+    int depth = 0;
+    while (*p < end) {
+      char c = **p;
+      if (c == '"') {
+        const char* b;
+        const char* e;
+        if (!scanString(p, end, &b, &e)) {
+          return false;
+        }
+        continue;
+      }
+      ++*p;
+      if (c == '{' || c == '[') {
+        ++depth;
+      } else if ((c == '}' || c == ']') && --depth == 0) {
+        return true;
+      }
+    }
+    return false;
+  }
+  // Number, true, false or null
+  while (*p < end && **p != ',' && **p != '}' && **p != ']') {
+    ++*p;
+  }
+  return true;
+}
+
+bool equals(const char* begin, const char* stop, const char* literal) {
+  size_t n = strlen(literal);
+  return static_cast<size_t>(stop - begin) == n && !memcmp(begin, literal, n);
+}
+
+// A number field, sent as a string ("6.2785") or as a bare number
+bool parseNumberValue(const char** p, const char* end, double* value) {
+  skipSpace(p, end);
+  if (*p < end && **p == '"') {
+    const char* b;
+    const char* e;
+    if (!scanString(p, end, &b, &e)) {
+      return false;
+    }
+    skipSpace(&b, e);
+    return parseDouble(&b, e, value);
+  }
+  return parseDouble(p, end, value);
+}
+
+// A whitespace-separated list of numbers inside a string field. Writes the
+//   i-th number to the x or y member of observations[i], growing the
+//   buffer as needed; returns the count through *n.
+bool parseCoordinateList(const char** p, const char* end, bool y_list,
+                         std::vector<LandmarkObs>& observations, size_t* n) {
+  const char* b;
+  const char* e;
+  if (!scanString(p, end, &b, &e)) {
+    return false;
+  }
+  size_t count = 0;
+  for (;;) {
+    skipSpace(&b, e);
+    if (b == e) {
+      break;
+    }
+    double v;
+    if (!parseDouble(&b, e, &v)) {
+      return false;
+    }
+    if (count == observations.size()) {
+      LandmarkObs obs;
+      obs.id = -1;
+      obs.x = 0.0;
+      obs.y = 0.0;
+      observations.push_back(obs);
+    }
+    if (y_list) {
+      observations[count].y = v;
+    } else {
+      observations[count].x = v;
+    }
+    ++count;
+  }
+  *n = count;
+  return true;
+}
+
+}  // namespace
+
+bool parseDouble(const char** p, const char* end, double* value) {
+  const char* s = *p;
+  bool negative = false;
+  if (s < end && (*s == '-' || *s == '+')) {
+    negative = *s == '-';
+    ++s;
+  }
+
+  uint64_t mantissa = 0;
+  int digits = 0;     // Significant digits accumulated in mantissa
+  int exponent = 0;   // Decimal exponent applied to mantissa
+  bool truncated = false;  // Digits beyond the 19th were dropped
+  bool any = false;
+  for ( ; s < end && isDigit(*s); ++s) {
+    any = true;
+    if (digits < 19) {
+      mantissa = mantissa * 10 + (*s - '0');
+      digits += mantissa != 0;
+    } else {
+      truncated |= *s != '0';
+      ++exponent;
+    }
+  }
+  if (s < end && *s == '.') {
+    ++s;
+    for ( ; s < end && isDigit(*s); ++s) {
+      any = true;
+      if (digits < 19) {
+        mantissa = mantissa * 10 + (*s - '0');
+        digits += mantissa != 0;
+        --exponent;
+      } else {
+        truncated |= *s != '0';
+      }
+    }
+  }
+  // No digits: inf and nan are rejected on purpose, although std::stod
+  //   took them; the filter cannot use non-finite values
+  if (!any) {
+    return false;
+  }
+  if (s < end && (*s == 'e' || *s == 'E')) {
+    const char* e = s + 1;
+    bool exp_negative = false;
+    if (e < end && (*e == '-' || *e == '+')) {
+      exp_negative = *e == '-';
+      ++e;
+    }
+    if (e < end && isDigit(*e)) {
+      int exp_value = 0;
+      for ( ; e < end && isDigit(*e); ++e) {
+        if (exp_value < 10000) {
+          exp_value = exp_value * 10 + (*e - '0');
+        }
+      }
+      exponent += exp_negative ? -exp_value : exp_value;
+      s = e;
+    }
+  }
+
+  // Fast path: an exact mantissa scaled by an exact power of ten rounds
+  //   correctly in one operation
+  double result;
+  if (!truncated && mantissa < (1ULL << 53) && exponent >= -22 &&
+      exponent <= 22) {
+    double v = static_cast<double>(mantissa);
+    v = exponent < 0 ? v / kPow10[-exponent] : v * kPow10[exponent];
+    result = negative ? -v : v;
+  } else {
+    // Rare: hand the token to strtod through a terminated copy, on the
+    //   heap for the very rare token that does not fit the buffer
+    char buffer[64];
+    size_t n = s - *p;
+    if (n < sizeof(buffer)) {
+      memcpy(buffer, *p, n);
+      buffer[n] = '\0';
+      result = strtod(buffer, NULL);
+    } else {
+      std::string token(*p, n);
+      result = strtod(token.c_str(), NULL);
+    }
+  }
+  // Likewise for a finite token that overflows
+  if (!std::isfinite(result)) {
+    return false;
+  }
+  *value = result;
+  *p = s;
+  return true;
+}
+
+TelemetryStatus parseTelemetry(const char* data, size_t length,
+                               Telemetry& telemetry,
+                               std::vector<LandmarkObs>& observations) {
+  // "42" at the start of the message means there's a websocket message
+  //   event: the 4 signifies a websocket message, the 2 a websocket event
+  const char* p = data;
+  const char* end = data + length;
+  if (length < 3 || p[0] != '4' || p[1] != '2') {
+    return TELEMETRY_OTHER;
+  }
+  p += 2;
+  if (!expect(&p, end, '[')) {
+    return TELEMETRY_NO_DATA;
+  }
+
+  const char* name;
+  const char* name_end;
+  if (!scanString(&p, end, &name, &name_end)) {
+    return TELEMETRY_NO_DATA;
+  }
+  if (!expect(&p, end, ',')) {
+    return TELEMETRY_NO_DATA;
+  }
+  skipSpace(&p, end);
+  if (end - p >= 4 && !memcmp(p, "null", 4)) {
+    return TELEMETRY_NO_DATA;
+  }
+  if (!equals(name, name_end, "telemetry")) {
+    return TELEMETRY_OTHER;
+  }
+  if (!expect(&p, end, '{')) {
+    return TELEMETRY_MALFORMED;
+  }
+
+  // Bit per field seen
+  enum {
+    SENSE_X = 1, SENSE_Y = 2, SENSE_THETA = 4, VELOCITY = 8, YAWRATE = 16
+  };
+  int seen = 0;
+  size_t num_x = 0;
+  size_t num_y = 0;
+  observations.clear();
+
+  if (!expect(&p, end, '}')) {
+    for (;;) {
+      const char* key;
+      const char* key_end;
+      if (!scanString(&p, end, &key, &key_end) || !expect(&p, end, ':')) {
+        return TELEMETRY_MALFORMED;
+      }
+      bool ok;
+      if (equals(key, key_end, "sense_x")) {
+        ok = parseNumberValue(&p, end, &telemetry.sense_x);
+        seen |= SENSE_X;
+      } else if (equals(key, key_end, "sense_y")) {
+        ok = parseNumberValue(&p, end, &telemetry.sense_y);
+        seen |= SENSE_Y;
+      } else if (equals(key, key_end, "sense_theta")) {
+        ok = parseNumberValue(&p, end, &telemetry.sense_theta);
+        seen |= SENSE_THETA;
+      } else if (equals(key, key_end, "previous_velocity")) {
+        ok = parseNumberValue(&p, end, &telemetry.previous_velocity);
+        seen |= VELOCITY;
+      } else if (equals(key, key_end, "previous_yawrate")) {
+        ok = parseNumberValue(&p, end, &telemetry.previous_yawrate);
+        seen |= YAWRATE;
+      } else if (equals(key, key_end, "sense_observations_x")) {
+        ok = parseCoordinateList(&p, end, false, observations, &num_x);
+      } else if (equals(key, key_end, "sense_observations_y")) {
+        ok = parseCoordinateList(&p, end, true, observations, &num_y);
+      } else {
+        ok = skipValue(&p, end);
+      }
+      if (!ok) {
+        return TELEMETRY_MALFORMED;
+      }
+      if (expect(&p, end, '}')) {
+        break;
+      }
+      if (!expect(&p, end, ',')) {
+        return TELEMETRY_MALFORMED;
+      }
+    }
+  }
+
+  // Only complete x/y pairs are observations
+  observations.resize(num_x < num_y ? num_x : num_y);
+  telemetry.has_sense = (seen & (SENSE_X | SENSE_Y | SENSE_THETA)) ==
+                        (SENSE_X | SENSE_Y | SENSE_THETA);
+  telemetry.has_control = (seen & (VELOCITY | YAWRATE)) == (VELOCITY | YAWRATE);
+  return TELEMETRY_OK;
+}
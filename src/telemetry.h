@@ -0,0 +1,62 @@
+/**
+ * telemetry.h
+ * Zero-copy decoder for the simulator's SocketIO telemetry messages.
+ *
+ * A message looks like
+ *   42["telemetry",{"sense_x":"6.2785",...,"sense_observations_x":"1.5 -3.2"}]
+ * The decoder walks the frame once, in place, and parses the numeric
+ * fields straight into the caller's buffers without building a document
+ * or any intermediate strings.
+ */
+
+#ifndef TELEMETRY_H_
+#define TELEMETRY_H_
+
+#include <stddef.h>
+#include <vector>
+#include "helper_functions.h"
+
+/**
+ * Fields of one telemetry event. A has_* flag is false when the field was
+ *   absent from the message.
+ */
+struct Telemetry {
+  bool has_sense;    // sense_x, sense_y and sense_theta all present
+  bool has_control;  // previous_velocity and previous_yawrate both present
+  double sense_x;            // Noisy GPS x [m]
+  double sense_y;            // Noisy GPS y [m]
+  double sense_theta;        // Noisy GPS yaw [rad]
+  double previous_velocity;  // [m/s]
+  double previous_yawrate;   // [rad/s]
+};
+
+enum TelemetryStatus {
+  TELEMETRY_OK,         // A telemetry event with data
+  TELEMETRY_NO_DATA,    // A SocketIO event without data (manual mode)
+  TELEMETRY_OTHER,      // Not a SocketIO event, or a different event
+  TELEMETRY_MALFORMED   // Telemetry event that could not be decoded
+};
+
+/**
+ * parseTelemetry Decodes a SocketIO message in place.
+ * @param data Message bytes, need not be NUL-terminated
+ * @param length Number of bytes in data
+ * @param telemetry Output fields of the event
+ * @param observations Output observations in vehicle coordinates; resized
+ *   to the number of x/y pairs, so its capacity is reused across frames
+ * @output Status of the message, telemetry and observations are only
+ *   meaningful for TELEMETRY_OK
+ */
+TelemetryStatus parseTelemetry(const char* data, size_t length,
+                               Telemetry& telemetry,
+                               std::vector<LandmarkObs>& observations);
+
+/**
+ * parseDouble Parses a decimal floating-point number from [*p, end) and
+ *   advances *p past it. Correctly rounded; the common case of at most 19
+ *   significant digits and a small exponent avoids strtod.
+ * @output False if no number starts at *p or it is not finite
+ */
+bool parseDouble(const char** p, const char* end, double* value);
+
+#endif  // TELEMETRY_H_
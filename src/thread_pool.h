@@ -0,0 +1,132 @@
+/**
+ * thread_pool.h
+ * Fixed-size fork/join pool used to split per-particle loops across cores.
+ */
+
+#ifndef THREAD_POOL_H_
+#define THREAD_POOL_H_
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+ public:
+  /**
+   * Constructor Starts num_threads - 1 workers; the calling thread of
+   *   parallelFor does the first share of the work itself.
+   * @param num_threads Total number of threads taking part in a loop
+   */
+  explicit ThreadPool(int num_threads)
+      : num_threads_(num_threads < 1 ? 1 : num_threads),
+        generation_(0), pending_(0), fn_(NULL), call_(NULL), n_(0),
+        stop_(false) {
+    for (int t = 1; t < num_threads_; ++t) {
+      workers_.push_back(std::thread(&ThreadPool::workerLoop, this, t));
+    }
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    start_cv_.notify_all();
+    for (size_t t = 0; t < workers_.size(); ++t) {
+      workers_[t].join();
+    }
+  }
+
+  int size() const {
+    return num_threads_;
+  }
+
+  /**
+   * parallelFor Splits [0, n) into one contiguous chunk per thread and
+   *   blocks until all chunks are done. Chunk boundaries depend only on n
+   *   and the thread count, so results are reproducible. The functor is
+   *   called through a plain function pointer, so no allocation happens.
+   * @param n Number of loop iterations
+   * @param fn Functor fn(begin, end, chunk) called once per non-empty
+   *   chunk [begin, end); chunk is in [0, size()) and unique per call
+   */
+  template <typename Fn>
+  void parallelFor(int n, const Fn& fn) {
+    if (num_threads_ == 1 || n < 2) {
+      if (n > 0) {
+        fn(0, n, 0);
+      }
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      fn_ = &fn;
+      call_ = &invoke<Fn>;
+      n_ = n;
+      pending_ = num_threads_ - 1;
+      ++generation_;
+    }
+    start_cv_.notify_all();
+
+    runChunk(0);
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_cv_.wait(lock, [this] { return pending_ == 0; });
+    fn_ = NULL;
+  }
+
+ private:
+  typedef void (*CallFn)(const void* fn, int begin, int end, int chunk);
+
+  template <typename Fn>
+  static void invoke(const void* fn, int begin, int end, int chunk) {
+    (*static_cast<const Fn*>(fn))(begin, end, chunk);
+  }
+
+  ThreadPool(const ThreadPool&);
+  ThreadPool& operator=(const ThreadPool&);
+
+  void runChunk(int t) {
+    int begin = static_cast<int>(static_cast<long long>(n_) * t / num_threads_);
+    int end = static_cast<int>(static_cast<long long>(n_) * (t + 1) / num_threads_);
+    if (begin < end) {
+      call_(fn_, begin, end, t);
+    }
+  }
+
+  void workerLoop(int t) {
+    unsigned long seen = 0;
+    for (;;) {
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        start_cv_.wait(lock, [this, seen] { return stop_ || generation_ != seen; });
+        if (stop_) {
+          return;
+        }
+        seen = generation_;
+      }
+
+      runChunk(t);
+
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (--pending_ == 0) {
+        done_cv_.notify_one();
+      }
+    }
+  }
+
+  int num_threads_;
+  std::vector<std::thread> workers_;
+  std::mutex mutex_;
+  std::condition_variable start_cv_;
+  std::condition_variable done_cv_;
+  unsigned long generation_;  // Bumped once per parallelFor call
+  int pending_;               // Workers still running the current loop
+  const void* fn_;            // Functor of the current loop
+  CallFn call_;               // Type-erased caller for fn_
+  int n_;
+  bool stop_;
+};
+
+#endif  // THREAD_POOL_H_
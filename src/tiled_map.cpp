@@ -0,0 +1,432 @@
+/**
+ * tiled_map.cpp
+ * Streams a tiled map file so that only the landmarks around the particle
+ * cloud are resident.
+ *
+ * Layout, in host byte order (the header records it):
+ *   TiledMapHeader             64 bytes
+ *   TileEntry[num_tiles]       Directory of the non-empty tiles, sorted by
+ *                              (ty, tx), 24 bytes each
+ *   single_landmark_s[count]   Landmark records grouped by tile, starting
+ *                              at the next 8-byte boundary
+ */
+
+#include "tiled_map.h"
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+
+#include "fast_math.h"
+
+namespace {
+
+const char kTiledMagic[8] = {'P', 'F', 'T', 'I', 'L', 'E', 'S', 0};
+const uint32_t kTiledVersion = 1;
+const uint32_t kByteOrderMark = 0x01020304;
+
+struct TiledMapHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;   // kByteOrderMark as written by the producer
+  uint32_t record_size;  // sizeof(Map::single_landmark_s)
+  uint32_t num_tiles;    // Entries in the tile directory
+  uint64_t count;        // Number of landmarks
+  double tile_size;
+  double origin_x;       // Map coordinates of the corner of tile (0, 0)
+  double origin_y;
+  uint64_t reserved;
+};
+
+// Points sampled along the extrapolated path when prefetching
+const int kPrefetchSteps = 4;
+
+inline uint64_t align8(uint64_t n) {
+  return (n + 7) & ~static_cast<uint64_t>(7);
+}
+
+bool preadAll(int fd, void* buffer, size_t n, uint64_t offset) {
+  char* p = static_cast<char*>(buffer);
+  while (n > 0) {
+    ssize_t r = pread(fd, p, n, offset);
+    if (r <= 0) {
+      return false;
+    }
+    p += r;
+    n -= r;
+    offset += r;
+  }
+  return true;
+}
+
+}  // namespace
+
+TiledMap::TiledMap()
+    : fd(-1), tile_size(0.0), origin_x(0.0), origin_y(0.0), records_offset(0),
+      resident_bytes(0), memory_limit(64 << 20), horizon(2.0), frame(0),
+      demand_loads(0), prefetch_loads(0), failed_loads(0), eviction_count(0),
+      stopping(false) {}
+
+TiledMap::~TiledMap() {
+  close();
+}
+
+bool TiledMap::write(const Map& map, double tile_size,
+                     const std::string& filename) {
+  if (tile_size <= 0.0) {
+    return false;
+  }
+  const Map::single_landmark_s* lm = map.landmarks();
+  size_t n = map.size();
+
+  TiledMapHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kTiledMagic, sizeof(kTiledMagic));
+  header.version = kTiledVersion;
+  header.byte_order = kByteOrderMark;
+  header.record_size = sizeof(Map::single_landmark_s);
+  header.count = n;
+  header.tile_size = tile_size;
+  for (size_t i = 0; i < n; ++i) {
+    header.origin_x = i == 0 ? lm[i].x_f : std::min<double>(header.origin_x, lm[i].x_f);
+    header.origin_y = i == 0 ? lm[i].y_f : std::min<double>(header.origin_y, lm[i].y_f);
+  }
+
+  // Sort the records by tile, keeping landmark order within a tile
+  std::vector<std::pair<std::pair<int32_t, int32_t>, size_t> > order(n);
+  for (size_t i = 0; i < n; ++i) {
+    int32_t tx = static_cast<int32_t>(floor((lm[i].x_f - header.origin_x) / tile_size));
+    int32_t ty = static_cast<int32_t>(floor((lm[i].y_f - header.origin_y) / tile_size));
+    order[i] = std::make_pair(std::make_pair(ty, tx), i);
+  }
+  std::sort(order.begin(), order.end());
+
+  std::vector<TileEntry> directory;
+  for (size_t i = 0; i < n; ++i) {
+    if (directory.empty() || directory.back().ty != order[i].first.first ||
+        directory.back().tx != order[i].first.second) {
+      TileEntry entry;
+      entry.ty = order[i].first.first;
+      entry.tx = order[i].first.second;
+      entry.first = i;
+      entry.count = 0;
+      entry.reserved = 0;
+      directory.push_back(entry);
+    }
+    directory.back().count++;
+  }
+  header.num_tiles = directory.size();
+
+  FILE* f = fopen(filename.c_str(), "wb");
+  if (!f) {
+    return false;
+  }
+  uint64_t records = align8(sizeof(header) + directory.size() * sizeof(TileEntry));
+  static const char zeros[8] = {0};
+  size_t pad = records - sizeof(header) - directory.size() * sizeof(TileEntry);
+  bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+            (directory.empty() ||
+             fwrite(&directory[0], sizeof(TileEntry), directory.size(), f) ==
+                 directory.size()) &&
+            fwrite(zeros, 1, pad, f) == pad;
+  for (size_t i = 0; ok && i < n; ++i) {
+    ok = fwrite(&lm[order[i].second], sizeof(Map::single_landmark_s), 1, f) == 1;
+  }
+  return fclose(f) == 0 && ok;
+}
+
+bool TiledMap::isTiledMap(const std::string& filename) {
+  FILE* f = fopen(filename.c_str(), "rb");
+  if (!f) {
+    return false;
+  }
+  char magic[sizeof(kTiledMagic)];
+  bool tiled = fread(magic, 1, sizeof(magic), f) == sizeof(magic) &&
+               memcmp(magic, kTiledMagic, sizeof(kTiledMagic)) == 0;
+  fclose(f);
+  return tiled;
+}
+
+bool TiledMap::open(const std::string& filename) {
+  close();
+  fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  TiledMapHeader header;
+  if (!preadAll(fd, &header, sizeof(header), 0) ||
+      memcmp(header.magic, kTiledMagic, sizeof(kTiledMagic)) != 0 ||
+      header.version != kTiledVersion || header.byte_order != kByteOrderMark ||
+      header.record_size != sizeof(Map::single_landmark_s) ||
+      !(header.tile_size > 0.0)) {
+    close();
+    return false;
+  }
+  tiles.resize(header.num_tiles);
+  if (!tiles.empty() &&
+      !preadAll(fd, &tiles[0], tiles.size() * sizeof(TileEntry), sizeof(header))) {
+    close();
+    return false;
+  }
+  for (size_t t = 0; t < tiles.size(); ++t) {
+    if (tiles[t].first + tiles[t].count > header.count) {
+      close();
+      return false;
+    }
+  }
+  tile_size = header.tile_size;
+  origin_x = header.origin_x;
+  origin_y = header.origin_y;
+  records_offset = align8(sizeof(header) + tiles.size() * sizeof(TileEntry));
+
+  stopping = false;
+  prefetcher = std::thread(&TiledMap::prefetchLoop, this);
+  return true;
+}
+
+void TiledMap::close() {
+  if (prefetcher.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    cv.notify_all();
+    prefetcher.join();
+  }
+  if (fd >= 0) {
+    ::close(fd);
+    fd = -1;
+  }
+  tiles.clear();
+  resident.clear();
+  resident_bytes = 0;
+  needed.clear();
+  queue.clear();
+  in_flight.clear();
+  loaded.clear();
+  working.landmark_list.clear();
+  working.buildIndex();
+  demand_loads = prefetch_loads = failed_loads = eviction_count = 0;
+}
+
+int TiledMap::lowerBound(int tx, int ty, int lo) const {
+  int hi = static_cast<int>(tiles.size());
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    const TileEntry& e = tiles[mid];
+    if (e.ty < ty || (e.ty == ty && e.tx < tx)) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+bool TiledMap::readTile(int tile, std::vector<Map::single_landmark_s>& out) const {
+  const TileEntry& e = tiles[tile];
+  out.resize(e.count);
+  return e.count == 0 ||
+         preadAll(fd, &out[0], e.count * sizeof(Map::single_landmark_s),
+                  records_offset + e.first * sizeof(Map::single_landmark_s));
+}
+
+void TiledMap::tilesInBox(double min_x, double min_y, double max_x,
+                          double max_y, std::vector<int>& out) const {
+  int tx0 = static_cast<int>(floor((min_x - origin_x) / tile_size));
+  int tx1 = static_cast<int>(floor((max_x - origin_x) / tile_size));
+  int ty0 = static_cast<int>(floor((min_y - origin_y) / tile_size));
+  int ty1 = static_cast<int>(floor((max_y - origin_y) / tile_size));
+  // Walk the directory, sorted by (ty, tx), row by row: a row's tiles in
+  //   the box are contiguous, so empty coordinates are never probed and a
+  //   map-wide box costs one pass over the directory
+  const int num_tiles = static_cast<int>(tiles.size());
+  int k = lowerBound(tx0, ty0, 0);
+  while (k < num_tiles && tiles[k].ty <= ty1) {
+    const TileEntry& e = tiles[k];
+    if (e.tx < tx0) {
+      k = lowerBound(tx0, e.ty, k);
+    } else if (e.tx > tx1) {
+      k = lowerBound(tx0, e.ty + 1, k);
+    } else {
+      out.push_back(k++);
+    }
+  }
+}
+
+const Map& TiledMap::focus(const ParticleSet& particles, double sensor_range,
+                           double velocity, double yaw_rate) {
+  ++frame;
+  int n = particles.size();
+  if (fd < 0 || n == 0) {
+    return working;
+  }
+
+  // Bounding box and mean heading of the cloud
+  double min_x = particles.x[0], max_x = min_x;
+  double min_y = particles.y[0], max_y = min_y;
+  double sum_s = 0.0, sum_c = 0.0;
+  for (int i = 0; i < n; ++i) {
+    min_x = std::min(min_x, particles.x[i]);
+    max_x = std::max(max_x, particles.x[i]);
+    min_y = std::min(min_y, particles.y[i]);
+    max_y = std::max(max_y, particles.y[i]);
+  }
+  // The cloud is tight, a sample of the headings is enough
+  for (int i = 0; i < n; i += 16) {
+    double s, c;
+    fast_math::sincos(particles.theta[i], &s, &c);
+    sum_s += s;
+    sum_c += c;
+  }
+  double theta = atan2(sum_s, sum_c);
+
+  adoptPrefetched();
+
+  // Everything within sensor range of any particle
+  scratch.clear();
+  tilesInBox(min_x - sensor_range, min_y - sensor_range, max_x + sensor_range,
+             max_y + sensor_range, scratch);
+  size_t kept = 0;
+  for (size_t k = 0; k < scratch.size(); ++k) {
+    std::unordered_map<int, Tile>::iterator it = resident.find(scratch[k]);
+    if (it == resident.end()) {
+      Tile& tile = resident[scratch[k]];
+      // A short read would leave zeroed records; drop the tile and retry
+      //   it next frame instead
+      if (!readTile(scratch[k], tile.landmarks)) {
+        resident.erase(scratch[k]);
+        failed_loads++;
+        continue;
+      }
+      resident_bytes += tile.landmarks.size() * sizeof(Map::single_landmark_s);
+      demand_loads++;
+      it = resident.find(scratch[k]);
+    }
+    it->second.last_used = frame;
+    scratch[kept++] = scratch[k];
+  }
+  scratch.resize(kept);
+
+  // Tiles come out of tilesInBox in directory order, i.e. sorted
+  if (scratch != needed) {
+    needed.swap(scratch);
+    working.landmark_list.clear();
+    for (size_t k = 0; k < needed.size(); ++k) {
+      const std::vector<Map::single_landmark_s>& lms = resident[needed[k]].landmarks;
+      working.landmark_list.insert(working.landmark_list.end(), lms.begin(),
+                                   lms.end());
+    }
+    working.buildIndex();
+  }
+
+  prefetchAhead(min_x - sensor_range, min_y - sensor_range,
+                max_x + sensor_range, max_y + sensor_range, theta, velocity,
+                yaw_rate);
+  evict();
+  return working;
+}
+
+void TiledMap::adoptPrefetched() {
+  std::lock_guard<std::mutex> lock(mutex);
+  for (size_t k = 0; k < loaded.size(); ++k) {
+    int id = loaded[k].first;
+    in_flight.erase(id);
+    if (resident.count(id)) {
+      continue;
+    }
+    // Newer than anything not used this frame, but not pinned
+    Tile& tile = resident[id];
+    tile.landmarks.swap(loaded[k].second);
+    tile.last_used = frame - 1;
+    resident_bytes += tile.landmarks.size() * sizeof(Map::single_landmark_s);
+    prefetch_loads++;
+  }
+  loaded.clear();
+}
+
+void TiledMap::prefetchAhead(double min_x, double min_y, double max_x,
+                             double max_y, double theta, double velocity,
+                             double yaw_rate) {
+  if (horizon <= 0.0 || velocity == 0.0) {
+    return;
+  }
+  // Shift the current box along the CTRV path of the cloud's mean pose
+  scratch.clear();
+  for (int step = 1; step <= kPrefetchSteps; ++step) {
+    double t = horizon * step / kPrefetchSteps;
+    double dx, dy;
+    if (fabs(yaw_rate) > 0.00001) {
+      dx = velocity / yaw_rate * (sin(theta + yaw_rate * t) - sin(theta));
+      dy = velocity / yaw_rate * (cos(theta) - cos(theta + yaw_rate * t));
+    } else {
+      dx = velocity * t * cos(theta);
+      dy = velocity * t * sin(theta);
+    }
+    tilesInBox(min_x + dx, min_y + dy, max_x + dx, max_y + dy, scratch);
+  }
+
+  bool queued = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (size_t k = 0; k < scratch.size(); ++k) {
+      int id = scratch[k];
+      if (!resident.count(id) && !in_flight.count(id)) {
+        in_flight.insert(id);
+        queue.push_back(id);
+        queued = true;
+      }
+    }
+  }
+  if (queued) {
+    cv.notify_one();
+  }
+}
+
+void TiledMap::evict() {
+  // Least recently used first, never the tiles of this frame
+  while (resident_bytes > memory_limit) {
+    std::unordered_map<int, Tile>::iterator victim = resident.end();
+    for (std::unordered_map<int, Tile>::iterator it = resident.begin();
+         it != resident.end(); ++it) {
+      if (it->second.last_used != frame &&
+          (victim == resident.end() ||
+           it->second.last_used < victim->second.last_used)) {
+        victim = it;
+      }
+    }
+    if (victim == resident.end()) {
+      return;
+    }
+    resident_bytes -= victim->second.landmarks.size() * sizeof(Map::single_landmark_s);
+    resident.erase(victim);
+    eviction_count++;
+  }
+}
+
+void TiledMap::prefetchLoop() {
+  std::vector<Map::single_landmark_s> buffer;
+  for (;;) {
+    int id;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      cv.wait(lock, [this] { return stopping || !queue.empty(); });
+      if (stopping) {
+        return;
+      }
+      id = queue.front();
+      queue.erase(queue.begin());
+    }
+    bool ok = readTile(id, buffer);
+    std::lock_guard<std::mutex> lock(mutex);
+    if (ok) {
+      loaded.push_back(std::make_pair(id, std::vector<Map::single_landmark_s>()));
+      loaded.back().second.swap(buffer);
+    } else {
+      in_flight.erase(id);
+    }
+  }
+}
@@ -0,0 +1,163 @@
+/**
+ * tiled_map.h
+ * Streams a tiled map file so that only the landmarks around the particle
+ * cloud are resident.
+ *
+ * The map is cut into square tiles. Each frame, focus() makes every tile
+ * within sensor range of the cloud resident, loading synchronously only
+ * what the prefetcher has not already brought in, and hands the filter a
+ * Map of exactly those tiles. A background thread prefetches the tiles
+ * along the path the vehicle will take over the next few seconds,
+ * extrapolated from the velocity and yaw rate given to prediction().
+ * Resident tiles beyond the memory limit are evicted least recently used
+ * first; the tiles the current frame needs are never evicted.
+ */
+
+#ifndef TILED_MAP_H_
+#define TILED_MAP_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "map.h"
+#include "particle_set.h"
+
+class TiledMap {
+ public:
+  TiledMap();
+  ~TiledMap();
+
+  /**
+   * write Saves map in the tiled format.
+   * @param map Map to tile
+   * @param tile_size Tile edge length [m]
+   * @param filename Output file
+   * @output True if the file was written
+   */
+  static bool write(const Map& map, double tile_size, const std::string& filename);
+
+  /**
+   * isTiledMap Returns whether filename starts with the tiled map magic.
+   */
+  static bool isTiledMap(const std::string& filename);
+
+  /**
+   * open Reads the tile directory of a tiled map file; no landmarks are
+   *   loaded until focus() asks for them.
+   * @output False if the file could not be read or is not a tiled map
+   */
+  bool open(const std::string& filename);
+
+  /**
+   * setMemoryLimit Caps the bytes of resident landmark tiles (64 MB by
+   *   default). The tiles of the current frame stay resident regardless.
+   */
+  void setMemoryLimit(size_t bytes) {
+    memory_limit = bytes;
+  }
+
+  /**
+   * setPrefetchHorizon Sets how far ahead [s] tiles are prefetched along
+   *   the extrapolated path (2 s by default, 0 disables prefetching).
+   */
+  void setPrefetchHorizon(double seconds) {
+    horizon = seconds;
+  }
+
+  /**
+   * focus Makes the tiles within sensor_range of the particle cloud
+   *   resident and queues the tiles ahead for prefetching.
+   * @param particles Current particle set
+   * @param sensor_range Range [m] of sensor
+   * @param velocity Velocity of car [m/s], as given to prediction()
+   * @param yaw_rate Yaw rate of car [rad/s], as given to prediction()
+   * @output Map of the landmarks in the tiles around the cloud; the same
+   *   object on every call, rebuilt when the set of tiles changes
+   */
+  const Map& focus(const ParticleSet& particles, double sensor_range,
+                   double velocity, double yaw_rate);
+
+  // Statistics since open()
+  size_t residentBytes() const {
+    return resident_bytes;
+  }
+  unsigned long demandLoads() const {    // Tiles loaded synchronously
+    return demand_loads;
+  }
+  unsigned long prefetchLoads() const {  // Prefetched tiles taken into use
+    return prefetch_loads;
+  }
+  unsigned long failedLoads() const {    // Demand loads dropped on a read error
+    return failed_loads;
+  }
+  unsigned long evictions() const {
+    return eviction_count;
+  }
+
+ private:
+  struct TileEntry {
+    int32_t tx;
+    int32_t ty;
+    uint64_t first;  // Index of the tile's first landmark record
+    uint32_t count;
+    uint32_t reserved;
+  };
+
+  struct Tile {
+    std::vector<Map::single_landmark_s> landmarks;
+    unsigned long last_used;  // Frame that last needed the tile
+  };
+
+  TiledMap(const TiledMap&);
+  TiledMap& operator=(const TiledMap&);
+
+  void close();
+  // First directory entry at or after (tx, ty), searching from lo
+  int lowerBound(int tx, int ty, int lo) const;
+  bool readTile(int tile, std::vector<Map::single_landmark_s>& out) const;
+  void tilesInBox(double min_x, double min_y, double max_x, double max_y,
+                  std::vector<int>& out) const;
+  void adoptPrefetched();
+  void prefetchAhead(double min_x, double min_y, double max_x, double max_y,
+                     double theta, double velocity, double yaw_rate);
+  void evict();
+  void prefetchLoop();
+
+  int fd;
+  double tile_size;
+  double origin_x;
+  double origin_y;
+  uint64_t records_offset;      // File offset of the landmark records
+  std::vector<TileEntry> tiles;  // Non-empty tiles, sorted by (ty, tx)
+
+  std::unordered_map<int, Tile> resident;
+  size_t resident_bytes;
+  size_t memory_limit;
+  double horizon;
+  unsigned long frame;
+  std::vector<int> needed;       // Tiles of the current frame, sorted
+  std::vector<int> scratch;
+  Map working;
+
+  unsigned long demand_loads;
+  unsigned long prefetch_loads;
+  unsigned long failed_loads;
+  unsigned long eviction_count;
+
+  // Prefetcher state, guarded by mutex
+  std::thread prefetcher;
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::vector<int> queue;               // Tiles to load, oldest first
+  std::unordered_set<int> in_flight;    // Queued or being loaded
+  std::vector<std::pair<int, std::vector<Map::single_landmark_s> > > loaded;
+  bool stopping;
+};
+
+#endif  // TILED_MAP_H_